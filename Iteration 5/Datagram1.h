@@ -4,7 +4,11 @@
  * A work in progress.
  */
 
+#ifndef DATAGRAM1_H
+#define DATAGRAM1_H
+
 #include <vector>
+#include <algorithm>
 #include <exception>
 #include <cstring>
 #include <sys/errno.h>
@@ -12,6 +16,11 @@
 #include <sys/socket.h> 
 #include <arpa/inet.h> 
 #include <netinet/in.h> 
+#include <unistd.h>
+#include <stdexcept>
+#include <string>
+
+#define DATAGRAM_BATCH_MAX 64		/* Most datagrams moved by one batch call */
 
 class InetAddress
 {
@@ -27,11 +36,14 @@ public:
 	_address.sin_port = port;
 	_address.sin_addr.s_addr = address;
 	_length = std::min( data.size(), length );	// Take smaller value.
+	_truncated = false;
     }
 
     void * getData() const { return const_cast<void *>(static_cast<const void *>(_data.data())); }
     size_t getLength() const { return _length; }
-    void setLength( size_t length ) { _length = std::min( length, _data.size() ); }
+    /* Receivers pass the datagram's full length; anything past the buffer is cut off and flagged. */
+    void setLength( size_t length ) { _length = std::min( length, _data.size() ); _truncated = length > _data.size(); }
+    bool isTruncated() const { return _truncated; }
     in_addr_t getAddress() { return _address.sin_addr.s_addr; }
     in_port_t getPort() { return _address.sin_port; } 	// swap to host byte order.
     std::string getAddressAsString() const { return std::string( inet_ntoa( _address.sin_addr ) ); }
@@ -43,6 +55,7 @@ public:
 private:
     std::vector<uint8_t>& _data;	/* Don't copy data passed in constructor */
     size_t _length;
+    bool _truncated;
     struct sockaddr_in _address;
 };
 
@@ -57,13 +70,21 @@ public:
 
     /*
      * Open a socket and bind to a specific port.  The socket is attached to all interfaces.
+     * With reusePort, other sockets made the same way may bind the port too (SO_REUSEPORT) and
+     * the kernel spreads incoming datagrams across them, keeping each sender on one socket.
      */
     
-    DatagramSocket(in_port_t port) : socket_fd(socket(AF_INET, SOCK_DGRAM, 0)) {
+    DatagramSocket(in_port_t port, bool reusePort = false) : socket_fd(socket(AF_INET, SOCK_DGRAM, 0)) {
 	if ( socket_fd < 0 ) {
 	    throw std::runtime_error( std::string("socket creation failed: ") + strerror(errno) );
 	}
 
+	int reuse = 1;
+	if ( reusePort && setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0 ) {
+	    close( socket_fd );
+	    throw std::runtime_error( std::string("setsockopt SO_REUSEPORT failed: ") + strerror(errno) );
+	}
+
 	struct sockaddr_in address;
 	memset(&address, 0, sizeof(address)); 
        
@@ -81,6 +102,21 @@ public:
 	close( socket_fd );
     }
 
+    static bool canSharePort( int ) { return true; }
+
+    /*
+     * The port bound, in the same form the constructor takes: the one asked for, or the one the
+     * kernel picked if that was 0.
+     */
+    in_port_t localPort() const {
+	struct sockaddr_in address;
+	socklen_t length = sizeof(address);
+	if ( getsockname(socket_fd, (struct sockaddr *)&address, &length) < 0 ) {
+	    throw std::runtime_error( std::string("getsockname failed: ") + strerror(errno) );
+	}
+	return address.sin_port;
+    }
+
     ssize_t send( DatagramPacket& packet ) {
 	ssize_t sent = sendto( socket_fd, packet.getData(), packet.getLength(), 0, packet.address(), sizeof(*packet.address()) );
 	if ( sent == -1 ) {
@@ -89,16 +125,128 @@ public:
 	return sent;
     }
     
-    void receive( DatagramPacket& packet ) {
+    /*
+     * Wait at most ms milliseconds in receive() and receiveBatch().  0, the default, waits for ever.
+     */
+
+    void setSoTimeout( int ms ) {
+	struct timeval timeout = { ms / 1000, (ms % 1000) * 1000 };
+	if ( setsockopt( socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) ) < 0 ) {
+	    throw std::runtime_error( std::string("setsockopt failed: ") + strerror(errno) );
+	}
+    }
+
+    /*
+     * Returns false if the timeout expired, or a signal arrived, before a datagram.
+     */
+
+    bool receive( DatagramPacket& packet ) {
 	socklen_t len = sizeof(*packet.address());
-	int received = recvfrom(socket_fd, packet.getData(), MAXLINE, MSG_WAITALL, packet.address(), &len);
+	int received = recvfrom(socket_fd, packet.getData(), packet.end() - packet.begin(), MSG_TRUNC, packet.address(), &len);
 	if ( received < 0 ) {
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) {
+		return false;
+	    }
 	    throw std::runtime_error( std::string("recvfrom failed: ") + strerror(errno) );
 	}
 	packet.setLength(received);
+	return true;
     }
+
+    /*
+     * Receive without blocking.  Returns false if no datagram is waiting.
+     */
+
+    bool tryReceive( DatagramPacket& packet ) {
+	socklen_t len = sizeof(*packet.address());
+	int received = recvfrom(socket_fd, packet.getData(), packet.end() - packet.begin(), MSG_DONTWAIT | MSG_TRUNC, packet.address(), &len);
+	if ( received < 0 ) {
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+		return false;
+	    }
+	    throw std::runtime_error( std::string("recvfrom failed: ") + strerror(errno) );
+	}
+	packet.setLength(received);
+	return true;
+    }
+
+    /*
+     * Receive up to packets.size() datagrams (at most DATAGRAM_BATCH_MAX) with one system call,
+     * blocking until the first arrives.  Returns how many were received and sets their lengths;
+     * 0 if the timeout expired.
+     */
+
+    int receiveBatch( std::vector<DatagramPacket>& packets ) {
+	return receiveMany( packets, MSG_WAITFORONE | MSG_TRUNC );
+    }
+
+    /*
+     * As receiveBatch, but returns 0 instead of blocking.
+     */
+
+    int tryReceiveBatch( std::vector<DatagramPacket>& packets ) {
+	return receiveMany( packets, MSG_DONTWAIT | MSG_TRUNC );
+    }
+
+    /*
+     * Send every packet, each to its own address, DATAGRAM_BATCH_MAX per system call.
+     */
+
+    int sendBatch( std::vector<DatagramPacket>& packets ) {
+	size_t sent = 0;
+	while ( sent < packets.size() ) {
+	    struct mmsghdr messages[DATAGRAM_BATCH_MAX];
+	    struct iovec buffers[DATAGRAM_BATCH_MAX];
+	    size_t count = std::min( packets.size() - sent, static_cast<size_t>(DATAGRAM_BATCH_MAX) );
+	    memset( messages, 0, sizeof(messages) );
+	    for ( size_t i = 0; i < count; i++ ) {
+		DatagramPacket& packet = packets[sent + i];
+		buffers[i].iov_base = packet.getData();
+		buffers[i].iov_len = packet.getLength();
+		messages[i].msg_hdr.msg_iov = &buffers[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+		messages[i].msg_hdr.msg_name = packet.address();
+		messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	    }
+	    int n = sendmmsg( socket_fd, messages, count, 0 );
+	    if ( n < 0 ) {
+		throw std::runtime_error( std::string("sendmmsg failed: ") + strerror(errno) );
+	    }
+	    sent += n;
+	}
+	return sent;
+    }
+
+    int fd() const { return socket_fd; }
     
 private:
     int socket_fd;
-    static const size_t MAXLINE=1024;
+
+    int receiveMany( std::vector<DatagramPacket>& packets, int flags ) {
+	struct mmsghdr messages[DATAGRAM_BATCH_MAX];
+	struct iovec buffers[DATAGRAM_BATCH_MAX];
+	size_t count = std::min( packets.size(), static_cast<size_t>(DATAGRAM_BATCH_MAX) );
+	memset( messages, 0, sizeof(messages) );
+	for ( size_t i = 0; i < count; i++ ) {
+	    buffers[i].iov_base = packets[i].getData();
+	    buffers[i].iov_len = packets[i].end() - packets[i].begin();
+	    messages[i].msg_hdr.msg_iov = &buffers[i];
+	    messages[i].msg_hdr.msg_iovlen = 1;
+	    messages[i].msg_hdr.msg_name = packets[i].address();
+	    messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	int received = recvmmsg( socket_fd, messages, count, flags, nullptr );
+	if ( received < 0 ) {
+	    if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) {
+		return 0;
+	    }
+	    throw std::runtime_error( std::string("recvmmsg failed: ") + strerror(errno) );
+	}
+	for ( int i = 0; i < received; i++ ) {
+	    packets[i].setLength( messages[i].msg_len );
+	}
+	return received;
+    }
 };
+
+#endif // DATAGRAM1_H
@@ -0,0 +1,75 @@
+#ifndef ASSIGNMENT_H
+#define ASSIGNMENT_H
+
+#include <vector>
+#include <limits>
+#include <stdexcept>
+
+// Minimum-cost assignment of rows to distinct columns (Hungarian algorithm with potentials,
+// O(rows^2 * columns)). Needs rows <= columns. Returns the column chosen for each row.
+inline std::vector<int> solveAssignment(const std::vector<std::vector<long long>>& cost) {
+    int rows = cost.size();
+    if (rows == 0) {
+        return {};
+    }
+    int columns = cost[0].size();
+    if (rows > columns) {
+        throw std::runtime_error("Assignment needs at least as many columns as rows");
+    }
+
+    const long long INF = std::numeric_limits<long long>::max() / 4;
+    // 1-based as in the textbook formulation; column 0 is a virtual start.
+    std::vector<long long> rowPotential(rows + 1, 0), columnPotential(columns + 1, 0);
+    std::vector<int> rowOfColumn(columns + 1, 0), way(columns + 1, 0);
+
+    for (int row = 1; row <= rows; row++) {
+        rowOfColumn[0] = row;
+        int column = 0;
+        std::vector<long long> minSlack(columns + 1, INF);
+        std::vector<bool> used(columns + 1, false);
+        do {
+            used[column] = true;
+            int currentRow = rowOfColumn[column];
+            long long delta = INF;
+            int nextColumn = 0;
+            for (int j = 1; j <= columns; j++) {
+                if (!used[j]) {
+                    long long slack = cost[currentRow - 1][j - 1] - rowPotential[currentRow] - columnPotential[j];
+                    if (slack < minSlack[j]) {
+                        minSlack[j] = slack;
+                        way[j] = column;
+                    }
+                    if (minSlack[j] < delta) {
+                        delta = minSlack[j];
+                        nextColumn = j;
+                    }
+                }
+            }
+            for (int j = 0; j <= columns; j++) {
+                if (used[j]) {
+                    rowPotential[rowOfColumn[j]] += delta;
+                    columnPotential[j] -= delta;
+                } else {
+                    minSlack[j] -= delta;
+                }
+            }
+            column = nextColumn;
+        } while (rowOfColumn[column] != 0);
+
+        do {
+            int previous = way[column];
+            rowOfColumn[column] = rowOfColumn[previous];
+            column = previous;
+        } while (column != 0);
+    }
+
+    std::vector<int> assignment(rows, -1);
+    for (int j = 1; j <= columns; j++) {
+        if (rowOfColumn[j] != 0) {
+            assignment[rowOfColumn[j] - 1] = j - 1;
+        }
+    }
+    return assignment;
+}
+
+#endif // ASSIGNMENT_H
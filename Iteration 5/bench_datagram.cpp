@@ -0,0 +1,67 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Datagram1.h"
+#include "protocol.hpp"
+#include "uring_socket.hpp"
+
+#define BENCH_PORT 4800
+
+// Loopback packets per second: one call per packet against batches of DATAGRAM_BATCH_MAX, which
+// DatagramSocket makes with sendmmsg/recvmmsg and UringDatagramSocket with one submission and
+// multishot receive. Each round sends a burst of request-sized packets and reads it back on the
+// same thread, so the receive buffer never overflows and the figure is the cost of the calls
+// rather than of scheduling.
+template <typename Socket>
+static double packetsPerSecond(bool batched, double seconds) {
+    Socket receiver(BENCH_PORT);
+    Socket sender;
+
+    std::vector<std::vector<uint8_t>> outData(DATAGRAM_BATCH_MAX, std::vector<uint8_t>(REQUEST_PACKET_SIZE, 7));
+    std::vector<std::vector<uint8_t>> inData(DATAGRAM_BATCH_MAX, std::vector<uint8_t>(REQUEST_PACKET_SIZE));
+    std::vector<DatagramPacket> outgoing;
+    std::vector<DatagramPacket> incoming;
+    for (int i = 0; i < DATAGRAM_BATCH_MAX; i++) {
+        outgoing.emplace_back(outData[i], outData[i].size(), InetAddress::getLocalHost(), BENCH_PORT);
+        incoming.emplace_back(inData[i], inData[i].size());
+    }
+
+    long moved = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto stop = start + std::chrono::duration<double>(seconds);
+    while (std::chrono::steady_clock::now() < stop) {
+        if (batched) {
+            sender.sendBatch(outgoing);
+            for (int received = 0; received < DATAGRAM_BATCH_MAX;) {
+                received += receiver.receiveBatch(incoming);
+            }
+        } else {
+            for (DatagramPacket& packet : outgoing) {
+                sender.send(packet);
+            }
+            for (DatagramPacket& packet : incoming) {
+                receiver.receive(packet);
+            }
+        }
+        moved += DATAGRAM_BATCH_MAX;
+    }
+    return moved / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 2.0;
+    double single = packetsPerSecond<DatagramSocket>(false, seconds);
+    double batched = packetsPerSecond<DatagramSocket>(true, seconds);
+    double uringSingle = packetsPerSecond<UringDatagramSocket>(false, seconds);
+    double uringBatched = packetsPerSecond<UringDatagramSocket>(true, seconds);
+    std::cout << "single          : " << static_cast<long>(single) << " packets/s" << std::endl;
+    std::cout << "batched         : " << static_cast<long>(batched) << " packets/s (x" << batched / single << ")" << std::endl;
+    std::cout << "io_uring single : " << static_cast<long>(uringSingle) << " packets/s (x" << uringSingle / single << ")" << std::endl;
+    std::cout << "io_uring batched: " << static_cast<long>(uringBatched) << " packets/s (x" << uringBatched / single << ")" << std::endl;
+    if (std::thread::hardware_concurrency() < 2) {
+        std::cout << "(one CPU: the io_uring polling thread competes with this program for it)" << std::endl;
+    }
+}
@@ -0,0 +1,173 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Datagram1.h"
+#include "ring_queue.hpp"
+
+#define POOL_BUFFER_BYTES 64       // larger than any message in protocol.hpp
+#define POOL_BUFFER_COUNT 256      // a batch being received, the one handed out, and spares
+
+class BufferPool;
+
+// A receive buffer on loan from a BufferPool, returned to it when the handle is destroyed.
+// Move-only. *buffer is the message, sized to the bytes received.
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+
+    PooledBuffer(PooledBuffer&& other) noexcept
+        : pool(std::exchange(other.pool, nullptr)), slot(other.slot) {}
+
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept {
+        if (this != &other) {
+            release();
+            pool = std::exchange(other.pool, nullptr);
+            slot = other.slot;
+        }
+        return *this;
+    }
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    ~PooledBuffer() {
+        release();
+    }
+
+    explicit operator bool() const { return pool != nullptr; }
+
+    inline const std::vector<uint8_t>& operator*() const;
+    const std::vector<uint8_t>* operator->() const { return &**this; }
+
+    // The whole buffer, for a DatagramPacket to receive into, and the received length.
+    inline std::vector<uint8_t>& fill();
+    inline void setLength(size_t length);
+
+private:
+    friend class BufferPool;
+
+    BufferPool* pool = nullptr;
+    uint32_t slot = 0;
+
+    PooledBuffer(BufferPool* pool, uint32_t slot) : pool(pool), slot(slot) {}
+
+    inline void release();
+};
+
+// A fixed set of equal-sized buffers allocated once, so receiving allocates nothing. Buffers may
+// be taken and returned from any thread; the free list is a RingQueue of slot numbers.
+class BufferPool {
+private:
+    size_t bytes;
+    std::vector<std::vector<uint8_t>> slots;
+    RingQueue<uint32_t> free;
+
+    friend class PooledBuffer;
+
+public:
+    BufferPool(size_t count = POOL_BUFFER_COUNT, size_t bytes = POOL_BUFFER_BYTES)
+        : bytes(bytes), slots(count, std::vector<uint8_t>(bytes)), free(count < 2 ? 2 : count) {
+        for (uint32_t i = 0; i < count; i++) {
+            free.tryPush(i);
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // A full-sized buffer. Throws if every buffer is on loan, which means a holder kept one too long.
+    PooledBuffer acquire() {
+        std::optional<uint32_t> slot = free.tryPop();
+        if (!slot) {
+            throw std::runtime_error("receive buffer pool exhausted (" + std::to_string(slots.size()) + " buffers)");
+        }
+        slots[*slot].resize(bytes);
+        return PooledBuffer(this, *slot);
+    }
+
+    size_t bufferSize() const {
+        return bytes;
+    }
+};
+
+const std::vector<uint8_t>& PooledBuffer::operator*() const {
+    return pool->slots[slot];
+}
+
+std::vector<uint8_t>& PooledBuffer::fill() {
+    std::vector<uint8_t>& buffer = pool->slots[slot];
+    buffer.resize(pool->bytes);     // within the capacity reserved at construction
+    return buffer;
+}
+
+void PooledBuffer::setLength(size_t length) {
+    std::vector<uint8_t>& buffer = pool->slots[slot];
+    buffer.resize(std::min(length, buffer.size()));
+}
+
+void PooledBuffer::release() {
+    if (pool != nullptr) {
+        pool->free.tryPush(slot);
+        pool = nullptr;
+    }
+}
+
+// Pooled buffers for receiving up to DATAGRAM_BATCH_MAX datagrams with one call. Only one thread
+// may use a batch; threads reading the same socket each need their own.
+class BufferBatch {
+private:
+    BufferPool& pool;
+    std::vector<PooledBuffer> spare;
+    std::vector<PooledBuffer> received;
+    std::vector<DatagramPacket> packets;
+
+public:
+    BufferBatch(BufferPool& pool) : pool(pool) {
+        spare.reserve(DATAGRAM_BATCH_MAX);
+        received.reserve(DATAGRAM_BATCH_MAX);
+        packets.reserve(DATAGRAM_BATCH_MAX);
+    }
+
+    BufferBatch(const BufferBatch&) = delete;
+    BufferBatch& operator=(const BufferBatch&) = delete;
+
+    // Returns the previous batch to the pool and sets up full-sized packets to receive into.
+    std::vector<DatagramPacket>& prepare() {
+        received.clear();
+        while (spare.size() < DATAGRAM_BATCH_MAX) {
+            spare.push_back(pool.acquire());
+        }
+        packets.clear();
+        for (PooledBuffer& buffer : spare) {
+            std::vector<uint8_t>& bytes = buffer.fill();
+            packets.emplace_back(bytes, bytes.size());
+        }
+        return packets;
+    }
+
+    // Hands out the first `count` packets, less any that were truncated, which are counted in
+    // `truncated`. The buffers stay on loan until the next prepare() unless moved out.
+    std::vector<PooledBuffer>& take(int count, long& truncated) {
+        for (int i = 0; i < count; i++) {
+            if (packets[i].isTruncated()) {
+                truncated++;
+                continue;
+            }
+            spare[i].setLength(packets[i].getLength());
+            received.push_back(std::move(spare[i]));
+        }
+        spare.erase(std::remove_if(spare.begin(), spare.end(), [](const PooledBuffer& buffer) { return !buffer; }),
+                    spare.end());
+        return received;
+    }
+};
+
+#endif // BUFFER_POOL_H
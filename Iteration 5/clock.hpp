@@ -0,0 +1,157 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <memory>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include <iostream>
+
+// Time source for the simulation. Every motion, door and replay delay goes through a
+// Clock so the same binaries can run in real time, at a speed factor, or in virtual time.
+class Clock {
+public:
+    using duration = std::chrono::milliseconds;
+
+    virtual ~Clock() = default;
+
+    // Simulated time elapsed since the clock was created.
+    virtual duration now() const = 0;
+
+    // Blocks for a simulated duration.
+    virtual void sleepFor(duration d) = 0;
+
+    // Blocks for a simulated duration during which other processes, which keep real time, get
+    // to run, as when collecting the datagrams that arrive within a window.
+    virtual void waitFor(duration d) {
+        sleepFor(d);
+    }
+
+    void sleepUntil(duration t) {
+        duration current = now();
+        if (t > current) {
+            sleepFor(t - current);
+        }
+    }
+
+    virtual std::string name() const = 0;
+
+    static Clock& realTime();
+    static Clock& fromArgs(int argc, char* argv[]);
+};
+
+class RealClock : public Clock {
+private:
+    std::chrono::steady_clock::time_point start;
+
+public:
+    RealClock() : start(std::chrono::steady_clock::now()) {}
+
+    duration now() const override {
+        return std::chrono::duration_cast<duration>(std::chrono::steady_clock::now() - start);
+    }
+
+    void sleepFor(duration d) override {
+        std::this_thread::sleep_for(d);
+    }
+
+    std::string name() const override { return "real time"; }
+};
+
+// Runs simulated time `factor` times faster than the wall clock.
+class ScaledClock : public Clock {
+private:
+    std::chrono::steady_clock::time_point start;
+    double factor;
+
+public:
+    ScaledClock(double factor) : start(std::chrono::steady_clock::now()), factor(factor) {
+        if (factor <= 0) {
+            throw std::runtime_error("Clock speed factor must be positive");
+        }
+    }
+
+    duration now() const override {
+        std::chrono::duration<double, std::milli> real = std::chrono::steady_clock::now() - start;
+        return duration(static_cast<long long>(real.count() * factor));
+    }
+
+    void sleepFor(duration d) override {
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(d.count() / factor));
+    }
+
+    std::string name() const override { return std::to_string(factor) + "x speed"; }
+};
+
+// "As fast as possible" mode: sleeps return immediately and only advance simulated time.
+// Each thread keeps its own timeline, so one car's door wait never delays another car.
+class VirtualClock : public Clock {
+private:
+    unsigned long long clockId;
+
+    long long& threadTime() const {
+        thread_local std::map<unsigned long long, long long> elapsed;
+        return elapsed[clockId];
+    }
+
+    static unsigned long long nextId() {
+        static std::atomic<unsigned long long> ids{0};
+        return ++ids;
+    }
+
+public:
+    VirtualClock() : clockId(nextId()) {}
+
+    duration now() const override {
+        return duration(threadTime());
+    }
+
+    void sleepFor(duration d) override {
+        threadTime() += d.count();
+        std::this_thread::yield();
+    }
+
+    // Virtual time passes without anyone else running, so this waits `d` of real time too.
+    void waitFor(duration d) override {
+        std::this_thread::sleep_for(d);
+        threadTime() += d.count();
+    }
+
+    std::string name() const override { return "virtual time"; }
+};
+
+inline Clock& Clock::realTime() {
+    static RealClock clock;
+    return clock;
+}
+
+// Picks the clock from the command line: "--speed N" or "--virtual", real time otherwise. Exits
+// with usage if N is not a positive number.
+inline Clock& Clock::fromArgs(int argc, char* argv[]) {
+    static std::unique_ptr<Clock> selected;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--virtual") {
+            selected = std::make_unique<VirtualClock>();
+        } else if (arg == "--speed") {
+            char* end = nullptr;
+            double factor = i + 1 < argc ? std::strtod(argv[++i], &end) : 0;
+            if (end == nullptr || end == argv[i] || *end != '\0' || !std::isfinite(factor) || factor <= 0) {
+                std::cerr << "Usage: " << argv[0] << " [--speed N | --virtual] ...\n"
+                          << "  --speed N   run N times faster than real time, N > 0" << std::endl;
+                std::exit(1);
+            }
+            selected = std::make_unique<ScaledClock>(factor);
+        }
+    }
+    Clock& clock = selected ? *selected : realTime();
+    std::cout << "[Clock] Running in " << clock.name() << std::endl;
+    return clock;
+}
+
+#endif // CLOCK_H
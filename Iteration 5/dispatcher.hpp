@@ -0,0 +1,344 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <vector>
+#include <mutex>
+#include <limits>
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include "elevator_state.hpp"
+#include "elevator_event.hpp"
+#include "assignment.hpp"
+
+// Extra cost for a car that reports itself busy with work this dispatcher did not assign.
+#define BUSY_PENALTY_MS 10000
+// Cost that keeps a batch solver from giving a group to a car too small for it.
+#define UNFIT_COST_MS 1000000000LL
+// Calls one car can take in a batch solve, and calls solved together; bigger batches are
+// solved in parts, each seeing the cars as the parts before it left them.
+#define BATCH_CAR_SLOTS 4
+#define BATCH_SOLVE_MAX 64
+
+struct CarStatus {
+    int id;
+    int port;
+    int capacity = CAR_CAPACITY;
+    int lowestFloor = 1;            // floors the car serves, from its registration
+    int highestFloor = TOP_FLOOR;
+    int floor = 1;
+    Direction direction = Direction::Idle;
+    ElevatorState state = ElevatorState::Idle;
+    long long availableAt = 0;      // when the car finishes the calls already assigned to it
+    int availableFloor = 1;         // where it will be at that time
+};
+
+// Result of assigning a batch of pending calls at once.
+struct BatchPlan {
+    std::vector<int> cars;          // car index for each call, -1 if no car in service can take it
+    long long totalCost = 0;        // summed estimated arrival times of the optimal plan, ms
+    long long greedyCost = 0;       // the same calls assigned one at a time in arrival order, ms
+    double solveMicros = 0;
+};
+
+// Assigns each hall call to the car with the lowest estimated time to arrive. Car positions
+// come from the status packets elevators send with every display update; work the dispatcher
+// has handed out is projected forward so a burst of calls spreads across the fleet.
+class Dispatcher {
+private:
+    std::vector<CarStatus> cars;
+    mutable std::mutex mtx;
+
+    static long long tripTime(const ElevatorEvent& event) {
+        long long time = event.floorsToMove * FLOOR_TIME_MS + 3 * DOOR_STEP_MS + REST_TIME_MS;
+        if (event.fault == FaultType::Minor) {
+            time += DOOR_FAULT_MS;
+        }
+        return time;
+    }
+
+    static int destinationOf(const ElevatorEvent& event) {
+        return event.floorButton == Direction::Up ? event.floor + event.floorsToMove : event.floor - event.floorsToMove;
+    }
+
+    static bool serves(const CarStatus& car, const ElevatorEvent& event) {
+        int destination = destinationOf(event);
+        return event.floor >= car.lowestFloor && event.floor <= car.highestFloor
+            && destination >= car.lowestFloor && destination <= car.highestFloor;
+    }
+
+    long long estimate(const CarStatus& car, const ElevatorEvent& event, long long now) const {
+        if (car.state == ElevatorState::MajorFault || !serves(car, event)) {
+            return std::numeric_limits<long long>::max();
+        }
+        long long start = now;
+        int from = car.floor;
+        if (car.availableAt > now) {
+            start = car.availableAt;
+            from = car.availableFloor;
+        } else if (car.state == ElevatorState::MinorFault) {
+            start += DOOR_FAULT_MS;
+        } else if (car.state != ElevatorState::Idle) {
+            start += BUSY_PENALTY_MS;
+        }
+        return start - now + travelTime(from, event.floor);
+    }
+
+    void book(CarStatus& car, const ElevatorEvent& event, long long now, long long cost) {
+        car.availableAt = now + cost + tripTime(event);
+        car.availableFloor = destinationOf(event);
+    }
+
+    // One solve of assignBatch() for at most `active.size() * BATCH_CAR_SLOTS` calls. Caller
+    // holds mtx.
+    BatchPlan assignPart(const std::vector<ElevatorEvent>& calls, const std::vector<int>& active, long long now) {
+        BatchPlan plan;
+        plan.cars.assign(calls.size(), -1);
+
+        // Calls no car can take stay unassigned and out of the solve, where they would take slots.
+        std::vector<size_t> fit;
+        std::vector<std::vector<long long>> etas(calls.size(), std::vector<long long>(active.size()));
+        for (size_t i = 0; i < calls.size(); i++) {
+            bool anyFit = false;
+            for (size_t c = 0; c < active.size(); c++) {
+                long long eta = estimate(cars[active[c]], calls[i], now);
+                if (eta >= UNFIT_COST_MS || cars[active[c]].capacity < calls[i].passengers) {
+                    eta = UNFIT_COST_MS;
+                }
+                etas[i][c] = eta;
+                anyFit |= eta < UNFIT_COST_MS;
+            }
+            if (anyFit) {
+                fit.push_back(i);
+            }
+        }
+        if (fit.empty()) {
+            return plan;
+        }
+
+        int slots = std::min<int>(fit.size(), BATCH_CAR_SLOTS);
+        long long slotDelay = 0;
+        for (size_t i : fit) {
+            slotDelay += tripTime(calls[i]);
+        }
+        slotDelay /= fit.size();
+
+        // Column c * slots + k is the k-th call served by active car c; row r is call fit[r].
+        std::vector<std::vector<long long>> cost(fit.size(), std::vector<long long>(active.size() * slots));
+        for (size_t r = 0; r < fit.size(); r++) {
+            for (size_t c = 0; c < active.size(); c++) {
+                for (int k = 0; k < slots; k++) {
+                    cost[r][c * slots + k] = etas[fit[r]][c] + k * slotDelay;
+                }
+            }
+        }
+        std::vector<int> columns = solveAssignment(cost);
+
+        std::vector<int> taken(active.size(), 0);
+        for (size_t r = 0; r < fit.size(); r++) {
+            int best = -1;
+            for (size_t c = 0; c < active.size(); c++) {
+                if (taken[c] < slots && (best < 0 || cost[r][c * slots + taken[c]] < cost[r][best * slots + taken[best]])) {
+                    best = c;
+                }
+            }
+            plan.greedyCost += cost[r][best * slots + taken[best]];
+            taken[best]++;
+        }
+
+        // Book each car's calls in slot order so its projection covers them one after another.
+        // A call may still land on a car unfit for it if the fit ones are full; it is left over.
+        std::vector<size_t> order(fit.size());
+        for (size_t r = 0; r < order.size(); r++) {
+            order[r] = r;
+        }
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return columns[a] % slots < columns[b] % slots; });
+        for (size_t r : order) {
+            plan.totalCost += cost[r][columns[r]];
+            if (cost[r][columns[r]] >= UNFIT_COST_MS) {
+                continue;
+            }
+            size_t i = fit[r];
+            int car = active[columns[r] / slots];
+            plan.cars[i] = car;
+            book(cars[car], calls[i], now, estimate(cars[car], calls[i], now));
+        }
+        return plan;
+    }
+
+public:
+    // Time for an idle car to reach a floor and open its doors.
+    static long long travelTime(int from, int to) {
+        long long travel = std::abs(from - to) * FLOOR_TIME_MS;
+        if (from != to) {
+            travel += 3 * DOOR_STEP_MS;
+        }
+        return travel;
+    }
+
+    void addCar(int id, int port, int capacity = CAR_CAPACITY) {
+        std::lock_guard<std::mutex> lock(mtx);
+        CarStatus car;
+        car.id = id;
+        car.port = port;
+        car.capacity = capacity;
+        cars.push_back(car);
+    }
+
+    // Adds a car that registered itself, or updates one with the same ID that registered before
+    // or was added by addCar, keeping its position. Returns its index.
+    int registerCar(int id, int port, int capacity, int lowestFloor, int highestFloor) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find_if(cars.begin(), cars.end(), [id](const CarStatus& car) { return car.id == id; });
+        if (it == cars.end()) {
+            it = cars.insert(cars.end(), CarStatus());
+            it->id = id;
+        }
+        it->port = port;
+        it->capacity = capacity;
+        it->lowestFloor = lowestFloor;
+        it->highestFloor = highestFloor;
+        return it - cars.begin();
+    }
+
+    void updateStatus(int id, int floor, Direction direction, ElevatorState state) {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (CarStatus& car : cars) {
+            if (car.id == id) {
+                car.floor = floor;
+                car.direction = direction;
+                car.state = state;
+            }
+        }
+    }
+
+    // Reads the packet built by Elevator::sendDisplayUpdate: id, floor low byte, direction, state,
+    // then the floor's high byte, which 4-byte packets leave out.
+    void updateStatus(const std::vector<uint8_t>& packet) {
+        if (packet.size() < 4) {
+            return;
+        }
+        Direction direction = packet[2] == 1 ? Direction::Up : packet[2] == 2 ? Direction::Down : Direction::Idle;
+        int floor = packet[1] | (packet.size() > 4 ? packet[4] << 8 : 0);
+        updateStatus(packet[0], floor, direction, static_cast<ElevatorState>(packet[3]));
+    }
+
+    // True if the car at `index` covers both floors of the call and has room for its passengers.
+    bool serves(int index, const ElevatorEvent& event) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return serves(cars[index], event) && cars[index].capacity >= event.passengers;
+    }
+
+    long long estimateArrival(int index, const ElevatorEvent& event, long long now) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return estimate(cars[index], event, now);
+    }
+
+    // Time for the car at `index` to reach the call straight from where it is now. Unlike
+    // estimateArrival() it ignores the work booked against the car, which may be this very call.
+    long long arrivalFromPosition(int index, const ElevatorEvent& event) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        const CarStatus& car = cars[index];
+        if (car.state == ElevatorState::MajorFault || !serves(car, event)) {
+            return std::numeric_limits<long long>::max();
+        }
+        return (car.state == ElevatorState::MinorFault ? DOOR_FAULT_MS : 0) + travelTime(car.floor, event.floor);
+    }
+
+    // Picks the car with the lowest estimated time to arrive and books the call against it.
+    // Returns the index of the car, or -1 if every car is out of service, too small, excluded or
+    // not serving the floors of the call.
+    int assign(const ElevatorEvent& event, long long now, const std::vector<int>& exclude = {}) {
+        std::lock_guard<std::mutex> lock(mtx);
+        int best = -1;
+        long long bestCost = std::numeric_limits<long long>::max();
+        for (size_t i = 0; i < cars.size(); i++) {
+            if (cars[i].capacity < event.passengers
+                    || std::find(exclude.begin(), exclude.end(), static_cast<int>(i)) != exclude.end()) {
+                continue;
+            }
+            long long cost = estimate(cars[i], event, now);
+            if (cost < bestCost) {
+                best = i;
+                bestCost = cost;
+            }
+        }
+        if (best >= 0) {
+            book(cars[best], event, now, bestCost);
+        }
+        return best;
+    }
+
+    // Books the call against a specific car, e.g. one that stole it from another car.
+    void assignTo(int index, const ElevatorEvent& event, long long now) {
+        std::lock_guard<std::mutex> lock(mtx);
+        book(cars[index], event, now, estimate(cars[index], event, now));
+    }
+
+    // Assigns all calls together with minimum total estimated arrival time. A car that takes k
+    // calls serves them in turn, so its k-th call waits k average trips longer. Each car takes
+    // at most BATCH_CAR_SLOTS calls per solve, which keeps a solve to O(calls^2 * cars).
+    BatchPlan assignBatch(const std::vector<ElevatorEvent>& calls, long long now) {
+        std::lock_guard<std::mutex> lock(mtx);
+        BatchPlan plan;
+        plan.cars.assign(calls.size(), -1);
+        std::vector<int> active;
+        for (size_t i = 0; i < cars.size(); i++) {
+            if (cars[i].state != ElevatorState::MajorFault) {
+                active.push_back(i);
+            }
+        }
+        if (calls.empty() || active.empty()) {
+            return plan;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t part = std::min<size_t>(BATCH_SOLVE_MAX, active.size() * BATCH_CAR_SLOTS);
+        for (size_t first = 0; first < calls.size(); first += part) {
+            std::vector<ElevatorEvent> chunk(calls.begin() + first, calls.begin() + std::min(calls.size(), first + part));
+            BatchPlan partPlan = assignPart(chunk, active, now);
+            std::copy(partPlan.cars.begin(), partPlan.cars.end(), plan.cars.begin() + first);
+            plan.totalCost += partPlan.totalCost;
+            plan.greedyCost += partPlan.greedyCost;
+        }
+        plan.solveMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        return plan;
+    }
+
+    // Largest group any car in service can take in one trip, 0 if none is in service.
+    int largestCapacity() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        int largest = 0;
+        for (const CarStatus& car : cars) {
+            if (car.state != ElevatorState::MajorFault) {
+                largest = std::max(largest, car.capacity);
+            }
+        }
+        return largest;
+    }
+
+    // Index of the car with elevator ID `id`, or -1.
+    int indexOf(int id) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t i = 0; i < cars.size(); i++) {
+            if (cars[i].id == id) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    CarStatus getCar(int index) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return cars[index];
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return cars.size();
+    }
+};
+
+#endif // DISPATCHER_H
@@ -27,7 +27,7 @@ std::string dirToStr(int d) {
 }
 
 int main() {
-    DatagramSocket displaySocket(DISPLAY_PORT);
+    ELEVATOR_TRANSPORT displaySocket(DISPLAY_PORT);
     std::map<int, std::tuple<int, std::string, std::string>> statusMap;
 
     while (true) {
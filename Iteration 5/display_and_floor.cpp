@@ -34,7 +34,7 @@ int main() {
     std::thread floorThread(std::ref(floorReader));
     floorThread.join();
 
-    DatagramSocket displaySocket(DISPLAY_PORT);
+    ELEVATOR_TRANSPORT displaySocket(DISPLAY_PORT);
     std::map<int, std::tuple<int, std::string, std::string>> statusMap;
 
     int event = 0;
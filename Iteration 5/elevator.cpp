@@ -1,29 +1,99 @@
 #include <chrono>
 #include <thread>
+#include <climits>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 #include <unistd.h>
 #include "elevator.hpp"
 #include "elevator_event.hpp"
+#include "socket_stats.hpp"
 
-int main() {
+int main(int argc, char* argv[]) {
+    Clock& clock = Clock::fromArgs(argc, argv);
 
-    Elevator<ElevatorEvent> elevator1(69, 1);
-    Elevator<ElevatorEvent> elevator2(70, 2);
-    Elevator<ElevatorEvent> elevator3(471, 3);
-    Elevator<ElevatorEvent> elevator4(472, 4);
+    // --banks N: report to the scheduler shard of each car's bank, as ./scheduler --banks N expects.
+    // --stats [N]: print drops on the cars' ports and their queued calls every N ms.
+    // --cars N: run N cars on ports the kernel picks instead of the four on ELEVATOR_1..4.
+    int banks = 1;
+    int fleet = 0;
+    int statsInterval = 0;
 
-    std::thread elevator1Thread(std::ref(elevator1));
-    std::thread elevator2Thread(std::ref(elevator2));
-    std::thread elevator3Thread(std::ref(elevator3));
-    std::thread elevator4Thread(std::ref(elevator4));
-    
-    elevator1Thread.join();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    elevator2Thread.join();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    elevator3Thread.join();
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    elevator4Thread.join();
+    // The argument at `i` as a whole number from `low` to `high`; false if it is missing or not one.
+    auto number = [&](int i, long low, long high, int& value) {
+        char* end = nullptr;
+        long parsed = i < argc ? std::strtol(argv[i], &end, 10) : 0;
+        if (end == nullptr || end == argv[i] || *end != '\0' || parsed < low || parsed > high) {
+            return false;
+        }
+        value = parsed;
+        return true;
+    };
+    auto usage = [&](const std::string& option, const std::string& meaning) {
+        std::cerr << "Usage: " << argv[0] << " [" << option << "] ...\n  " << option << "   " << meaning << std::endl;
+        return 1;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            statsInterval = STATS_INTERVAL_MS;
+            if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0 && !number(i + 1, 1, INT_MAX, statsInterval)) {
+                return usage("--stats [N]", "print drops on the cars' ports and their queued calls every N ms, N > 0");
+            }
+        } else if (arg == "--banks") {
+            if (!number(i + 1, 1, MAX_BANKS, banks)) {
+                return usage("--banks 1-" + std::to_string(MAX_BANKS), "report to the scheduler bank of each car, as ./scheduler --banks N expects");
+            }
+        } else if (arg == "--cars") {
+            if (!number(i + 1, 0, 255, fleet)) {
+                return usage("--cars 0-255", "run N cars on ports the kernel picks, 0 for the four on ELEVATOR_1..4");
+            }
+        }
+    }
+
+    // Each car registers with the scheduler before taking calls, waiting for it if need be.
+    const int ports[] = { ELEVATOR_1, ELEVATOR_2, ELEVATOR_3, ELEVATOR_4 };
+    std::vector<std::unique_ptr<Elevator<ElevatorEvent>>> cars;
+    try {
+        for (int i = 0; i < (fleet > 0 ? fleet : 4); i++) {
+            cars.emplace_back(new Elevator<ElevatorEvent>(fleet > 0 ? 0 : ports[i], i + 1, clock));
+            cars.back()->reportToBank(i % banks);
+        }
+    } catch (const std::runtime_error& e) {
+        std::cerr << "[Elevator] " << e.what() << std::endl;
+        return 1;
+    }
+    std::vector<std::thread> threads;
+    for (std::unique_ptr<Elevator<ElevatorEvent>>& car : cars) {
+        Elevator<ElevatorEvent>* elevator = car.get();
+        threads.emplace_back([elevator] {
+            elevator->registerWithScheduler();
+            (*elevator)();
+        });
+    }
+
+    if (statsInterval > 0) {
+        std::vector<int> carPorts;
+        for (std::unique_ptr<Elevator<ElevatorEvent>>& car : cars) {
+            carPorts.push_back(car->getPort());
+        }
+        SocketStats stats(carPorts);
+        stats.addGauge("queued calls", [&] {
+            std::string queued;
+            for (std::unique_ptr<Elevator<ElevatorEvent>>& car : cars) {
+                queued += (queued.empty() ? "" : " ") + std::to_string(car->getQueuedCalls());
+            }
+            return queued;
+        });
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(statsInterval));
+            stats.print();
+        }
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
 }
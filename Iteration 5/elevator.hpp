@@ -4,11 +4,16 @@
 #include <iostream>
 #include <thread>
 #include <chrono>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "scheduler.hpp"
 #include "elevator_event.hpp"
+#include "clock.hpp"
+#include "elevator_state.hpp"
 
-enum class ElevatorState { Idle, MovingUp, MovingDown, DoorOpening, DoorOpen, DoorClosing, MinorFault, MajorFault };
-enum class Direction { Up, Down, Idle };
 struct DisplayEvent {
     int elevatorID;
     int floor;
@@ -16,44 +21,75 @@ struct DisplayEvent {
     std::string status;
 };
 
+// A hall call queued for collective control.
 template <typename Type>
+struct Rider {
+    Type request;
+    int destination;
+    bool onBoard;
+};
+
+template <typename Type, typename Transport = ELEVATOR_TRANSPORT>
 class Elevator {
 private:
-    ElevatorState state;
+    std::atomic<ElevatorState> state;
     Direction direction;
     int currentFloor;
-    DatagramSocket receiveSocket;
-    DatagramSocket sendSocket;
+    Transport receiveSocket;
+    Transport sendSocket;
     int id;
-    const int MAX_CAPACITY = 4;
-
-
-    bool moveByFloors(int floorsToMove, const std::string& directionStr, int passengers) {
-        int targetFloor = (directionStr == "Up") ? currentFloor + floorsToMove : currentFloor - floorsToMove;
+    Clock& clock;
+    const int MAX_CAPACITY;
+    int notifierPort = FLOORNOTIFIER;       // replies, work requests
+    int statusPort = ELEVATOR_STATUS;
+    int lowestFloor = 1;                    // floors served, announced when registering
+    int highestFloor = TOP_FLOOR;
+    int receiveTimeoutMs = 0;
+    BufferPool receiveBuffers{4};           // the packet being handled, and the next
+
+    // Collective control (LOOK): stops served while sweeping up and while sweeping down.
+    std::mutex stopMutex;
+    std::condition_variable stopCv;
+    std::set<int> upStops;
+    std::set<int> downStops;
+    std::vector<Rider<Type>> riders;
+    Direction sweep = Direction::Idle;
+    int load = 0;
+
+    // Recently queued request IDs, so a retransmitted request is acknowledged but not queued twice.
+    std::set<int> seenRequests;
+    std::deque<int> seenOrder;
+
+
+    bool moveByFloors(int floorsToMove, Direction travel, int passengers) {
+        int targetFloor = travel == Direction::Up ? currentFloor + floorsToMove : currentFloor - floorsToMove;
         std::cout << "[Elevator" << id << "] Moving from Floor " << currentFloor 
                   << " to Floor " << targetFloor << std::endl
                   << "[Elevator" << id << "] Has Passengers: " << passengers << std::endl;
 
-        auto startTime = std::chrono::steady_clock::now();     
+        auto startTime = clock.now();     
 
         while (currentFloor != targetFloor) {
             if (currentFloor < targetFloor) {
                 currentFloor++;
                 state = ElevatorState::MovingUp;
+                direction = Direction::Up;
                 sendDisplayUpdate();
                 std::cout << "[Elevator" << id << "] Moving up: " << currentFloor << std::endl;
             } else {
                 currentFloor--;
                 state = ElevatorState::MovingDown;
+                direction = Direction::Down;
                 sendDisplayUpdate();
                 std::cout << "[Elevator" << id << "] Moving down: " << currentFloor << std::endl;
             }
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            clock.sleepFor(std::chrono::seconds(1));
 
-            auto elapsedTime = std::chrono::steady_clock::now() - startTime;
+            auto elapsedTime = clock.now() - startTime;
             auto elapsedSeconds = std::chrono::duration_cast<std::chrono::seconds>(elapsedTime).count();
 
         }
+        direction = Direction::Idle;
         return true;
     }
 
@@ -63,22 +99,22 @@ private:
 
         std::cout << "[Elevator" << id << "] Doors opening at floor: " << currentFloor << std::endl;
 
-        auto startTime = std::chrono::steady_clock::now(); // Start timer
+        auto startTime = clock.now(); // Start timer
 
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        clock.sleepFor(std::chrono::seconds(1));
 
         state = ElevatorState::DoorOpen;
         sendDisplayUpdate();
         std::cout << "[Elevator" << id << "] Boarding at floor: " << currentFloor << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        clock.sleepFor(std::chrono::seconds(1));
 
         state = ElevatorState::DoorClosing;
         sendDisplayUpdate();
         std::cout << "[Elevator" << id << "] Doors closing at floor: " << currentFloor << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+        clock.sleepFor(std::chrono::seconds(1));
         state = ElevatorState::Idle;
         sendDisplayUpdate();
-        auto elapsedTime = std::chrono::steady_clock::now() - startTime;
+        auto elapsedTime = clock.now() - startTime;
         auto elapsedSeconds = std::chrono::duration_cast<std::chrono::seconds>(elapsedTime).count();
 
         return true;
@@ -93,7 +129,7 @@ private:
 
     void handleDoorFault() {
         state = ElevatorState::MinorFault;
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+        clock.sleepFor(std::chrono::seconds(2));
         std::cout << "[Elevator" << id << "] Door Timer Fault: Door is stuck!" << std::endl;
         sendDisplayUpdate();
         recoverDoor();
@@ -101,21 +137,226 @@ private:
 
     void recoverDoor() {
         std::cout << "[Elevator" << id << "] Attempting to recover door..." << std::endl;
-        std::this_thread::sleep_for(std::chrono::seconds(10));
+        clock.sleepFor(std::chrono::seconds(10));
         state = ElevatorState::Idle;
         sendDisplayUpdate();
         std::cout << "[Elevator" << id << "] Door recovered successfully!" << std::endl;
     }
 
+    static int destinationOf(const Type& item) {
+        return item.floorButton == Direction::Up ? item.floor + item.floorsToMove : item.floor - item.floorsToMove;
+    }
+
+    // Rebuilds both stop sets from the riders. Pickups that would not fit right now are left
+    // out until enough passengers get off. Caller holds stopMutex.
+    void refreshStops() {
+        upStops.clear();
+        downStops.clear();
+        for (const Rider<Type>& rider : riders) {
+            std::set<int>& stops = rider.request.floorButton == Direction::Up ? upStops : downStops;
+            if (rider.onBoard) {
+                stops.insert(rider.destination);
+            } else if (load + rider.request.passengers <= MAX_CAPACITY) {
+                stops.insert(rider.request.floor);
+            }
+        }
+    }
+
+    // LOOK: keep going in the sweep direction while there are stops ahead, otherwise turn
+    // around. Caller holds stopMutex and has checked that there is at least one stop.
+    int nextStop() {
+        if (sweep == Direction::Idle) {
+            int nearest = upStops.empty() ? *downStops.begin() : *upStops.begin();
+            for (int floor : upStops) {
+                if (std::abs(floor - currentFloor) < std::abs(nearest - currentFloor)) nearest = floor;
+            }
+            for (int floor : downStops) {
+                if (std::abs(floor - currentFloor) < std::abs(nearest - currentFloor)) nearest = floor;
+            }
+            if (nearest != currentFloor) {
+                sweep = nearest > currentFloor ? Direction::Up : Direction::Down;
+            } else {
+                sweep = upStops.count(nearest) ? Direction::Up : Direction::Down;
+            }
+        }
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (sweep == Direction::Up) {
+                auto ahead = upStops.lower_bound(currentFloor);
+                if (ahead != upStops.end()) return *ahead;
+                if (!downStops.empty() && *downStops.rbegin() >= currentFloor) return *downStops.rbegin();
+                sweep = Direction::Down;
+            } else {
+                auto ahead = downStops.upper_bound(currentFloor);
+                if (ahead != downStops.begin()) return *std::prev(ahead);
+                if (!upStops.empty() && *upStops.begin() <= currentFloor) return *upStops.begin();
+                sweep = Direction::Up;
+            }
+        }
+        return currentFloor;
+    }
+
+    void moveOneFloor(Direction towards) {
+        direction = towards;
+        if (towards == Direction::Up) {
+            currentFloor++;
+            state = ElevatorState::MovingUp;
+        } else {
+            currentFloor--;
+            state = ElevatorState::MovingDown;
+        }
+        sendDisplayUpdate();
+        std::cout << "[Elevator" << id << "] Passing floor: " << currentFloor << std::endl;
+        clock.sleepFor(std::chrono::seconds(1));
+    }
+
+    // Takes the car out of service on reaching a call with a major fault. Calls still waiting
+    // are refused, so the scheduler gives them to other cars; the riders on board and the
+    // faulted call are reported stranded.
+    void failServing(const std::vector<Rider<Type>>& stranded) {
+        for (const Rider<Type>& rider : stranded) {
+            bool waiting = !rider.onBoard && rider.request.fault != FaultType::Major;
+            sendReply(MSG_NACK, rider.request.requestId, waiting ? NACK_OUT_OF_SERVICE : NACK_STRANDED);
+        }
+        handleFloorFault();
+    }
+
+    // Opens the doors at the current floor, lets off riders who have arrived and boards the
+    // riders travelling in the sweep direction that fit.
+    void serveFloor() {
+        std::vector<Type> boarding;
+        std::vector<Type> leaving;
+        {
+            std::unique_lock<std::mutex> lock(stopMutex);
+            std::set<int>& ahead = sweep == Direction::Up ? upStops : downStops;
+            if (!ahead.count(currentFloor)) {
+                // This stop only has calls going the other way: turn around here.
+                sweep = sweep == Direction::Up ? Direction::Down : Direction::Up;
+            }
+            Direction serving = sweep == Direction::Up ? Direction::Up : Direction::Down;
+            for (const Rider<Type>& rider : riders) {
+                if (!rider.onBoard && rider.request.floor == currentFloor && rider.request.floorButton == serving
+                        && rider.request.fault == FaultType::Major && load + rider.request.passengers <= MAX_CAPACITY) {
+                    std::vector<Rider<Type>> stranded;
+                    stranded.swap(riders);
+                    load = 0;
+                    refreshStops();
+                    state = ElevatorState::MajorFault;
+                    lock.unlock();
+                    failServing(stranded);
+                    return;
+                }
+            }
+            for (auto it = riders.begin(); it != riders.end();) {
+                if (it->onBoard && it->destination == currentFloor) {
+                    load -= it->request.passengers;
+                    leaving.push_back(it->request);
+                    it = riders.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (Rider<Type>& rider : riders) {
+                if (!rider.onBoard && rider.request.floor == currentFloor && rider.request.floorButton == serving
+                        && load + rider.request.passengers <= MAX_CAPACITY) {
+                    rider.onBoard = true;
+                    load += rider.request.passengers;
+                    boarding.push_back(rider.request);
+                }
+            }
+            refreshStops();
+        }
+
+        direction = Direction::Idle;
+        for (const Type& item : boarding) {
+            if (item.fault == FaultType::Minor) {
+                handleDoorFault();
+                break;
+            }
+        }
+        doorOperations();
+        for (const Type& item : leaving) {
+            std::cout << "[Elevator" << id << "] Dropped off " << item.passengers << " at floor " << currentFloor << std::endl;
+            sendReply(MSG_COMPLETE, item.requestId);
+        }
+        for (const Type& item : boarding) {
+            std::cout << "[Elevator" << id << "] Picked up " << item.passengers << " at floor " << currentFloor << std::endl;
+            sendReply(MSG_PICKUP, item.requestId);
+        }
+    }
+
 public:
-    Elevator(int PORT, int id)
+    Elevator(int PORT, int id, Clock& clock = Clock::realTime(), int capacity = CAR_CAPACITY)
         : state(ElevatorState::Idle), direction(Direction::Idle), 
-        currentFloor(1), receiveSocket(PORT), id(id) {}
+        currentFloor(1), receiveSocket(PORT), id(id), clock(clock), MAX_CAPACITY(capacity) {
+        if (getPort() == 0) {
+            throw std::runtime_error("Transport picks no port for Elevator" + std::to_string(id) + "; pass one");
+        }
+    }
+
+    // Sends replies and status packets to the scheduler shard serving `bank`.
+    void reportToBank(int bank) {
+        notifierPort = FLOORNOTIFIER + bank * BANK_PORT_STRIDE;
+        statusPort = ELEVATOR_STATUS + bank * BANK_PORT_STRIDE;
+    }
+
+    // Announces only floors `lowest` to `highest` when registering, so the scheduler sends no
+    // calls outside them.
+    void serveFloors(int lowest, int highest) {
+        lowestFloor = lowest;
+        highestFloor = highest;
+    }
+
+    // The port the scheduler reaches this car on; the kernel's choice if it was made with port 0.
+    int getPort() const { return receiveSocket.localPort(); }
+
+    // Tells the scheduler this car exists (ID, port, capacity, floors served) and waits for it to
+    // confirm, asking again every STARTUP_RETRY_MS, so a car started before the scheduler is
+    // still known to it. Calls sent meanwhile are queued as usual. Gives up after `attempts`
+    // asks, 0 for never, and returns false.
+    bool registerWithScheduler(int attempts = 0) {
+        int port = getPort();
+        std::vector<uint8_t> data = { 0x0, MSG_REGISTER, static_cast<uint8_t>(id),
+                                      static_cast<uint8_t>(port >> 8 & 0xFF), static_cast<uint8_t>(port & 0xFF),
+                                      static_cast<uint8_t>(MAX_CAPACITY),
+                                      static_cast<uint8_t>(lowestFloor >> 8 & 0xFF), static_cast<uint8_t>(lowestFloor & 0xFF),
+                                      static_cast<uint8_t>(highestFloor >> 8 & 0xFF), static_cast<uint8_t>(highestFloor & 0xFF) };
+        receiveSocket.setSoTimeout(STARTUP_RETRY_MS);
+        bool registered = false;
+        for (int attempt = 0; !registered && (attempts == 0 || attempt < attempts); attempt++) {
+            if (attempt == 1) {
+                std::cout << "[Elevator" << id << "] Waiting for the scheduler" << std::endl;
+            }
+            sendPacket(data, data.size(), InetAddress::getLocalHost(), statusPort);
+            auto retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(STARTUP_RETRY_MS);
+            while (!registered && std::chrono::steady_clock::now() < retry) {
+                PooledBuffer packet = receiveBuffer();
+                if (!packet) {
+                    break;
+                }
+                if (packet->size() >= 3 && (*packet)[0] == 0 && (*packet)[1] == MSG_REGISTERED && (*packet)[2] == id) {
+                    registered = true;
+                } else {
+                    handlePacket(*packet);
+                }
+            }
+        }
+        receiveSocket.setSoTimeout(receiveTimeoutMs);
+        if (registered) {
+            std::cout << "[Elevator" << id << "] Registered with the scheduler on port " << port << std::endl;
+        }
+        return registered;
+    }
 
     int getCurrentFloor() const { return currentFloor; }
 
     ElevatorState getState() const { return state; }
 
+    // Calls queued for this car, waiting or on board.
+    size_t getQueuedCalls() {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        return riders.size();
+    }
+
     void sendDisplayUpdate() {
         std::vector<uint8_t> data;
         data.push_back(id); // elevator ID
@@ -125,10 +366,13 @@ public:
         else if (direction == Direction::Down) data.push_back(2);
         else data.push_back(0);
     
-        data.push_back(static_cast<int>(state)); // ElevatorState enum to int
+        data.push_back(static_cast<int>(state.load())); // ElevatorState enum to int
+        data.push_back(currentFloor >> 8 & 0xFF);       // floor high byte, after the bytes the displays read
     
-        DatagramPacket pkt(data, data.size(), InetAddress::getLocalHost(), DISPLAY_PORT);
-        sendSocket.send(pkt);
+        sendPacket(data, data.size(), InetAddress::getLocalHost(), DISPLAY_PORT);
+
+        // The scheduler keeps its dispatch table current from the same status packet.
+        sendPacket(data, data.size(), InetAddress::getLocalHost(), statusPort);
     }
      
    void processRequest(const ElevatorEvent& item) {
@@ -136,22 +380,20 @@ public:
             std::cout << "[Elevator" << id << "] Over capacity (" << item.passengers 
             << " > " << MAX_CAPACITY << "), cannot board!\n";
 
-            std::vector<uint8_t> data = createData(item);
-            std::this_thread::sleep_for(std::chrono::seconds(1)); 
-            sendPacket(data, data.size(), InetAddress::getLocalHost(), FLOORREADER);  
-            
+            // The scheduler splits groups to fit; refuse rather than bounce it back to the floor queue.
+            sendReply(MSG_NACK, item.requestId, NACK_OVER_CAPACITY);
             state = ElevatorState::Idle;
             sendDisplayUpdate();
             return;  
         }
-        if (item.fault == "Major") {
+        if (item.fault == FaultType::Major) {
             handleFloorFault();
         } 
         if (currentFloor != item.floor) {
             std::cout << "[Elevator" << id << "] Moving to pickup floor " << item.floor << " with " << item.passengers << std::endl;
             moveToFloor(item.floor);
             sendDisplayUpdate();
-            if (item.fault == "Minor") {
+            if (item.fault == FaultType::Minor) {
                 handleDoorFault();
             }
             doorOperations();
@@ -160,7 +402,7 @@ public:
         }
 
         std::vector<uint8_t> packet_data = createData(item);
-        sendPacket(packet_data, packet_data.size(), InetAddress::getLocalHost(), FLOORNOTIFIER);
+        sendPacket(packet_data, packet_data.size(), InetAddress::getLocalHost(), notifierPort);
 
         if (!moveByFloors(item.floorsToMove, item.floorButton, item.passengers)) {
             sendDisplayUpdate();
@@ -170,29 +412,169 @@ public:
             return;
         }
 
-        sendPacket(packet_data, packet_data.size(), InetAddress::getLocalHost(), FLOORNOTIFIER);
+        sendPacket(packet_data, packet_data.size(), InetAddress::getLocalHost(), notifierPort);
+    }
+
+    // Queues a hall call. The car picks it up on the next sweep that passes its floor in its direction.
+    // Returns false for a group larger than the car, or once the car is out of service.
+    bool addRequest(const Type& item) {
+        if (item.passengers > MAX_CAPACITY) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(stopMutex);
+        if (state == ElevatorState::MajorFault) {
+            return false;
+        }
+        riders.push_back(Rider<Type>{item, destinationOf(item), false});
+        refreshStops();
+        stopCv.notify_one();
+        return true;
+    }
+
+    // Gives up a queued call whose riders have not boarded yet, so an idle car can take it.
+    // Returns false if the riders are already on board or the call is unknown.
+    bool revokeRequest(int requestId) {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        for (auto it = riders.begin(); it != riders.end(); ++it) {
+            if (it->request.requestId == requestId && !it->onBoard) {
+                riders.erase(it);
+                refreshStops();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Tells the scheduler this car is idle so it can hand over work from a busier car.
+    void requestWork() {
+        std::vector<uint8_t> data = { 0x0, MSG_STEAL, 0x0, 0x0, static_cast<uint8_t>(id),
+                                      static_cast<uint8_t>(currentFloor >> 8 & 0xFF), static_cast<uint8_t>(currentFloor & 0xFF) };
+        sendPacket(data, data.size(), InetAddress::getLocalHost(), notifierPort);
+    }
+
+    // ACK, NACK or completion for a numbered request, sent to the scheduler's notifier port.
+    void sendReply(uint8_t type, int requestId, int reason = -1) {
+        std::vector<uint8_t> data = { 0x0, type, static_cast<uint8_t>(requestId >> 8 & 0xFF),
+                                      static_cast<uint8_t>(requestId & 0xFF), static_cast<uint8_t>(id) };
+        if (reason >= 0) {
+            data.push_back(reason);
+        }
+        sendPacket(data, data.size(), InetAddress::getLocalHost(), notifierPort);
+    }
+
+    // Queues a request from the scheduler and acknowledges it, or refuses it with a NACK.
+    void handlePacket(const std::vector<uint8_t>& data) {
+        if (data.size() >= 4 && data[0] == 0 && data[1] == MSG_REVOKE) {
+            int requestId = data[2] << 8 | data[3];
+            bool released = revokeRequest(requestId);
+            std::cout << "[Elevator" << id << "] " << (released ? "Released" : "Kept") << " request " << requestId << std::endl;
+            sendReply(MSG_RELEASED, requestId, released ? 1 : 0);
+            return;
+        }
+        if (!ElevatorEvent::isRequest(data)) {
+            return;
+        }
+        ElevatorEvent item = processData(data);
+        if (state == ElevatorState::MajorFault) {
+            std::cout << "[Elevator" << id << "] Out of service, refused request: " << item.display() << std::endl;
+            sendReply(MSG_NACK, item.requestId, NACK_OUT_OF_SERVICE);
+            return;
+        }
+        if (item.requestId != 0 && seenRequests.count(item.requestId)) {
+            std::cout << "[Elevator" << id << "] Request " << item.requestId << " already queued" << std::endl;
+            sendReply(MSG_ACK, item.requestId);
+            return;
+        }
+        if (!addRequest(item)) {
+            if (state == ElevatorState::MajorFault) {
+                std::cout << "[Elevator" << id << "] Out of service, refused request: " << item.display() << std::endl;
+                sendReply(MSG_NACK, item.requestId, NACK_OUT_OF_SERVICE);
+                return;
+            }
+            std::cout << "[Elevator" << id << "] Over capacity (" << item.passengers 
+            << " > " << MAX_CAPACITY << "), cannot board!\n";
+            sendReply(MSG_NACK, item.requestId, NACK_OVER_CAPACITY);
+            return;
+        }
+        std::cout << "[Elevator" << id << "] Queued: " << item.display() << std::endl;
+        sendReply(MSG_ACK, item.requestId);
+
+        if (item.requestId != 0) {
+            seenRequests.insert(item.requestId);
+            seenOrder.push_back(item.requestId);
+            if (seenOrder.size() > 1024) {
+                seenRequests.erase(seenOrder.front());
+                seenOrder.pop_front();
+            }
+        }
+    }
+
+    // Serves queued stops in LOOK order until none are left. Returns the floors where the doors opened.
+    std::vector<int> serveUntilIdle() {
+        std::vector<int> served;
+        while (true) {
+            int target;
+            {
+                std::lock_guard<std::mutex> lock(stopMutex);
+                if (upStops.empty() && downStops.empty()) {
+                    sweep = Direction::Idle;
+                    break;
+                }
+                target = nextStop();
+            }
+            if (target == currentFloor) {
+                serveFloor();
+                served.push_back(currentFloor);
+            } else {
+                moveOneFloor(target > currentFloor ? Direction::Up : Direction::Down);
+            }
+        }
+        direction = Direction::Idle;
+        if (state != ElevatorState::Idle) {
+            state = ElevatorState::Idle;
+            sendDisplayUpdate();
+        }
+        return served;
+    }
+
+    // Serves stops as they are queued. While idle the car keeps asking the scheduler for work
+    // it could steal from a busier car.
+    void serveStops() {
+        while (true) {
+            bool work;
+            {
+                std::unique_lock<std::mutex> lock(stopMutex);
+                work = stopCv.wait_for(lock, std::chrono::milliseconds(STEAL_INTERVAL_MS),
+                                       [&] { return !upStops.empty() || !downStops.empty(); });
+            }
+            if (work) {
+                serveUntilIdle();
+            }
+            if (state == ElevatorState::MajorFault) {
+                return;
+            }
+            requestWork();
+        }
     }
 
     void operator()() {
+        std::thread worker([this] {
+            try {
+                serveStops();
+            } catch (const std::runtime_error& e) {
+                std::cerr << "[Elevator" << id << "] Critical error: " << e.what() << std::endl;
+                std::cerr << "[Elevator" << id << "] Going out of service." << std::endl;
+            }
+        });
+
         while (true) {
             std::cout << "[Elevator" << id << "] Waiting for next task..." << std::endl;
-            std::vector<uint8_t> data = receivePacket();
-            if (static_cast<int>(data[0]) == 0 && static_cast<int>(data[1]) == 1 && ElevatorState::Idle == state) {
-
-                ElevatorEvent item = processData(data);
-                std::cout << "[Elevator" << id << "] Processing: " << item.display() << std::endl;
-                try {
-                    processRequest(item); 
-                } catch (const std::runtime_error& e) {
-                    std::cerr << "[Elevator" << id << "] Critical error: " << e.what() << std::endl;
-                    std::cerr << "[Elevator" << id << "] Going out of service." << std::endl;
-                    break;  // clean shutdown of thread
-                }
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-            }else{
-                std::cout << "[Elevator" << id << "] Unable to process request, Elevator not in IDLE state" << std::endl;
+            PooledBuffer data = receiveBuffer();
+            if (data) {
+                handlePacket(*data);
             }
         }
+        worker.join();
     }
 
     void moveToFloor(int targetFloor) {
@@ -204,23 +586,46 @@ public:
  
             currentFloor += (currentFloor < targetFloor) ? 1 : -1;
             std::cout << "[Elevator" << id << "] Passing floor: " << currentFloor << std::endl;
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+            clock.sleepFor(std::chrono::seconds(1));
         }
     }
 
-    std::vector<uint8_t> receivePacket() {
+    // How long receiveBuffer() waits for a packet, 0 for ever (the default).
+    void setReceiveTimeout(int ms) {
+        receiveTimeoutMs = ms;
+        receiveSocket.setSoTimeout(ms);
+    }
 
-        std::vector<uint8_t> packetData(17);
-        DatagramPacket schedulerPacket(packetData, packetData.size());
+    // Waits for the next packet from the scheduler, received into a pooled buffer. Packets too
+    // long for the buffer are dropped. The buffer is empty if the receive timeout expired or
+    // the socket failed.
+    PooledBuffer receiveBuffer() {
+        while (true) {
+            PooledBuffer buffer = receiveBuffers.acquire();
+            std::vector<uint8_t>& bytes = buffer.fill();
+            DatagramPacket schedulerPacket(bytes, bytes.size());
 
-        try {
-            receiveSocket.receive(schedulerPacket);
-        } catch (const std::runtime_error& e ) {
-            std::cerr << e.what() << std::endl;
-            exit(1);
+            try {
+                if (!receiveSocket.receive(schedulerPacket)) {
+                    return PooledBuffer();
+                }
+            } catch (const std::runtime_error& e ) {
+                std::cerr << "[Elevator" << id << "] Receive failed: " << e.what() << std::endl;
+                return PooledBuffer();
+            }
+
+            if (!schedulerPacket.isTruncated()) {
+                buffer.setLength(schedulerPacket.getLength());
+                return buffer;
+            }
+            std::cout << "[Elevator" << id << "] Dropped a packet longer than " << bytes.size() << " bytes" << std::endl;
         }
+    }
 
-        return packetData;
+    // Empty if nothing arrived.
+    std::vector<uint8_t> receivePacket() {
+        PooledBuffer buffer = receiveBuffer();
+        return buffer ? *buffer : std::vector<uint8_t>();
     }
 
     void printPacket(std::vector<uint8_t> packet_data) {
@@ -239,45 +644,8 @@ public:
     }
     
 
-    std::vector<uint8_t> createData (Type item) {
-
-        int hour = item.timestamp.tm_hour;
-        int min = item.timestamp.tm_min;
-        int sec = item.timestamp.tm_sec;
-        int msec = 0;
-
-        std::vector<uint8_t> packet_data;
-        packet_data.push_back(0x0);
-        packet_data.push_back(0x1);
-
-        packet_data.push_back(hour / 10 % 10);
-        packet_data.push_back(hour % 10);
-        packet_data.push_back(min / 10 % 10);
-        packet_data.push_back(min % 10);
-        packet_data.push_back(sec / 10 % 10);
-        packet_data.push_back(sec % 10);
-        packet_data.push_back(msec % 10);
-        packet_data.push_back(item.floor / 10 % 10);
-        packet_data.push_back(item.floor % 10);
-        if (item.floorButton == "Up") {
-            packet_data.push_back(1);  // Elevator moving Up
-        } else if (item.floorButton == "Down") {
-            packet_data.push_back(0); // Elevator moving Down
-        } else {
-            packet_data.push_back(0xF); // unknown state
-        }
-        packet_data.push_back(item.passengers / 10 % 10);
-        packet_data.push_back(item.passengers % 10);
-        packet_data.push_back(item.floorsToMove / 10 % 10);
-        packet_data.push_back(item.floorsToMove % 10);
-        if (item.fault == "Minor") {
-            packet_data.push_back(1); // Minor fault
-        } else if (item.fault == "Major") {
-            packet_data.push_back(2); // Major fault
-        } else {
-            packet_data.push_back(0); // No fault
-        }
-        return packet_data;
+    std::vector<uint8_t> createData (const Type& item) {
+        return item.toPacket();
     }
 
     void sendPacket(std::vector<uint8_t> data, int size, in_addr_t address, int port) {
@@ -289,8 +657,7 @@ public:
         try {
             sendSocket.send(sendPacket);
         } catch ( const std::runtime_error& e ) {
-            std::cerr << e.what() << std::endl;
-            exit(1);
+            std::cerr << "[Elevator" << id << "] Send failed: " << e.what() << std::endl;
         }
 
         return;
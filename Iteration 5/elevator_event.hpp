@@ -4,48 +4,81 @@
 #include <string>
 #include <sstream>
 #include <iomanip>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include <stdexcept>
+#include <type_traits>
+#include "protocol.hpp"
+#include "request_codec.hpp"
+#include "elevator_state.hpp"
 
+// A hall call. Plain integers and one-byte enums, so queues and sockets copy it as 16 bytes;
+// text forms are only built when a log line is printed.
 struct ElevatorEvent {
-    struct tm timestamp;
-    int floor;
-    std::string floorButton;
-    int floorsToMove;
-    int passengers;
-    std::string fault;
+    uint32_t timeMs = 0;                    // since midnight
+    uint16_t floor = 0;
+    uint16_t floorsToMove = 0;
+    uint16_t passengers = 0;
+    uint16_t requestId = 0;                 // assigned by the scheduler, 0 until then
+    Direction floorButton = Direction::Up;
+    FaultType fault = FaultType::None;
+    uint8_t wireVersion = WIRE_V1;          // layout the request arrived in; it is forwarded in the same one
+
+    ElevatorEvent() = default;
+
+    ElevatorEvent(uint32_t timeMs, int floor, Direction floorButton, int floorsToMove, int passengers, FaultType fault)
+        : timeMs(timeMs), floor(floor), floorsToMove(floorsToMove), passengers(passengers),
+          floorButton(floorButton), fault(fault) {}
+
+    // From the text fields of a trace line; only the time of day is kept from `t`.
+    ElevatorEvent(struct tm t, int f, const std::string& fb, int cb, int p, const std::string& fa)
+        : ElevatorEvent(((t.tm_hour * 60 + t.tm_min) * 60 + t.tm_sec) * 1000, f, directionFromString(fb), cb, p,
+                        faultFromString(fa)) {}
+
+    static bool isRequest(const std::vector<uint8_t>& data) {
+        return requestVersion(data) != 0;
+    }
 
     static ElevatorEvent parseFromPacket(const std::vector<uint8_t>& data) {
-        if (data.size() < 17 || data[0] != 0 || data[1] != 1) {
+        int version = requestVersion(data);
+        if (version == 0) {
             throw std::runtime_error("Invalid packet");
         }
-    
-        int hour = data[2] * 10 + data[3];
-        int min = data[4] * 10 + data[5];
-        int sec = data[6] * 10 + data[7];
-        struct tm timestamp = {hour = hour, min = min, sec = sec};
-    
-        int floor = data[9] * 10 + data[10];
-        std::string direction = (data[11] == 1) ? "Up" : "Down";
-        int floorsToMove = data[12] * 10 + data[13];
-        int passengers = data[14] * 10 + data[15];
-        std::string fault;
-        switch (data[16]) {
-            case 1: fault = "Minor"; break;
-            case 2: fault = "Major"; break;
-            default: fault = "None"; break;
-        }
-    
-        return ElevatorEvent(timestamp, floor, direction, floorsToMove, passengers, fault);
+        WireRequest request = version == WIRE_V2 ? decodeRequest<WIRE_V2>(data.data()) : decodeRequest<WIRE_V1>(fullV1(data).data());
+        return fromWire(request, version);
     }
-        
 
-    ElevatorEvent(struct tm t, int f, std::string fb, int cb, int p, std::string fa) : timestamp(t), floor(f), floorButton(std::move(fb)), floorsToMove(cb), passengers (p), fault(fa) {}
+    static ElevatorEvent fromWire(const WireRequest& request, int version) {
+        ElevatorEvent event(request.timeMs, request.floor, request.up ? Direction::Up : Direction::Down,
+                            request.floorsToMove, request.passengers, static_cast<FaultType>(request.fault));
+        event.requestId = request.requestId;
+        event.wireVersion = version;
+        return event;
+    }
+
+    WireRequest toWire() const {
+        WireRequest request;
+        request.timeMs = timeMs;
+        request.floor = floor;
+        request.floorsToMove = floorsToMove;
+        request.passengers = passengers;
+        request.requestId = requestId;
+        request.up = floorButton == Direction::Up;
+        request.fault = static_cast<uint8_t>(fault);
+        return request;
+    }
+
+    // Encodes the request in the version it arrived in, or version 2 if it no longer fits version 1.
+    std::vector<uint8_t> toPacket() const {
+        return encodeRequest(toWire(), wireVersion);
+    }
 
-   
     std::string display() const {
         std::ostringstream oss;
         oss << "\n [Floor Subsystem] Request sent:\n"
             << "  Floor: " << floor
-            << "\n  Direction: " << (floorButton.empty() ? "None" : floorButton)
+            << "\n  Direction: " << (floorButton == Direction::Idle ? "None" : directionName(floorButton))
             << "\n  Floors to move: " << floorsToMove
             << "\n  Passengers: " << passengers
             << "\n  Fault: " << fault;
@@ -54,4 +87,7 @@ struct ElevatorEvent {
     }
 };
 
-#endif 
+static_assert(std::is_trivially_copyable<ElevatorEvent>::value, "ElevatorEvent must stay trivially copyable");
+static_assert(sizeof(ElevatorEvent) <= 16, "ElevatorEvent must fit in 16 bytes");
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef ELEVATOR_STATE_H
+#define ELEVATOR_STATE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+enum class ElevatorState { Idle, MovingUp, MovingDown, DoorOpening, DoorOpen, DoorClosing, MinorFault, MajorFault };
+enum class Direction : uint8_t { Up, Down, Idle };
+enum class FaultType : uint8_t { None, Minor, Major };
+
+// Text forms as written in the trace file, only needed for parsing and log lines.
+inline std::string_view directionName(Direction direction) {
+    return direction == Direction::Up ? "Up" : direction == Direction::Down ? "Down" : "Idle";
+}
+
+inline std::string_view faultName(FaultType fault) {
+    return fault == FaultType::Minor ? "Minor" : fault == FaultType::Major ? "Major" : "None";
+}
+
+inline Direction directionFromString(std::string_view name) {
+    return name == "Up" ? Direction::Up : name == "Down" ? Direction::Down : Direction::Idle;
+}
+
+inline FaultType faultFromString(std::string_view name) {
+    return name == "Minor" ? FaultType::Minor : name == "Major" ? FaultType::Major : FaultType::None;
+}
+
+inline std::ostream& operator<<(std::ostream& out, Direction direction) { return out << directionName(direction); }
+inline std::ostream& operator<<(std::ostream& out, FaultType fault) { return out << faultName(fault); }
+
+// How long a car spends on each step, in milliseconds.
+#define FLOOR_TIME_MS 1000
+#define DOOR_STEP_MS 1000           // each of opening, open and closing
+#define DOOR_FAULT_MS 12000         // 2 s before the fault is detected + 10 s recovery
+#define REST_TIME_MS 1000           // pause before the next task
+#define CAR_CAPACITY 4
+#define TOP_FLOOR 65535             // highest floor a request can name; a car serves 1 to this by default
+
+#endif // ELEVATOR_STATE_H
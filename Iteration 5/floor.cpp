@@ -1,12 +1,77 @@
 #include <chrono>
 #include <thread>
+#include <climits>
+#include <cmath>
 #include <cstdlib>
+#include <iostream>
+#include <memory>
 #include <unistd.h>
+#include <string>
 #include "floor.hpp"
 
-int main() {
+int main(int argc, char* argv[]) {
+    Clock& clock = Clock::fromArgs(argc, argv);
 
-    Floor<ElevatorEvent> floorReader("elevator.txt");
-    std::thread floorThread(std::ref(floorReader));
+    ReplayOptions replay;
+    replay.creditPort = FLOOR_CREDITS;
+    replay.waitForReady = true;
+    replay.readyAttempts = STARTUP_ATTEMPTS;
+    int wireVersion = WIRE_V2;
+
+    // The argument at `i` as a whole number from `low` to `high`; false if it is missing or not one.
+    auto number = [&](int i, long low, long high, int& value) {
+        char* end = nullptr;
+        long parsed = i < argc ? std::strtol(argv[i], &end, 10) : 0;
+        if (end == nullptr || end == argv[i] || *end != '\0' || parsed < low || parsed > high) {
+            return false;
+        }
+        value = parsed;
+        return true;
+    };
+    auto usage = [&](const std::string& option, const std::string& meaning) {
+        std::cerr << "Usage: " << argv[0] << " [" << option << "] ...\n  " << option << "   " << meaning << std::endl;
+        return 1;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--replay") {
+            replay.paced = true;
+        } else if (arg == "--replay-speed") {
+            char* end = nullptr;
+            replay.paced = true;
+            replay.speed = i + 1 < argc ? std::strtod(argv[++i], &end) : 0;
+            if (end == nullptr || end == argv[i] || *end != '\0' || !std::isfinite(replay.speed) || replay.speed <= 0) {
+                std::cerr << "Usage: " << argv[0] << " [--replay-speed N] ...\n"
+                          << "  --replay-speed N   replay the trace N times faster than recorded, N > 0" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--max-burst") {
+            if (!number(++i, 0, INT_MAX, replay.maxBurst)) {
+                return usage("--max-burst N", "send at most N requests back to back, 0 for no limit");
+            }
+        } else if (arg == "--wire") {
+            if (!number(++i, WIRE_V1, WIRE_V2, wireVersion)) {
+                return usage("--wire 1|2", "packet format to send requests in");
+            }
+        } else if (arg == "--credit-port") {
+            if (!number(++i, 1, 65535, replay.creditPort)) {
+                return usage("--credit-port N", "take credit grants on port N, 1-65535 (--no-credits to send freely)");
+            }
+        } else if (arg == "--no-credits") {
+            replay.creditPort = 0;
+        } else if (arg == "--no-wait") {
+            replay.waitForReady = false;
+        }
+    }
+
+    std::unique_ptr<Floor<ElevatorEvent>> floorReader;
+    try {
+        floorReader.reset(new Floor<ElevatorEvent>("elevator.txt", clock, replay, wireVersion));
+    } catch (const std::runtime_error& e) {
+        std::cerr << "[Floor] " << e.what() << std::endl;
+        return 1;
+    }
+    std::thread floorThread(std::ref(*floorReader));
     floorThread.join();
+    return floorReader->gaveUpWaiting() ? 1 : 0;
 }
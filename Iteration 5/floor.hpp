@@ -7,64 +7,215 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <deque>
+#include <memory>
 #include "scheduler.hpp"
+#include "floor_credits.hpp"
 #include "elevator_event.hpp"
+#include "clock.hpp"
 /* #include "Datagram1.h" */
 
 #define SCHEDULER 23
 #define ELEVATOR 69
 
-template <typename Type>
+// How the trace file is played back to the scheduler.
+struct ReplayOptions {
+    bool paced = false;                             // send each line at its recorded offset from the first line
+    double speed = 1.0;                             // trace time runs this many times faster than the clock
+    int maxBurst = 0;                               // most requests sent back to back, 0 for no limit
+    std::chrono::milliseconds burstGap{10};         // pause inserted once a burst hits maxBurst
+    int creditPort = 0;                             // take credit grants here and send only against them, 0 sends freely
+    bool waitForReady = false;                      // send nothing until the scheduler says it is ready
+    int readyAttempts = 0;                          // asks before giving up on the scheduler, 0 for never
+};
+
+template <typename Type, typename Transport = ELEVATOR_TRANSPORT>
 class Floor {
 private:
     std::string filename;
-    DatagramSocket sendSocket;
+    Transport sendSocket;
+    Clock& clock;
+    ReplayOptions replay;
+    int wireVersion;
+
+    // Replies from the scheduler: credit grants on replay.creditPort, or readiness on a port the
+    // kernel picks if only replay.waitForReady is set. Transports without kernel-picked ports
+    // need replay.creditPort.
+    std::unique_ptr<Transport> controlSocket;
+    int controlPort = 0;
+    std::vector<uint8_t> grant = std::vector<uint8_t>(8);
+
+    // Credit-based flow control, when replay.creditPort is set: requests wait in `held` until the
+    // scheduler has granted a credit for each.
+    bool useCredits = false;
+    std::deque<std::vector<uint8_t>> held;
+    int credits = 0;
+    int grantsSeen = 0;                             // running total of the last grant taken
+    bool asked = false;
+    int unanswered = 0;
+    bool gaveUp = false;                            // the scheduler never said it was ready
+
+    // Adds the credits a MSG_CREDIT grants beyond those already taken. Returns false if it is not
+    // one, or grants nothing new.
+    bool addGrant(const std::vector<uint8_t>& packet, size_t length) {
+        if (length < 4 || !isCreditPacket(packet) || packet[1] != MSG_CREDIT) {
+            return false;
+        }
+        int added = newCredits(creditValue(packet), grantsSeen);
+        if (added == 0) {
+            return false;
+        }
+        credits += added;
+        grantsSeen = creditValue(packet);
+        return true;
+    }
+
+    // Adds up the grants waiting on the credit port, first waiting up to FLOOR_CREDIT_WAIT_MS for
+    // one if `wait`. Returns false if none came.
+    bool takeGrants(bool wait) {
+        bool granted = false;
+        try {
+            DatagramPacket packet(grant, grant.size());
+            for (bool block = wait; block ? controlSocket->receive(packet) : controlSocket->tryReceive(packet); block = false) {
+                if (addGrant(grant, packet.getLength())) {
+                    granted = true;
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            std::cerr << "[Floor] Credit receive failed: " << e.what() << std::endl;
+        }
+        if (granted) {
+            asked = false;
+            unanswered = 0;
+        }
+        return granted;
+    }
+
+    // Sends held requests while credits last and asks for more once they run out. If `wait`, keeps
+    // waiting for grants until everything held has gone; after FLOOR_CREDIT_ATTEMPTS unanswered asks
+    // the scheduler is taken not to grant credits and the floor sends without them from then on.
+    void sendHeld(bool wait) {
+        takeGrants(false);
+        while (!held.empty()) {
+            for (; credits > 0 && !held.empty(); credits--) {
+                sendPacket(held.front(), held.front().size(), InetAddress::getLocalHost(), SCHEDULER);
+                held.pop_front();
+            }
+            if (held.empty()) {
+                break;
+            }
+            if (!asked) {
+                std::vector<uint8_t> ask = creditRequestPacket(controlPort, grantsSeen);
+                sendPacket(ask, ask.size(), InetAddress::getLocalHost(), SCHEDULER);
+                asked = true;
+            }
+            if (!wait) {
+                return;
+            }
+            if (!takeGrants(true)) {
+                if (++unanswered >= FLOOR_CREDIT_ATTEMPTS) {
+                    std::cerr << "[Floor] No credits from the scheduler, sending without them" << std::endl;
+                    useCredits = false;
+                    for (; !held.empty(); held.pop_front()) {
+                        sendPacket(held.front(), held.front().size(), InetAddress::getLocalHost(), SCHEDULER);
+                    }
+                    return;
+                }
+                asked = false;
+            }
+        }
+    }
+
+    void submit(const std::vector<uint8_t>& packet) {
+        if (!useCredits) {
+            sendPacket(packet, packet.size(), InetAddress::getLocalHost(), SCHEDULER);
+            return;
+        }
+        held.push_back(packet);
+        sendHeld(false);
+    }
 
 public:
-    Floor(const std::string& file)
-        : filename(file), sendSocket() {}
+    Floor(const std::string& file, Clock& clock = Clock::realTime(), ReplayOptions replay = ReplayOptions(),
+          int wireVersion = WIRE_V2)
+        : filename(file), sendSocket(), clock(clock), replay(replay), wireVersion(wireVersion) {
+        if (!(replay.speed > 0)) {
+            throw std::runtime_error("Replay speed must be greater than 0");
+        }
+        if (replay.creditPort > 0 || replay.waitForReady) {
+            controlSocket.reset(new Transport(replay.creditPort));
+            controlSocket->setSoTimeout(FLOOR_CREDIT_WAIT_MS);
+            controlPort = controlSocket->localPort();
+            if (controlPort == 0) {
+                throw std::runtime_error("Transport picks no port for the floor to hear back on; pass a credit port");
+            }
+            useCredits = replay.creditPort > 0;
+        }
+    }
 
-    std::vector<uint8_t> createData(
-     std::string timeStr, std::string floorButton, int floor, int floorsToMove, int passengers, std::string fault) {
-        
-        std::vector<uint8_t> packet_data;
-        packet_data.push_back(0x0);
-        packet_data.push_back(0x1);
-        
+    // Asks the scheduler every STARTUP_RETRY_MS whether it is ready for requests, so none are
+    // lost to a scheduler still starting, and returns the number of cars it reports in service.
+    // Gives up after `attempts` asks, 0 for never, and returns -1. Needs replay.creditPort or
+    // replay.waitForReady for a port to hear back on.
+    int waitForScheduler(int attempts = 0) {
+        std::vector<uint8_t> query = { 0, MSG_READY_QUERY, static_cast<uint8_t>(controlPort >> 8 & 0xFF),
+                                       static_cast<uint8_t>(controlPort & 0xFF) };
+        DatagramPacket packet(grant, grant.size());
+        controlSocket->setSoTimeout(STARTUP_RETRY_MS);
+        for (int attempt = 0; attempts == 0 || attempt < attempts; attempt++) {
+            if (attempt == 1) {
+                std::cout << "[Floor] Waiting for the scheduler" << std::endl;
+            }
+            sendPacket(query, query.size(), InetAddress::getLocalHost(), SCHEDULER);
+            auto retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(STARTUP_RETRY_MS);
+            try {
+                while (std::chrono::steady_clock::now() < retry && controlSocket->receive(packet)) {
+                    if (packet.getLength() >= 4 && grant[0] == 0 && grant[1] == MSG_READY) {
+                        controlSocket->setSoTimeout(FLOOR_CREDIT_WAIT_MS);
+                        int cars = grant[2] << 8 | grant[3];
+                        std::cout << "[Floor] Scheduler ready with " << cars << " elevators" << std::endl;
+                        return cars;
+                    }
+                    addGrant(grant, packet.getLength());
+                }
+            } catch (const std::runtime_error& e) {
+                std::cerr << "[Floor] Receive failed: " << e.what() << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(STARTUP_RETRY_MS));
+            }
+        }
+        controlSocket->setSoTimeout(FLOOR_CREDIT_WAIT_MS);
+        return -1;
+    }
+
+    // True if operator() sent nothing because the scheduler never said it was ready.
+    bool gaveUpWaiting() const {
+        return gaveUp;
+    }
+
+    // Converts a "HH:MM:SS.s" trace timestamp to milliseconds since midnight.
+    static long long parseTime(const std::string& timeStr) {
         int hour = std::stoi(&timeStr[0]);
         int min = std::stoi(&timeStr[3]);
         int sec = std::stoi(&timeStr[6]);
-        int msec = std::stoi(&timeStr[9]);
-        packet_data.push_back(hour / 10 % 10);
-        packet_data.push_back(hour % 10);
-        packet_data.push_back(min / 10 % 10);
-        packet_data.push_back(min % 10);
-        packet_data.push_back(sec / 10 % 10);
-        packet_data.push_back(sec % 10);
-        packet_data.push_back(msec % 10);
-        packet_data.push_back(floor / 10 % 10);
-        packet_data.push_back(floor % 10);
-
-        if (floorButton == "Up") {
-            packet_data.push_back(1);  // Elevator moving Up
-        } else if (floorButton == "Down") {
-            packet_data.push_back(0); // Elevator moving Down
-        } else {
-            packet_data.push_back(0xF); // unknown state
-        }
-        
-        packet_data.push_back(passengers / 10 % 10);
-        packet_data.push_back(passengers % 10);
-        packet_data.push_back(floorsToMove / 10 % 10);
-        packet_data.push_back(floorsToMove % 10);
-        if (fault == "Minor") {
-            packet_data.push_back(1);  // Minor fault
-        } else if (fault == "Major") {
-            packet_data.push_back(2);  // Major fault
-        } else {
-            packet_data.push_back(0);  // No fault
-        }
-        return packet_data;
+        long long msec = 0;
+        if (timeStr.size() > 9) {
+            std::string fraction = timeStr.substr(9, 3);
+            fraction.resize(3, '0');
+            msec = std::stoi(fraction);
+        }
+        return ((hour * 60LL + min) * 60 + sec) * 1000 + msec;
+    }
+
+    std::vector<uint8_t> createData(
+     std::string timeStr, std::string floorButton, int floor, int floorsToMove, int passengers, std::string fault) {
+        WireRequest request;
+        request.timeMs = parseTime(timeStr);
+        request.floor = floor;
+        request.floorsToMove = floorsToMove;
+        request.passengers = passengers;
+        request.up = directionFromString(floorButton) == Direction::Up;
+        request.fault = static_cast<uint8_t>(faultFromString(fault));
+        return encodeRequest(request, wireVersion);
     }
 
     void sendPacket(std::vector<uint8_t> data, int size, in_addr_t address, int port) {
@@ -74,8 +225,7 @@ public:
         try {
                 sendSocket.send(sendPacket);
         } catch ( const std::runtime_error& e ) {
-            std::cerr << e.what() << std::endl;
-            exit(1);
+            std::cerr << "[Floor] Send failed: " << e.what() << std::endl;
         }
 
         return;
@@ -99,7 +249,16 @@ public:
             return;
         }
     
+        if (replay.waitForReady && waitForScheduler(replay.readyAttempts) < 0) {
+            std::cerr << "[Floor] No answer from the scheduler after " << replay.readyAttempts << " asks" << std::endl;
+            gaveUp = true;
+            return;
+        }
+
         std::string line;
+        long long firstTime = -1;
+        Clock::duration replayStart = clock.now();
+        int burst = 0;
         while (std::getline(file, line)) { 
             std::istringstream iss(line);
             std::string timeStr, floorButton, fault;
@@ -109,9 +268,39 @@ public:
                 std::cerr << "Incorrect line format: " << line << std::endl;
                 continue;
             }
+
+            if (replay.paced) {
+                long long requestTime = parseTime(timeStr);
+                if (firstTime < 0) {
+                    firstTime = requestTime;
+                }
+                // Lines recorded earlier than the ones already sent are overdue and go out immediately.
+                Clock::duration due = replayStart + Clock::duration(static_cast<long long>((requestTime - firstTime) / replay.speed));
+                if (due > clock.now() && useCredits && !held.empty()) {
+                    sendHeld(true);     // overdue requests go before waiting for the next line
+                }
+                if (due > clock.now()) {
+                    clock.sleepUntil(due);
+                    burst = 0;
+                }
+            }
+            if (replay.maxBurst > 0 && burst >= replay.maxBurst) {
+                clock.sleepFor(replay.burstGap);
+                burst = 0;
+            }
+            burst++;
     
             std::vector<uint8_t> packetInfo = createData(timeStr, floorButton, floor, floorsToMove, passengers, fault);
-            sendPacket(packetInfo, packetInfo.size(), InetAddress::getLocalHost(), SCHEDULER);
+            submit(packetInfo);
+        }
+
+        if (useCredits) {
+            sendHeld(true);
+        }
+        if (controlSocket && credits > 0) {
+            std::vector<uint8_t> unused = creditPacket(MSG_CREDIT_RETURN, credits);
+            sendPacket(unused, unused.size(), InetAddress::getLocalHost(), SCHEDULER);
+            credits = 0;
         }
     }
 
@@ -0,0 +1,131 @@
+#ifndef FLOOR_CREDITS_H
+#define FLOOR_CREDITS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "protocol.hpp"
+
+#define FLOOR_CREDITS 26                // port a floor takes its credit grants on
+#define FLOOR_CREDIT_WAIT_MS 1000       // a floor asks again after this long without a grant
+#define FLOOR_CREDIT_ATTEMPTS 3         // unanswered asks before a floor sends without credits
+
+struct CreditGrant {
+    int port;
+    int total;                      // credits granted to the floor so far, mod 65536
+};
+
+inline std::vector<uint8_t> creditPacket(uint8_t type, int value) {
+    return { 0, type, static_cast<uint8_t>(value >> 8 & 0xFF), static_cast<uint8_t>(value & 0xFF) };
+}
+
+// A floor out of credits asks for more on `port`, saying how many it has been granted so far.
+inline std::vector<uint8_t> creditRequestPacket(int port, int seen) {
+    std::vector<uint8_t> packet = creditPacket(MSG_CREDIT_REQUEST, port);
+    packet.push_back(seen >> 8 & 0xFF);
+    packet.push_back(seen & 0xFF);
+    return packet;
+}
+
+// The credits a grant carrying `total` adds for a floor that has seen grants up to `seen`. Totals
+// count up mod 65536; one that is not ahead of `seen`, as a repeated or reordered grant can be, adds none.
+inline int newCredits(int total, int seen) {
+    int added = (total - seen) & 0xFFFF;
+    return added < 0x8000 ? added : 0;
+}
+
+inline bool isCreditPacket(const std::vector<uint8_t>& packet) {
+    return packet.size() >= 4 && packet[0] == 0
+        && (packet[1] == MSG_CREDIT_REQUEST || packet[1] == MSG_CREDIT || packet[1] == MSG_CREDIT_RETURN);
+}
+
+inline int creditValue(const std::vector<uint8_t>& packet) {
+    return packet[2] << 8 | packet[3];
+}
+
+// The scheduler's side of credit-based flow control for floor clients. Credits are granted out of
+// a fixed window to floors that ask for them (MSG_CREDIT_REQUEST, sent when a floor runs out) and
+// come back as requests leave the scheduler's queue, or when a floor returns what it did not use.
+// Floors that never ask are not limited, but the window only bounds the queue while all of them
+// ask.
+//
+// Grants carry the running total granted to the floor rather than the new credits alone, so a lost
+// grant is made up by the next one. If the floor asks again having seen less than that total, the
+// total is sent again at once. Thread-safe.
+class FloorCredits {
+private:
+    int window;
+    int available;                  // not granted to any floor
+    int returned = 0;               // back since the last grant
+    std::vector<int> waiting;       // credit ports of floors that have run out, in the order they asked
+    std::map<int, uint16_t> granted;    // running total granted to each credit port
+    std::mutex mtx;
+
+    // Shares what is available among the waiting floors. Caller holds mtx.
+    void grant(std::vector<CreditGrant>& grants) {
+        while (available > 0 && !waiting.empty()) {
+            int share = std::max(1, available / static_cast<int>(waiting.size()));
+            uint16_t& total = granted[waiting.front()];
+            total += share;
+            grants.push_back({ waiting.front(), total });
+            available -= share;
+            waiting.erase(waiting.begin());
+        }
+        returned = 0;
+    }
+
+public:
+    FloorCredits(int window) : window(window), available(window) {}
+
+    // Takes a MSG_CREDIT_REQUEST or MSG_CREDIT_RETURN and adds any grants it makes possible to
+    // `grants`. Returns false for any other packet.
+    bool handle(const std::vector<uint8_t>& packet, std::vector<CreditGrant>& grants) {
+        if (!isCreditPacket(packet) || packet[1] == MSG_CREDIT) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        int port = creditValue(packet);
+        if (packet[1] == MSG_CREDIT_RETURN) {
+            available = std::min(window, available + port);
+        } else {
+            if (packet.size() >= 6) {
+                uint16_t seen = packet[4] << 8 | packet[5];
+                auto known = granted.find(port);
+                if (known == granted.end()) {
+                    granted[port] = seen;           // a floor that outlived an earlier scheduler
+                } else if (known->second != seen) {
+                    grants.push_back({ port, known->second });
+                }
+            }
+            if (std::find(waiting.begin(), waiting.end(), port) == waiting.end()) {
+                waiting.push_back(port);
+            }
+        }
+        grant(grants);
+        return true;
+    }
+
+    // `count` requests have left the queue. Their credits go back to waiting floors once a quarter
+    // of the window has come back, or at once if `idle`, so no floor waits on a queue that is empty.
+    void consumed(int count, bool idle, std::vector<CreditGrant>& grants) {
+        std::lock_guard<std::mutex> lock(mtx);
+        available = std::min(window, available + count);
+        returned += count;
+        if (idle || returned >= window / 4) {
+            grant(grants);
+        }
+    }
+
+    int getAvailable() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return available;
+    }
+
+    int getWindow() const {
+        return window;
+    }
+};
+
+#endif // FLOOR_CREDITS_H
@@ -0,0 +1,295 @@
+#ifndef PENDING_REQUESTS_H
+#define PENDING_REQUESTS_H
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <deque>
+#include <set>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include "elevator_event.hpp"
+
+#define RETRANSMIT_TIMEOUT_MS 200   // first retransmit; doubles after every attempt
+#define MAX_SEND_ATTEMPTS 5
+
+struct PendingRequest {
+    ElevatorEvent event;
+    int car;                    // dispatcher index of the car it was last sent to
+    int attempts;
+    long long deadline;         // retransmit if no ACK/NACK by then
+    std::vector<int> refused;   // cars that NACKed it
+};
+
+// Delivery of a group that was split into several trips.
+struct GroupProgress {
+    int group;
+    int passengers;
+    int delivered = 0;
+    int lost = 0;               // passengers in parts no car could take
+
+    bool finished() const { return delivered + lost >= passengers; }
+};
+
+struct RequestCounters {
+    long sent = 0;
+    long acked = 0;
+    long nacked = 0;
+    long retransmitted = 0;
+    long abandoned = 0;
+    long completed = 0;
+    long stolen = 0;
+};
+
+// Requests sent to an elevator that have not been acknowledged yet. Numbers each request,
+// and hands back the ones whose ACK is overdue or that a car refused. Also keeps each car's
+// queue of calls it has been given but not picked up yet, which idle cars may steal from.
+class PendingRequests {
+private:
+    std::map<int, PendingRequest> pending;
+    std::map<int, std::deque<ElevatorEvent>> unstarted;     // by car index, oldest first
+    std::map<int, int> steals;                              // request ID -> car waiting to take it over
+    std::set<int> moved;                                    // calls already stolen once, never moved again
+    std::map<int, GroupProgress> groups;                    // by group number
+    std::map<int, std::pair<int, int>> groupOf;             // request ID -> group number, passengers
+    int nextGroup = 1;
+    std::mutex mtx;
+    int nextId = 1;
+    RequestCounters counters;
+
+    static long long backoff(int attempts) {
+        return static_cast<long long>(RETRANSMIT_TIMEOUT_MS) << (attempts - 1);
+    }
+
+    void removeUnstarted(int id) {
+        for (auto& [car, calls] : unstarted) {
+            for (auto it = calls.begin(); it != calls.end(); ++it) {
+                if (it->requestId == id) {
+                    calls.erase(it);
+                    moved.erase(id);
+                    return;
+                }
+            }
+        }
+    }
+
+    std::optional<GroupProgress> settle(int id, bool delivered) {
+        auto part = groupOf.find(id);
+        if (part == groupOf.end()) {
+            return std::nullopt;
+        }
+        auto [group, passengers] = part->second;
+        groupOf.erase(part);
+        return settleGroup(group, passengers, delivered);
+    }
+
+    std::optional<GroupProgress> settleGroup(int number, int passengers, bool delivered) {
+        auto group = groups.find(number);
+        if (group == groups.end()) {
+            return std::nullopt;
+        }
+        (delivered ? group->second.delivered : group->second.lost) += passengers;
+        GroupProgress progress = group->second;
+        if (progress.finished()) {
+            groups.erase(group);
+        }
+        return progress;
+    }
+
+public:
+    // Numbers the request if it has no ID yet and starts its retransmit timer. A request that
+    // is one trip of a split group passes the number from openGroup().
+    void track(ElevatorEvent& event, int car, long long now, const std::vector<int>& refused = {}, int group = 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (event.requestId == 0) {
+            do {
+                event.requestId = nextId;
+                nextId = nextId % 0xFFFF + 1;
+            } while (pending.count(event.requestId));
+        }
+        if (group != 0) {
+            groupOf[event.requestId] = {group, event.passengers};
+        }
+        pending.erase(event.requestId);
+        pending.emplace(event.requestId, PendingRequest{event, car, 1, now + backoff(1), refused});
+        removeUnstarted(event.requestId);
+        unstarted[car].push_back(event);
+        counters.sent++;
+    }
+
+    void acknowledge(int id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (pending.erase(id)) {
+            counters.acked++;
+        }
+    }
+
+    // Stops tracking a refused request and returns it for dispatch to a different car. A car
+    // that goes out of service refuses calls it had already acknowledged but not started; those
+    // are found in its queue.
+    std::optional<PendingRequest> refuse(int id, int car) {
+        std::lock_guard<std::mutex> lock(mtx);
+        PendingRequest request;
+        auto it = pending.find(id);
+        if (it != pending.end()) {
+            request = it->second;
+            pending.erase(it);
+        } else {
+            auto calls = unstarted.find(car);
+            if (calls == unstarted.end()) {
+                return std::nullopt;
+            }
+            auto call = std::find_if(calls->second.begin(), calls->second.end(),
+                                     [id](const ElevatorEvent& event) { return event.requestId == id; });
+            if (call == calls->second.end()) {
+                return std::nullopt;
+            }
+            request = PendingRequest{*call, car, 0, 0, {}};
+        }
+        counters.nacked++;
+        steals.erase(id);
+        removeUnstarted(id);
+        if (std::find(request.refused.begin(), request.refused.end(), car) == request.refused.end()) {
+            request.refused.push_back(car);
+        }
+        return request;
+    }
+
+    // Requests whose ACK is overdue, with their timers already backed off. Requests that
+    // have used up MAX_SEND_ATTEMPTS stop being tracked and are returned in `expired`.
+    std::vector<PendingRequest> due(long long now, std::vector<PendingRequest>& expired) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::vector<PendingRequest> resend;
+        for (auto it = pending.begin(); it != pending.end();) {
+            PendingRequest& request = it->second;
+            if (request.deadline > now) {
+                ++it;
+            } else if (request.attempts >= MAX_SEND_ATTEMPTS) {
+                request.refused.push_back(request.car);
+                expired.push_back(request);
+                removeUnstarted(request.event.requestId);
+                it = pending.erase(it);
+            } else {
+                request.attempts++;
+                request.deadline = now + backoff(request.attempts);
+                counters.retransmitted++;
+                resend.push_back(request);
+                ++it;
+            }
+        }
+        return resend;
+    }
+
+    // The car has picked the riders up, so the call can no longer be stolen.
+    void started(int id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        removeUnstarted(id);
+    }
+
+    // Offers an unstarted call of the busiest other car to an idle `thief`: the newest one that
+    // `closer(victim, call)` says the thief would reach first. The call stays with the victim
+    // until it confirms the release.
+    std::optional<std::pair<int, ElevatorEvent>> chooseSteal(int thief, std::function<bool(int, const ElevatorEvent&)> closer) {
+        std::lock_guard<std::mutex> lock(mtx);
+        int victim = -1;
+        size_t busiest = 0;
+        for (const auto& [car, calls] : unstarted) {
+            if (car != thief && calls.size() > busiest) {
+                victim = car;
+                busiest = calls.size();
+            }
+        }
+        if (victim < 0) {
+            return std::nullopt;
+        }
+        const std::deque<ElevatorEvent>& calls = unstarted[victim];
+        for (auto call = calls.rbegin(); call != calls.rend(); ++call) {
+            if (!steals.count(call->requestId) && !moved.count(call->requestId) && closer(victim, *call)) {
+                steals[call->requestId] = thief;
+                return std::make_pair(victim, *call);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // The victim answered a revoke. If it let the call go, returns the car that asked to steal
+    // it together with the call.
+    std::optional<std::pair<int, ElevatorEvent>> finishSteal(int id, bool released) {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = steals.find(id);
+        if (it == steals.end()) {
+            return std::nullopt;
+        }
+        int thief = it->second;
+        steals.erase(it);
+        if (!released) {
+            return std::nullopt;
+        }
+        for (auto& [car, calls] : unstarted) {
+            for (auto call = calls.begin(); call != calls.end(); ++call) {
+                if (call->requestId == id) {
+                    ElevatorEvent event = *call;
+                    calls.erase(call);
+                    moved.insert(id);
+                    counters.stolen++;
+                    return std::make_pair(thief, event);
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Unstarted calls queued for the car at `car`.
+    size_t queued(int car) {
+        std::lock_guard<std::mutex> lock(mtx);
+        return unstarted.count(car) ? unstarted[car].size() : 0;
+    }
+
+    // Starts tracking a group of `passengers` that is being sent as several trips.
+    int openGroup(int passengers) {
+        std::lock_guard<std::mutex> lock(mtx);
+        int group = nextGroup++;
+        groups.emplace(group, GroupProgress{group, passengers});
+        return group;
+    }
+
+    // Counts a delivered request. For one trip of a split group, returns the group's progress;
+    // the group stops being tracked once everyone is accounted for.
+    std::optional<GroupProgress> complete(int id = 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        counters.completed++;
+        return settle(id, true);
+    }
+
+    // Counts a request that no car could take, with the same group accounting as complete().
+    std::optional<GroupProgress> abandon(int id = 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        counters.abandoned++;
+        return settle(id, false);
+    }
+
+    // Counts a trip of `group` that was dropped before it was ever sent.
+    std::optional<GroupProgress> abandonTrip(int group, int passengers) {
+        std::lock_guard<std::mutex> lock(mtx);
+        counters.abandoned++;
+        return settleGroup(group, passengers, false);
+    }
+
+    size_t openGroups() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return groups.size();
+    }
+
+    RequestCounters getCounters() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return counters;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return pending.size();
+    }
+};
+
+#endif // PENDING_REQUESTS_H
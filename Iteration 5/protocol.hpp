@@ -0,0 +1,43 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+
+// Every packet starts with 0x00 followed by one of these message types.
+#define MSG_REQUEST 0x01        // hall call: 17 digit bytes, then the request ID (high, low)
+#define MSG_REQUEST_V2 0x02     // hall call in the binary layout below
+#define MSG_ACK 0x05            // elevator -> scheduler: id high, id low, elevator id
+#define MSG_NACK 0x06           // elevator -> scheduler: id high, id low, elevator id, reason
+#define MSG_COMPLETE 0x07       // elevator -> scheduler: id high, id low, elevator id
+#define MSG_PICKUP 0x08         // elevator -> scheduler: id high, id low, elevator id
+#define MSG_STEAL 0x09          // idle elevator -> scheduler: 0, 0, elevator id, current floor high, low
+#define MSG_REVOKE 0x0A         // scheduler -> elevator: id high, id low
+#define MSG_RELEASED 0x0B       // elevator -> scheduler: id high, id low, elevator id, 1 released / 0 already started
+#define MSG_CREDIT_REQUEST 0x0C // floor -> scheduler: credit port high, low, credits granted so far high, low,
+                                // as the floor has seen them; the floor has run out of credits
+#define MSG_CREDIT 0x0D         // scheduler -> floor: credits granted to the floor so far high, low (mod 65536),
+                                // each good for one request
+#define MSG_CREDIT_RETURN 0x0E  // floor -> scheduler: unused credits high, low, when the floor is done
+#define MSG_REGISTER 0x0F       // elevator -> scheduler status port: elevator id, port high, low, capacity,
+                                // lowest floor high, low, highest floor high, low
+#define MSG_REGISTERED 0x10     // scheduler -> elevator: elevator id
+#define MSG_READY_QUERY 0x11    // floor -> scheduler: reply port high, low
+#define MSG_READY 0x12          // scheduler -> floor: cars in service high, low
+
+#define REQUEST_PACKET_SIZE 19
+#define REQUEST_V1_BASELINE_SIZE 17     // version 1 as first shipped, before the request ID
+#define REQUEST_V2_SIZE 16
+
+// Request layouts, defined field by field in request_codec.hpp. Version 1 holds one decimal
+// digit per byte, so every field stops at 99. Version 2 packs little-endian integers.
+#define WIRE_V1 1
+#define WIRE_V2 2
+#define STEAL_INTERVAL_MS 2000    // how often an idle elevator asks for work
+#define STARTUP_RETRY_MS 500      // how often an elevator re-registers, or a floor asks again if the scheduler is ready
+#define STARTUP_ATTEMPTS 120      // asks ./floor makes, a minute's worth, before giving up on the scheduler
+
+// NACK reasons
+#define NACK_OVER_CAPACITY 1
+#define NACK_OUT_OF_SERVICE 2
+#define NACK_STRANDED 3         // the car failed with the riders on board, or failed serving this call
+
+#endif // PROTOCOL_H
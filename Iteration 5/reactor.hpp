@@ -0,0 +1,303 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "scheduler.hpp"
+
+#define REACTOR_MAX_EVENTS 16
+
+// Every scheduler task for one bank of cars on one thread: floor requests, elevator replies,
+// status packets, the retransmit timer and the batch window, multiplexed with epoll. Requests
+// are dispatched by the thread that read them, with no queue in between, so a request goes to
+// a car of whichever bank woke first, not of a bank picked by its floor.
+template <typename Transport = ELEVATOR_TRANSPORT>
+class SchedulerReactor {
+private:
+    Scheduler<ElevatorEvent, Transport>& requests;      // FLOORREADER, shared by every bank
+    BufferPool requestBuffers;
+    BufferBatch requestBatch;                           // this thread's buffers for `requests`
+    std::vector<ElevatorEvent> requestEvents;           // and the requests decoded from them
+    Scheduler<ElevatorEvent, Transport> replies;
+    Scheduler<ElevatorEvent, Transport> status;
+    Dispatcher& dispatcher;
+    PendingRequests& pending;
+    int batchWindow;                                    // ms, 0 to dispatch every request at once
+    std::vector<ElevatorEvent> batch;
+    int epollFd;
+    int retransmitTimer;
+    int batchTimer;
+    int statsTimer = -1;
+    SocketStats* stats = nullptr;
+
+    static int makeTimer() {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("timerfd_create failed: ") + strerror(errno));
+        }
+        return fd;
+    }
+
+    static void armTimer(int fd, int firstMs, int intervalMs) {
+        itimerspec spec = {};
+        spec.it_value.tv_sec = firstMs / 1000;
+        spec.it_value.tv_nsec = firstMs % 1000 * 1000000L;
+        spec.it_interval.tv_sec = intervalMs / 1000;
+        spec.it_interval.tv_nsec = intervalMs % 1000 * 1000000L;
+        timerfd_settime(fd, 0, &spec, nullptr);
+    }
+
+    static void clearTimer(int fd) {
+        uint64_t expirations;
+        while (read(fd, &expirations, sizeof(expirations)) > 0) {}
+    }
+
+    void watch(int fd, uint32_t events) {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::runtime_error(std::string("epoll_ctl failed: ") + strerror(errno));
+        }
+    }
+
+    // Anything on the reply port that is neither a reply nor a well-formed request is counted as malformed.
+    void handleRequest(const std::vector<uint8_t>& packet) {
+        ElevatorEvent event;
+        if (replies.tryDecodeRequest(packet, event)) {
+            handleRequest(event);
+        }
+    }
+
+    void handleRequest(const ElevatorEvent& event) {
+        if (batchWindow <= 0) {
+            dispatchRequest(&replies, &dispatcher, &pending, event);
+            return;
+        }
+        if (batch.empty()) {
+            armTimer(batchTimer, batchWindow, 0);
+        }
+        batch.push_back(event);
+    }
+
+    void readRequests() {
+        while (true) {
+            std::vector<PooledBuffer>& packets = requests.tryReceiveClients(requestBatch);
+            if (packets.empty()) {
+                return;
+            }
+            requests.processBatch(packets, requestEvents);
+            for (const ElevatorEvent& event : requestEvents) {
+                handleRequest(event);
+            }
+            requests.requestsTaken(requestEvents.size());
+        }
+    }
+
+    // Replies from the bank's cars. Requests sent here, as the threaded scheduler allows, are dispatched too.
+    void readReplies() {
+        while (true) {
+            std::vector<PooledBuffer>& packets = replies.tryReceiveClients();
+            if (packets.empty()) {
+                return;
+            }
+            for (const PooledBuffer& packet : packets) {
+                if (!handleElevatorReply(&replies, &dispatcher, &pending, *packet)) {
+                    handleRequest(*packet);
+                }
+            }
+        }
+    }
+
+    void readStatus() {
+        while (true) {
+            std::vector<PooledBuffer>& packets = status.tryReceiveClients();
+            if (packets.empty()) {
+                return;
+            }
+            for (const PooledBuffer& packet : packets) {
+                if (!handleRegistration(&status, &dispatcher, *packet)) {
+                    dispatcher.updateStatus(*packet);
+                }
+            }
+        }
+    }
+
+public:
+    // `requests` may be shared with the reactors of other banks; each request is read by exactly one.
+    SchedulerReactor(Scheduler<ElevatorEvent, Transport>& requests, int bank, Dispatcher& dispatcher,
+                     PendingRequests& pending, Clock& clock, int batchWindow = 0)
+        : requests(requests), requestBatch(requestBuffers), replies(FLOORNOTIFIER + bank * BANK_PORT_STRIDE, clock),
+          status(ELEVATOR_STATUS + bank * BANK_PORT_STRIDE, clock), dispatcher(dispatcher), pending(pending),
+          batchWindow(batchWindow), epollFd(epoll_create1(EPOLL_CLOEXEC)), retransmitTimer(makeTimer()),
+          batchTimer(makeTimer()) {
+        if (epollFd < 0) {
+            throw std::runtime_error(std::string("epoll_create1 failed: ") + strerror(errno));
+        }
+        watch(requests.receiveFd(), EPOLLIN | EPOLLEXCLUSIVE);
+        watch(replies.receiveFd(), EPOLLIN);
+        watch(status.receiveFd(), EPOLLIN);
+        watch(retransmitTimer, EPOLLIN);
+        watch(batchTimer, EPOLLIN);
+        armTimer(retransmitTimer, RETRANSMIT_TIMEOUT_MS / 4, RETRANSMIT_TIMEOUT_MS / 4);
+    }
+
+    ~SchedulerReactor() {
+        if (statsTimer >= 0) {
+            close(statsTimer);
+        }
+        close(batchTimer);
+        close(retransmitTimer);
+        close(epollFd);
+    }
+
+    SchedulerReactor(const SchedulerReactor&) = delete;
+    SchedulerReactor& operator=(const SchedulerReactor&) = delete;
+
+    // Prints `report` every `intervalMs` from this loop. One reactor per process is enough.
+    void reportStats(SocketStats& report, int intervalMs) {
+        stats = &report;
+        statsTimer = makeTimer();
+        watch(statsTimer, EPOLLIN);
+        armTimer(statsTimer, intervalMs, intervalMs);
+    }
+
+    // Waits up to `timeoutMs` (-1 for ever) and handles everything that is ready. Packets to the
+    // cars go out together once every ready source has been handled. Returns the number of
+    // ready sources.
+    int poll(int timeoutMs) {
+        epoll_event events[REACTOR_MAX_EVENTS];
+        int ready = epoll_wait(epollFd, events, REACTOR_MAX_EVENTS, timeoutMs);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            throw std::runtime_error(std::string("epoll_wait failed: ") + strerror(errno));
+        }
+        replies.holdPackets();
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == requests.receiveFd()) {
+                readRequests();
+            } else if (fd == replies.receiveFd()) {
+                readReplies();
+            } else if (fd == status.receiveFd()) {
+                readStatus();
+            } else if (fd == retransmitTimer) {
+                clearTimer(retransmitTimer);
+                retransmitDue(&replies, &dispatcher, &pending);
+            } else if (fd == statsTimer) {
+                clearTimer(statsTimer);
+                stats->print();
+            } else if (fd == batchTimer) {
+                clearTimer(batchTimer);
+                dispatchBatch(&replies, &dispatcher, batch, &pending);
+                batch.clear();
+            }
+        }
+        replies.flushPackets();
+        return ready;
+    }
+
+    void run() {
+        while (true) {
+            poll(-1);
+        }
+    }
+};
+
+// Whether every port the reactors of `banks` banks wait on has a descriptor. Shared-memory ports
+// and in-process ones do not.
+template <typename Transport = ELEVATOR_TRANSPORT>
+bool reactorCanPoll(int banks) {
+    if (!canPoll<Transport>(FLOORREADER)) {
+        return false;
+    }
+    for (int bank = 0; bank < banks; bank++) {
+        if (!canPoll<Transport>(FLOORNOTIFIER + bank * BANK_PORT_STRIDE)
+                || !canPoll<Transport>(ELEVATOR_STATUS + bank * BANK_PORT_STRIDE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Keeps the calling thread on one CPU, wrapping around if there are fewer CPUs than shards.
+inline void pinToCore(int shard) {
+    unsigned cores = std::thread::hardware_concurrency();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cores > 0 ? shard % cores : 0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// The scheduler process on event loops instead of reader threads. With several banks, car i
+// belongs to bank i % banks and each bank runs its own reactor, dispatcher and retransmit
+// table on its own core. Banks spread the load: every bank reads the one request port and
+// dispatches what it reads to its own cars. Elevators must report to the same banks
+// (Elevator::reportToBank). Throws unless reactorCanPoll(banks).
+// The first bank's loop prints drops on every port every `statsInterval` ms, if not 0. With
+// `fleet` cars, as in runScheduler, cars join the bank whose status port they register on.
+template <typename Transport = ELEVATOR_TRANSPORT>
+void runSchedulerReactor(Clock& clock, int batchWindow = 0, int banks = 1, int statsInterval = 0, int fleet = 0) {
+    const int ports[] = { ELEVATOR_1, ELEVATOR_2, ELEVATOR_3, ELEVATOR_4 };
+    if (banks < 1 || banks > MAX_BANKS) {
+        throw std::runtime_error("cannot split the scheduler into " + std::to_string(banks) + " banks, it takes 1 to " + std::to_string(MAX_BANKS));
+    }
+    if (!reactorCanPoll<Transport>(banks)) {
+        throw std::runtime_error("the event loop needs ports it can poll, not shared-memory or in-process ones");
+    }
+    Scheduler<ElevatorEvent, Transport> requests(FLOORREADER, clock);
+    requests.enableFloorCredits();
+    std::vector<std::unique_ptr<Dispatcher>> dispatchers;
+    std::vector<std::unique_ptr<PendingRequests>> pending;
+    for (int bank = 0; bank < banks; bank++) {
+        dispatchers.emplace_back(new Dispatcher());
+        pending.emplace_back(new PendingRequests());
+    }
+    for (int i = 0; i < 4 && fleet == 0; i++) {
+        dispatchers[i % banks]->addCar(i + 1, ports[i]);
+    }
+    std::vector<const Dispatcher*> fleetDispatchers;
+    for (const std::unique_ptr<Dispatcher>& dispatcher : dispatchers) {
+        fleetDispatchers.push_back(dispatcher.get());
+    }
+    requests.expectCars(fleetDispatchers, fleet);
+    std::cout << "[Scheduler] Event loop serving " << banks << (banks == 1 ? " bank" : " banks") << std::endl;
+
+    std::vector<std::thread> shards;
+    for (int bank = 1; bank < banks; bank++) {
+        shards.emplace_back([&, bank] {
+            pinToCore(bank);
+            SchedulerReactor<Transport> reactor(requests, bank, *dispatchers[bank], *pending[bank], clock, batchWindow);
+            reactor.run();
+        });
+    }
+    pinToCore(0);
+    SchedulerReactor<Transport> reactor(requests, 0, *dispatchers[0], *pending[0], clock, batchWindow);
+    SocketStats stats(monitoredPorts(banks));
+    stats.addGauge("requests", [&] { return requests.describeQueue(); });
+    if (statsInterval > 0) {
+        reactor.reportStats(stats, statsInterval);
+    }
+    reactor.run();
+
+    for (std::thread& shard : shards) {
+        shard.join();
+    }
+}
+
+#endif // REACTOR_H
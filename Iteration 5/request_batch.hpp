@@ -0,0 +1,315 @@
+#ifndef REQUEST_BATCH_H
+#define REQUEST_BATCH_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "protocol.hpp"
+#include "request_codec.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define REQUEST_BATCH_X86 1
+#endif
+
+#define REQUEST_BATCH_MAX 64        // one bit per packet in the invalid mask
+#define DAY_MS 86400000
+
+// A request decoded from a batch, with the layout it arrived in.
+struct DecodedRequest {
+    WireRequest request;
+    uint8_t version = 0;
+};
+
+// Instruction sets the batch decoder can use. Best picks the widest the CPU has.
+enum class SimdLevel { Scalar, Ssse3, Avx2, Best };
+
+// Smallest and largest value of each byte of a well-formed version 1 request, from its layout:
+// digits 0-9, except that tens of hours stop at 2 and tens of minutes and seconds at 5.
+struct ByteLimits {
+    std::array<uint8_t, REQUEST_PACKET_SIZE> low{};
+    std::array<uint8_t, REQUEST_PACKET_SIZE> high{};
+};
+
+constexpr ByteLimits requestByteLimits() {
+    ByteLimits limits;
+    for (const FieldSpec& spec : RequestLayout<WIRE_V1>::fields) {
+        for (int i = 0; i < spec.width; i++) {
+            uint8_t low = 0;
+            uint8_t high = 0xFF;
+            if (spec.field == Field::Zero) high = 0;
+            else if (spec.field == Field::Type) low = high = MSG_REQUEST;
+            else if (spec.field == Field::Up) high = 1;
+            else if (spec.field == Field::Fault) high = 2;
+            else if (spec.encoding == Encoding::Digits) {
+                high = 9;
+                if (i == 0 && spec.field == Field::Hour) high = 2;
+                if (i == 0 && (spec.field == Field::Minute || spec.field == Field::Second)) high = 5;
+            }
+            limits.low[spec.offset + i] = low;
+            limits.high[spec.offset + i] = high;
+        }
+    }
+    return limits;
+}
+
+inline constexpr ByteLimits REQUEST_BYTE_LIMITS = requestByteLimits();
+
+// Where a version 1 field starts and how wide it is, from the layout.
+constexpr FieldSpec v1Field(Field field) {
+    for (const FieldSpec& spec : RequestLayout<WIRE_V1>::fields) {
+        if (spec.field == field) {
+            return spec;
+        }
+    }
+    return FieldSpec{field, Encoding::Byte, -1, 0};
+}
+
+// A two-digit field the vector paths combine in the 16-bit lane at offset / 2 of the first 16 bytes.
+constexpr bool inEvenLane(Field field) {
+    return v1Field(field).encoding == Encoding::Digits && v1Field(field).width == 2 &&
+           v1Field(field).offset % 2 == 0 && v1Field(field).offset + 2 <= 16;
+}
+
+// The same for one read from the bytes shifted down by one, lane (offset - 1) / 2.
+constexpr bool inOddLane(Field field) {
+    return v1Field(field).encoding == Encoding::Digits && v1Field(field).width == 2 &&
+           v1Field(field).offset % 2 == 1 && v1Field(field).offset + 2 <= 16;
+}
+
+constexpr bool isByte(Field field, Encoding encoding = Encoding::Byte) {
+    return v1Field(field).encoding == encoding && v1Field(field).width == 1;
+}
+
+static_assert(inEvenLane(Field::Hour) && inEvenLane(Field::Minute) && inEvenLane(Field::Second) &&
+              inEvenLane(Field::FloorsToMove) && inEvenLane(Field::Passengers) && inOddLane(Field::Floor),
+              "the v1 layout no longer puts its digit pairs where the vector decoders read them");
+static_assert(isByte(Field::Tenths, Encoding::Digits) && isByte(Field::Up) && isByte(Field::Fault) &&
+              v1Field(Field::RequestId).encoding == Encoding::BigEndian && v1Field(Field::RequestId).width == 2,
+              "the v1 layout no longer has the single bytes and big-endian ID the decoders read");
+
+// 16-bit lanes of the digit pairs, and offsets of the bytes read directly.
+constexpr int V1_HOUR_LANE = v1Field(Field::Hour).offset / 2;
+constexpr int V1_MINUTE_LANE = v1Field(Field::Minute).offset / 2;
+constexpr int V1_SECOND_LANE = v1Field(Field::Second).offset / 2;
+constexpr int V1_FLOOR_LANE = (v1Field(Field::Floor).offset - 1) / 2;
+constexpr int V1_FLOORS_TO_MOVE_LANE = v1Field(Field::FloorsToMove).offset / 2;
+constexpr int V1_PASSENGERS_LANE = v1Field(Field::Passengers).offset / 2;
+constexpr int V1_HOUR = v1Field(Field::Hour).offset;
+constexpr int V1_TENTHS = v1Field(Field::Tenths).offset;
+constexpr int V1_UP = v1Field(Field::Up).offset;
+constexpr int V1_FAULT = v1Field(Field::Fault).offset;
+constexpr int V1_REQUEST_ID = v1Field(Field::RequestId).offset;
+
+// Bytes past the first 16, which the vector paths check one by one.
+inline bool tailInLimits(const uint8_t* in) {
+    for (int i = 16; i < REQUEST_PACKET_SIZE; i++) {
+        if (in[i] < REQUEST_BYTE_LIMITS.low[i] || in[i] > REQUEST_BYTE_LIMITS.high[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Version 1, one byte at a time. Also the reference the vector paths are tested against.
+inline bool decodeV1Scalar(const uint8_t* in, WireRequest& out) {
+    bool outside = false;
+    for (int i = 0; i < REQUEST_PACKET_SIZE; i++) {
+        // Unsigned wrap-around turns low <= byte <= high into one comparison.
+        outside |= static_cast<uint8_t>(in[i] - REQUEST_BYTE_LIMITS.low[i]) >
+                   static_cast<uint8_t>(REQUEST_BYTE_LIMITS.high[i] - REQUEST_BYTE_LIMITS.low[i]);
+    }
+    if (outside || in[V1_HOUR] * 10 + in[V1_HOUR + 1] > 23) {
+        return false;
+    }
+    out = decodeRequest<WIRE_V1>(in);
+    return true;
+}
+
+// Version 2 carries binary integers, so only the header, flags and time of day can be wrong.
+inline bool decodeV2(const uint8_t* in, WireRequest& out) {
+    if (in[2] != WIRE_V2 || in[3] > (1 | 2 << 1)) {
+        return false;
+    }
+    WireRequest request = decodeRequest<WIRE_V2>(in);
+    if (request.timeMs >= DAY_MS) {
+        return false;
+    }
+    out = request;
+    return true;
+}
+
+#ifdef REQUEST_BATCH_X86
+// The first 16 bytes of a version 1 request: whether each is within its limits, and the fields.
+// Digit pairs at even offsets are combined by one multiply-add (tens * 10 + ones); the floor,
+// which starts at an odd offset, by a second on the bytes shifted down by one.
+__attribute__((target("ssse3")))
+inline bool decodeV1Ssse3(const uint8_t* in, WireRequest& out) {
+    const __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(REQUEST_BYTE_LIMITS.low.data()));
+    const __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(REQUEST_BYTE_LIMITS.high.data()));
+    const __m128i tensOnes = _mm_set1_epi16(0x010A);
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    __m128i inRange = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(bytes, low), bytes),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(bytes, high), bytes));
+    if (_mm_movemask_epi8(inRange) != 0xFFFF || !tailInLimits(in)) {
+        return false;
+    }
+    __m128i pairs = _mm_maddubs_epi16(bytes, tensOnes);
+    __m128i oddPairs = _mm_maddubs_epi16(_mm_srli_si128(bytes, 1), tensOnes);
+    int hour = _mm_extract_epi16(pairs, V1_HOUR_LANE);
+    if (hour > 23) {
+        return false;
+    }
+    out.timeMs = ((hour * 60 + _mm_extract_epi16(pairs, V1_MINUTE_LANE)) * 60 + _mm_extract_epi16(pairs, V1_SECOND_LANE)) * 1000 +
+                 in[V1_TENTHS] * 100;
+    out.floor = _mm_extract_epi16(oddPairs, V1_FLOOR_LANE);
+    out.up = in[V1_UP];
+    out.floorsToMove = _mm_extract_epi16(pairs, V1_FLOORS_TO_MOVE_LANE);
+    out.passengers = _mm_extract_epi16(pairs, V1_PASSENGERS_LANE);
+    out.fault = in[V1_FAULT];
+    out.requestId = in[V1_REQUEST_ID] << 8 | in[V1_REQUEST_ID + 1];
+    return true;
+}
+
+// Two version 1 requests at once, one per 128-bit lane; the same steps as decodeV1Ssse3.
+// Returns a bit per request that was well-formed.
+__attribute__((target("avx2")))
+inline int decodeV1PairAvx2(const uint8_t* first, const uint8_t* second, WireRequest& firstOut, WireRequest& secondOut) {
+    const __m256i low = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(REQUEST_BYTE_LIMITS.low.data())));
+    const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(REQUEST_BYTE_LIMITS.high.data())));
+    const __m256i tensOnes = _mm256_set1_epi16(0x010A);
+    __m256i bytes = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first))),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(second)), 1);
+    __m256i inRange = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(bytes, low), bytes),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(bytes, high), bytes));
+    uint32_t laneMask = _mm256_movemask_epi8(inRange);
+    __m256i pairs = _mm256_maddubs_epi16(bytes, tensOnes);
+    __m256i oddPairs = _mm256_maddubs_epi16(_mm256_srli_si256(bytes, 1), tensOnes);
+
+    int valid = 0;
+    int firstHour = _mm256_extract_epi16(pairs, V1_HOUR_LANE);
+    if ((laneMask & 0xFFFF) == 0xFFFF && tailInLimits(first) && firstHour <= 23) {
+        firstOut.timeMs = ((firstHour * 60 + _mm256_extract_epi16(pairs, V1_MINUTE_LANE)) * 60 +
+                           _mm256_extract_epi16(pairs, V1_SECOND_LANE)) * 1000 + first[V1_TENTHS] * 100;
+        firstOut.floor = _mm256_extract_epi16(oddPairs, V1_FLOOR_LANE);
+        firstOut.up = first[V1_UP];
+        firstOut.floorsToMove = _mm256_extract_epi16(pairs, V1_FLOORS_TO_MOVE_LANE);
+        firstOut.passengers = _mm256_extract_epi16(pairs, V1_PASSENGERS_LANE);
+        firstOut.fault = first[V1_FAULT];
+        firstOut.requestId = first[V1_REQUEST_ID] << 8 | first[V1_REQUEST_ID + 1];
+        valid |= 1;
+    }
+    int secondHour = _mm256_extract_epi16(pairs, V1_HOUR_LANE + 8);
+    if (laneMask >> 16 == 0xFFFF && tailInLimits(second) && secondHour <= 23) {
+        secondOut.timeMs = ((secondHour * 60 + _mm256_extract_epi16(pairs, V1_MINUTE_LANE + 8)) * 60 +
+                           _mm256_extract_epi16(pairs, V1_SECOND_LANE + 8)) * 1000 + second[V1_TENTHS] * 100;
+        secondOut.floor = _mm256_extract_epi16(oddPairs, V1_FLOOR_LANE + 8);
+        secondOut.up = second[V1_UP];
+        secondOut.floorsToMove = _mm256_extract_epi16(pairs, V1_FLOORS_TO_MOVE_LANE + 8);
+        secondOut.passengers = _mm256_extract_epi16(pairs, V1_PASSENGERS_LANE + 8);
+        secondOut.fault = second[V1_FAULT];
+        secondOut.requestId = second[V1_REQUEST_ID] << 8 | second[V1_REQUEST_ID + 1];
+        valid |= 2;
+    }
+    return valid;
+}
+#endif
+
+inline SimdLevel bestSimdLevel() {
+#ifdef REQUEST_BATCH_X86
+    static const SimdLevel level = __builtin_cpu_supports("avx2") ? SimdLevel::Avx2
+                                 : __builtin_cpu_supports("ssse3") ? SimdLevel::Ssse3 : SimdLevel::Scalar;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+// The batch loop for one instruction set. Always inlined into the wrappers below, which carry
+// the target attribute, so the kernels are inlined into it in turn.
+template <SimdLevel Level>
+__attribute__((always_inline))
+inline uint64_t decodeBatchWith(const std::vector<uint8_t>* const packets[], int count, DecodedRequest out[]) {
+    uint64_t invalid = 0;
+    int pending = -1;           // a version 1 request waiting for a partner in the other AVX2 lane
+    for (int i = 0; i < count && i < REQUEST_BATCH_MAX; i++) {
+        const std::vector<uint8_t>& packet = *packets[i];
+        int version = requestVersion(packet);
+        bool valid = false;
+        if (version == WIRE_V2) {
+            valid = decodeV2(packet.data(), out[i].request);
+        } else if (version == WIRE_V1 && packet.size() < REQUEST_PACKET_SIZE) {
+            valid = decodeV1Scalar(fullV1(packet).data(), out[i].request);
+        } else if (version == WIRE_V1) {
+#ifdef REQUEST_BATCH_X86
+            if constexpr (Level == SimdLevel::Avx2) {
+                if (pending < 0) {
+                    pending = i;
+                    continue;
+                }
+                int pair = decodeV1PairAvx2(packets[pending]->data(), packet.data(), out[pending].request, out[i].request);
+                if (pair & 1) {
+                    out[pending].version = WIRE_V1;
+                }
+                invalid |= static_cast<uint64_t>(!(pair & 1)) << pending;
+                pending = -1;
+                valid = pair & 2;
+            } else if constexpr (Level == SimdLevel::Ssse3) {
+                valid = decodeV1Ssse3(packet.data(), out[i].request);
+            } else
+#endif
+            valid = decodeV1Scalar(packet.data(), out[i].request);
+        }
+        if (valid) {
+            out[i].version = version;
+        }
+        invalid |= static_cast<uint64_t>(!valid) << i;
+    }
+#ifdef REQUEST_BATCH_X86
+    if constexpr (Level == SimdLevel::Avx2) {
+        if (pending >= 0) {
+            bool valid = decodeV1Ssse3(packets[pending]->data(), out[pending].request);
+            if (valid) {
+                out[pending].version = WIRE_V1;
+            }
+            invalid |= static_cast<uint64_t>(!valid) << pending;
+        }
+    }
+#endif
+    return invalid;
+}
+
+#ifdef REQUEST_BATCH_X86
+__attribute__((target("ssse3")))
+inline uint64_t decodeBatchSsse3(const std::vector<uint8_t>* const packets[], int count, DecodedRequest out[]) {
+    return decodeBatchWith<SimdLevel::Ssse3>(packets, count, out);
+}
+
+__attribute__((target("avx2")))
+inline uint64_t decodeBatchAvx2(const std::vector<uint8_t>* const packets[], int count, DecodedRequest out[]) {
+    return decodeBatchWith<SimdLevel::Avx2>(packets, count, out);
+}
+#endif
+
+// Validates and decodes up to REQUEST_BATCH_MAX request packets, version 1 with vector
+// instructions where the CPU has them. Returns a mask with bit i set for each packet that is not a
+// well-formed request (wrong header, a byte outside its field's range, a time past midnight); out[i]
+// is left as it was for those. Nothing throws, so one bad datagram costs no more than a good one.
+// `level` must be one the CPU has; tests compare the paths.
+inline uint64_t decodeRequestBatch(const std::vector<uint8_t>* const packets[], int count, DecodedRequest out[],
+                                   SimdLevel level = SimdLevel::Best) {
+    if (level == SimdLevel::Best) {
+        level = bestSimdLevel();
+    }
+#ifdef REQUEST_BATCH_X86
+    if (level == SimdLevel::Avx2) {
+        return decodeBatchAvx2(packets, count, out);
+    }
+    if (level == SimdLevel::Ssse3) {
+        return decodeBatchSsse3(packets, count, out);
+    }
+#endif
+    return decodeBatchWith<SimdLevel::Scalar>(packets, count, out);
+}
+
+#endif // REQUEST_BATCH_H
@@ -0,0 +1,235 @@
+#ifndef REQUEST_CODEC_H
+#define REQUEST_CODEC_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "protocol.hpp"
+
+// Numeric content of a hall call request as it travels on the wire.
+struct WireRequest {
+    uint32_t timeMs = 0;        // since midnight
+    uint16_t floor = 0;
+    uint16_t floorsToMove = 0;
+    uint16_t passengers = 0;
+    uint16_t requestId = 0;
+    uint8_t up = 0;
+    uint8_t fault = 0;          // 0 none, 1 minor, 2 major
+};
+
+enum class Field { Zero, Type, Version, Hour, Minute, Second, Tenths, Time, Floor, Up, FloorsToMove, Passengers, Fault, Flags, RequestId };
+enum class Encoding { Byte, Digits, LittleEndian, BigEndian };
+
+struct FieldSpec {
+    Field field;
+    Encoding encoding;
+    int offset;
+    int width;                  // bytes
+};
+
+template <size_t N>
+constexpr int layoutSize(const FieldSpec (&fields)[N]) {
+    int size = 0;
+    for (const FieldSpec& spec : fields) {
+        size = spec.offset + spec.width > size ? spec.offset + spec.width : size;
+    }
+    return size;
+}
+
+// True if every byte of the packet belongs to exactly one field.
+template <size_t N>
+constexpr bool layoutIsDense(const FieldSpec (&fields)[N]) {
+    int covered = 0;
+    for (const FieldSpec& spec : fields) {
+        for (const FieldSpec& other : fields) {
+            if (&spec != &other && spec.offset < other.offset + other.width && other.offset < spec.offset + spec.width) {
+                return false;
+            }
+        }
+        covered += spec.width;
+    }
+    return covered == layoutSize(fields);
+}
+
+// The one description of each request layout. Encoder and decoder are both generated from it.
+template <int Version>
+struct RequestLayout;
+
+template <>
+struct RequestLayout<WIRE_V1> {
+    static constexpr uint8_t TYPE = MSG_REQUEST;
+    static constexpr FieldSpec fields[] = {
+        {Field::Zero, Encoding::Byte, 0, 1},
+        {Field::Type, Encoding::Byte, 1, 1},
+        {Field::Hour, Encoding::Digits, 2, 2},
+        {Field::Minute, Encoding::Digits, 4, 2},
+        {Field::Second, Encoding::Digits, 6, 2},
+        {Field::Tenths, Encoding::Digits, 8, 1},
+        {Field::Floor, Encoding::Digits, 9, 2},
+        {Field::Up, Encoding::Byte, 11, 1},
+        {Field::FloorsToMove, Encoding::Digits, 12, 2},
+        {Field::Passengers, Encoding::Digits, 14, 2},
+        {Field::Fault, Encoding::Byte, 16, 1},
+        {Field::RequestId, Encoding::BigEndian, 17, 2},
+    };
+    static constexpr int SIZE = layoutSize(fields);
+};
+
+template <>
+struct RequestLayout<WIRE_V2> {
+    static constexpr uint8_t TYPE = MSG_REQUEST_V2;
+    static constexpr FieldSpec fields[] = {
+        {Field::Zero, Encoding::Byte, 0, 1},
+        {Field::Type, Encoding::Byte, 1, 1},
+        {Field::Version, Encoding::Byte, 2, 1},
+        {Field::Flags, Encoding::Byte, 3, 1},
+        {Field::Time, Encoding::LittleEndian, 4, 4},
+        {Field::Floor, Encoding::LittleEndian, 8, 2},
+        {Field::FloorsToMove, Encoding::LittleEndian, 10, 2},
+        {Field::Passengers, Encoding::LittleEndian, 12, 2},
+        {Field::RequestId, Encoding::LittleEndian, 14, 2},
+    };
+    static constexpr int SIZE = layoutSize(fields);
+};
+
+static_assert(RequestLayout<WIRE_V1>::SIZE == REQUEST_PACKET_SIZE, "v1 layout does not match REQUEST_PACKET_SIZE");
+static_assert(RequestLayout<WIRE_V2>::SIZE == REQUEST_V2_SIZE, "v2 layout does not match REQUEST_V2_SIZE");
+static_assert(layoutIsDense(RequestLayout<WIRE_V1>::fields), "v1 fields overlap or leave gaps");
+static_assert(layoutIsDense(RequestLayout<WIRE_V2>::fields), "v2 fields overlap or leave gaps");
+
+template <int Version, Field F>
+constexpr uint32_t fieldValue(const WireRequest& request) {
+    if constexpr (F == Field::Zero) return 0;
+    else if constexpr (F == Field::Type) return RequestLayout<Version>::TYPE;
+    else if constexpr (F == Field::Version) return Version;
+    else if constexpr (F == Field::Hour) return request.timeMs / 3600000 % 24;
+    else if constexpr (F == Field::Minute) return request.timeMs / 60000 % 60;
+    else if constexpr (F == Field::Second) return request.timeMs / 1000 % 60;
+    else if constexpr (F == Field::Tenths) return request.timeMs % 1000 / 100;
+    else if constexpr (F == Field::Time) return request.timeMs;
+    else if constexpr (F == Field::Floor) return request.floor;
+    else if constexpr (F == Field::Up) return request.up;
+    else if constexpr (F == Field::FloorsToMove) return request.floorsToMove;
+    else if constexpr (F == Field::Passengers) return request.passengers;
+    else if constexpr (F == Field::Fault) return request.fault;
+    else if constexpr (F == Field::Flags) return request.up | request.fault << 1;
+    else return request.requestId;
+}
+
+template <Field F>
+constexpr void setField(WireRequest& request, uint32_t value) {
+    if constexpr (F == Field::Hour) request.timeMs += value * 3600000;
+    else if constexpr (F == Field::Minute) request.timeMs += value * 60000;
+    else if constexpr (F == Field::Second) request.timeMs += value * 1000;
+    else if constexpr (F == Field::Tenths) request.timeMs += value * 100;
+    else if constexpr (F == Field::Time) request.timeMs = value;
+    else if constexpr (F == Field::Floor) request.floor = value;
+    else if constexpr (F == Field::Up) request.up = value == 1;
+    else if constexpr (F == Field::FloorsToMove) request.floorsToMove = value;
+    else if constexpr (F == Field::Passengers) request.passengers = value;
+    else if constexpr (F == Field::Fault) request.fault = value;
+    else if constexpr (F == Field::Flags) {
+        request.up = value & 1;
+        request.fault = value >> 1 & 0x3;
+    }
+    else if constexpr (F == Field::RequestId) request.requestId = value;
+}
+
+template <Encoding E, int Width>
+constexpr void writeField(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < Width; i++) {
+        if constexpr (E == Encoding::Byte) out[i] = value;
+        else if constexpr (E == Encoding::Digits) {
+            out[Width - 1 - i] = value % 10;
+            value /= 10;
+        }
+        else if constexpr (E == Encoding::LittleEndian) out[i] = value >> (8 * i) & 0xFF;
+        else out[Width - 1 - i] = value >> (8 * i) & 0xFF;
+    }
+}
+
+template <Encoding E, int Width>
+constexpr uint32_t readField(const uint8_t* in) {
+    uint32_t value = 0;
+    for (int i = 0; i < Width; i++) {
+        if constexpr (E == Encoding::Byte) value = in[i];
+        else if constexpr (E == Encoding::Digits) value = value * 10 + in[i];
+        else if constexpr (E == Encoding::LittleEndian) value |= static_cast<uint32_t>(in[i]) << (8 * i);
+        else value = value << 8 | in[i];
+    }
+    return value;
+}
+
+template <int Version, size_t... I>
+void encodeFields(const WireRequest& request, uint8_t* out, std::index_sequence<I...>) {
+    using Layout = RequestLayout<Version>;
+    (writeField<Layout::fields[I].encoding, Layout::fields[I].width>(
+        out + Layout::fields[I].offset, fieldValue<Version, Layout::fields[I].field>(request)), ...);
+}
+
+template <int Version, size_t... I>
+void decodeFields(const uint8_t* in, WireRequest& request, std::index_sequence<I...>) {
+    using Layout = RequestLayout<Version>;
+    (setField<Layout::fields[I].field>(
+        request, readField<Layout::fields[I].encoding, Layout::fields[I].width>(in + Layout::fields[I].offset)), ...);
+}
+
+template <int Version>
+std::array<uint8_t, RequestLayout<Version>::SIZE> encodeRequest(const WireRequest& request) {
+    constexpr size_t count = std::size(RequestLayout<Version>::fields);
+    std::array<uint8_t, RequestLayout<Version>::SIZE> packet{};
+    encodeFields<Version>(request, packet.data(), std::make_index_sequence<count>());
+    return packet;
+}
+
+// `in` must hold RequestLayout<Version>::SIZE bytes.
+template <int Version>
+WireRequest decodeRequest(const uint8_t* in) {
+    constexpr size_t count = std::size(RequestLayout<Version>::fields);
+    WireRequest request;
+    decodeFields<Version>(in, request, std::make_index_sequence<count>());
+    return request;
+}
+
+// Whether every field fits the one-digit-per-byte version 1 layout.
+inline bool fitsV1(const WireRequest& request) {
+    return request.floor <= 99 && request.floorsToMove <= 99 && request.passengers <= 99 && request.timeMs % 100 == 0;
+}
+
+// Layout version of a request packet, or 0 if it is not a request. A version 1 packet may also be
+// exactly REQUEST_V1_BASELINE_SIZE bytes, without an ID; widen it with fullV1 before decoding.
+inline int requestVersion(const std::vector<uint8_t>& data) {
+    if (data.size() < 2 || data[0] != 0) {
+        return 0;
+    }
+    if (data[1] == MSG_REQUEST && (data.size() == REQUEST_V1_BASELINE_SIZE || data.size() >= REQUEST_PACKET_SIZE)) {
+        return WIRE_V1;
+    }
+    if (data[1] == MSG_REQUEST_V2 && data.size() >= RequestLayout<WIRE_V2>::SIZE && data[2] == WIRE_V2) {
+        return WIRE_V2;
+    }
+    return 0;
+}
+
+// A version 1 packet at full size. One without an ID gets ID 0, as a floor sends it anyway, so the
+// scheduler numbers it like any new request.
+inline std::array<uint8_t, REQUEST_PACKET_SIZE> fullV1(const std::vector<uint8_t>& data) {
+    std::array<uint8_t, REQUEST_PACKET_SIZE> packet{};
+    std::copy_n(data.begin(), std::min(data.size(), packet.size()), packet.begin());
+    return packet;
+}
+
+// Encodes in `version`, or in version 2 if the request does not fit version 1.
+inline std::vector<uint8_t> encodeRequest(const WireRequest& request, int version) {
+    if (version >= WIRE_V2 || !fitsV1(request)) {
+        std::array<uint8_t, REQUEST_V2_SIZE> packet = encodeRequest<WIRE_V2>(request);
+        return std::vector<uint8_t>(packet.begin(), packet.end());
+    }
+    std::array<uint8_t, REQUEST_PACKET_SIZE> packet = encodeRequest<WIRE_V1>(request);
+    return std::vector<uint8_t>(packet.begin(), packet.end());
+}
+
+#endif // REQUEST_CODEC_H
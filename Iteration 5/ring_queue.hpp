@@ -0,0 +1,111 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+// Bounded multi-producer/multi-consumer ring buffer. Every slot carries a sequence number that
+// tells producers and consumers whose turn it is, so neither side ever takes a lock.
+// The capacity is rounded up to a power of two.
+template <typename T>
+class RingQueue {
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    static constexpr size_t CACHE_LINE = 64;
+
+    Slot* slots;
+    size_t mask;
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};    // next slot to pop
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};    // next slot to push
+
+public:
+    RingQueue(size_t capacity) {
+        if (capacity < 2) {
+            throw std::runtime_error("RingQueue capacity must be at least 2");
+        }
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        slots = new Slot[size];
+        for (size_t i = 0; i < size; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~RingQueue() {
+        while (tryPop()) {}
+        delete[] slots;
+    }
+
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+
+    // Returns false when the queue is full.
+    bool tryPush(T item) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    new (slot.storage) T(std::move(item));
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns an empty optional when the queue is empty.
+    std::optional<T> tryPop() {
+        size_t position = head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    std::optional<T> item(std::move(*slot.item()));
+                    slot.item()->~T();
+                    slot.sequence.store(position + mask + 1, std::memory_order_release);
+                    return item;
+                }
+            } else if (difference < 0) {
+                return std::nullopt;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate while other threads are pushing or popping.
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return mask + 1; }
+};
+
+#endif // RING_QUEUE_H
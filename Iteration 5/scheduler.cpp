@@ -1,40 +1,87 @@
 #include <chrono>
 #include <thread>
+#include <climits>
 #include <cstdlib>
 #include <iostream>
 #include <string>
 #include <unistd.h>
 #include <functional>
+#include <algorithm>
 #include "scheduler.hpp"
+#include "reactor.hpp"
 #include "elevator.hpp"
 #include "elevator_event.hpp"
 
 #ifndef DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
-int main() {
+int main(int argc, char* argv[]) {
     std::cout << "[Scheduler] Request input from the Floor Subsystem" << std::endl;
+    Clock& clock = Clock::fromArgs(argc, argv);
 
-    Elevator<ElevatorEvent> elevator1(71, 1);
-    Elevator<ElevatorEvent> elevator2(72, 2);
+    // --batch-window N collects calls for N ms and assigns them together.
+    // --reactor runs on one epoll event loop; --banks N runs one loop per bank of cars.
+    // --stats [N] prints socket drops and queue depth every N ms (STATS_INTERVAL_MS by default).
+    // --ingress N reads requests on N threads, each with its own SO_REUSEPORT socket on port 23.
+    // --cars N starts with no cars and waits for N elevators to register (./elevator --cars N).
+    int batchWindow = 0;
+    int banks = 0;
+    int statsInterval = 0;
+    int ingress = 1;
+    int fleet = 0;
 
-    Scheduler<ElevatorEvent> scheduler(23);
-    Scheduler<ElevatorEvent> floorNotifier(24);
-
-    std::thread floorThread(floorReader, &scheduler);
-    std::thread elevatorThread(alertElevator, &scheduler);
-
-    while (true) {
-        std::vector<uint8_t> data = floorNotifier.receiveClient();
-        if (static_cast<int>(data[0]) == 1 && static_cast<int>(data[1]) == 1) {
-            std::cout << "[Scheduler] Request completed\n";
+    // The argument at `i` as a whole number from `low` to `high`; false if it is missing or not one.
+    auto number = [&](int i, long low, long high, int& value) {
+        char* end = nullptr;
+        long parsed = i < argc ? std::strtol(argv[i], &end, 10) : 0;
+        if (end == nullptr || end == argv[i] || *end != '\0' || parsed < low || parsed > high) {
+            return false;
         }
-        else {
-            ElevatorEvent packetInfo = floorNotifier.processData(data);
-            floorNotifier.put(packetInfo);
+        value = parsed;
+        return true;
+    };
+    auto usage = [&](const std::string& option, const std::string& meaning) {
+        std::cerr << "Usage: " << argv[0] << " [" << option << "] ...\n  " << option << "   " << meaning << std::endl;
+        return 1;
+    };
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--batch-window") {
+            if (!number(i + 1, 0, INT_MAX, batchWindow)) {
+                return usage("--batch-window N", "collect calls for N ms and assign them together, 0 to assign each at once");
+            }
+        } else if (arg == "--reactor") {
+            banks = std::max(banks, 1);
+        } else if (arg == "--banks") {
+            if (!number(i + 1, 1, MAX_BANKS, banks)) {
+                return usage("--banks 1-" + std::to_string(MAX_BANKS), "run one event loop per bank of cars");
+            }
+        } else if (arg == "--cars") {
+            if (!number(i + 1, 0, 255, fleet)) {
+                return usage("--cars 0-255", "start with no cars and wait for N to register, 0 for the four on ELEVATOR_1..4");
+            }
+        } else if (arg == "--ingress") {
+            if (!number(i + 1, 1, 64, ingress)) {
+                return usage("--ingress 1-64", "read requests on N threads sharing port " + std::to_string(FLOORREADER));
+            }
+        } else if (arg == "--stats") {
+            statsInterval = STATS_INTERVAL_MS;
+            if (i + 1 < argc && std::string(argv[i + 1]).rfind("--", 0) != 0 && !number(i + 1, 1, INT_MAX, statsInterval)) {
+                return usage("--stats [N]", "print socket drops and queue depth every N ms, N > 0");
+            }
         }
     }
 
-    floorThread.join();
-    elevatorThread.join();
+    if (banks > 0 && !reactorCanPoll(banks)) {
+        std::cerr << "Usage: " << argv[0] << " [--reactor | --banks N] ...   (not with the scheduler's ports in ELEVATOR_SHM_CHANNELS)" << std::endl;
+        return 1;
+    }
+
+    Elevator<ElevatorEvent> elevator1(71, 1, clock);
+    Elevator<ElevatorEvent> elevator2(72, 2, clock);
+
+    if (banks > 0) {
+        runSchedulerReactor(clock, batchWindow, banks, statsInterval, fleet);
+    }
+    runScheduler(clock, batchWindow, statsInterval, ingress, fleet);
 }
 
 #endif
\ No newline at end of file
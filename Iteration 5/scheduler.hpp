@@ -3,6 +3,7 @@
 
 #define FLOORREADER 23
 #define FLOORNOTIFIER 24
+#define ELEVATOR_STATUS 25
 #define ELEVATOR_1 69
 #define ELEVATOR_2 70
 #define ELEVATOR_3 471
@@ -10,36 +11,194 @@
 #define DISPLAY_CONSOLE 75
 #define DISPLAY_PORT 99
 
+// A scheduler sharded by bank takes replies and status packets for bank k on
+// FLOORNOTIFIER and ELEVATOR_STATUS plus k * BANK_PORT_STRIDE.
+#define BANK_PORT_STRIDE 100
+#define MAX_BANKS 4                 // banks a scheduler can be split into, one per default car
+
+// Build with -DSCHEDULER_LOCKFREE_QUEUE to replace the mutex-guarded std::queue with a
+// bounded lock-free ring of SCHEDULER_QUEUE_CAPACITY requests.
+#ifndef SCHEDULER_QUEUE_CAPACITY
+#define SCHEDULER_QUEUE_CAPACITY 1024
+#endif
+
+// Requests floors may have sent against credits but the scheduler not yet taken off its queue:
+// an eighth of the queue, which also keeps a full window within the request port's default
+// socket receive buffer, so nothing sent against a credit is dropped on the way in.
+#ifndef FLOOR_CREDIT_WINDOW
+#define FLOOR_CREDIT_WINDOW (SCHEDULER_QUEUE_CAPACITY / 8)
+#endif
+
 #include <queue>
+#include <atomic>
+#include <optional>
 #include <mutex>
 #include <condition_variable>
+#include <thread>
 #include <iostream>
 #include <unistd.h>
 #include <string>
 #include <time.h>
 #include "elevator_event.hpp"
-#include "Datagram1.h"
+#include "request_batch.hpp"
+#include "transport.hpp"
+#include "clock.hpp"
+#include "ring_queue.hpp"
+#include "buffer_pool.hpp"
+#include "floor_credits.hpp"
+#include "socket_stats.hpp"
+#include "dispatcher.hpp"
+#include "pending_requests.hpp"
 
 enum class SchedulerState {
     BUSY,
     IDLE
 };
 
-template <typename Type>
+template <typename Type, typename Transport = ELEVATOR_TRANSPORT>
 class Scheduler {
 private:
+#ifdef SCHEDULER_LOCKFREE_QUEUE
+    RingQueue<Type> queue;
+    std::atomic<int> waiting;       // consumers parked on the condition variable
+#else
     std::queue<Type> queue;
+#endif
     std::mutex mtx;
     std::condition_variable cv;
-    DatagramSocket ServerSocket;
-    DatagramSocket ClientSocket;
-    SchedulerState state;
+    Transport ServerSocket;
+    Transport ClientSocket;
+    int clientPort;
+    std::atomic<SchedulerState> state;
+    std::atomic<long> overflows;
+    std::atomic<size_t> highWater;  // deepest the queue has been
+    Clock& clock;
+
+    // Receive buffers come from a fixed pool; `batch` holds the ones receiveClients() hands out.
+    BufferPool pool;
+    BufferBatch batch;
+    std::atomic<long> truncated;
+    std::atomic<long> receiveErrors;
+    std::atomic<long> malformed;
+
+    // Flow control for floor clients, if enabled.
+    std::optional<FloorCredits> credits;
+
+    // Floors are told the scheduler is ready once these dispatchers hold `readyCars` cars between them.
+    std::vector<const Dispatcher*> fleet;
+    size_t readyCars = 0;
+
+    // Packets held back for one batched send.
+    std::vector<std::pair<std::vector<uint8_t>, int>> outbox;
+    bool holding = false;
+
+    // A datagram longer than its buffer is dropped rather than decoded cut short.
+    bool complete(const DatagramPacket& packet) {
+        if (!packet.isTruncated()) {
+            return true;
+        }
+        truncated++;
+        std::cout << "[Scheduler] Dropped a datagram longer than " << pool.bufferSize() << " bytes" << std::endl;
+        return false;
+    }
+
+    // Socket errors are reported and counted, and the caller gets nothing, as after a timeout.
+    void receiveFailed(const std::runtime_error& e) {
+        receiveErrors++;
+        std::cerr << "[Scheduler] Receive failed: " << e.what() << std::endl;
+    }
+
+    PooledBuffer receiveOne(bool block) {
+        while (true) {
+            PooledBuffer buffer = pool.acquire();
+            std::vector<uint8_t>& bytes = buffer.fill();
+            DatagramPacket clientPacket(bytes, bytes.size());
+            try {
+                if (!(block ? ClientSocket.receive(clientPacket) : ClientSocket.tryReceive(clientPacket))) {
+                    return PooledBuffer();
+                }
+            } catch (const std::runtime_error& e) {
+                receiveFailed(e);
+                return PooledBuffer();
+            }
+            if (complete(clientPacket)) {
+                buffer.setLength(clientPacket.getLength());
+                return buffer;
+            }
+        }
+    }
+
+    std::vector<PooledBuffer>& takeBatch(BufferBatch& into, int received) {
+        long cut = 0;
+        std::vector<PooledBuffer>& packets = into.take(received, cut);
+        if (cut > 0) {
+            truncated += cut;
+            std::cout << "[Scheduler] Dropped " << cut << " datagrams longer than " << pool.bufferSize() << " bytes" << std::endl;
+        }
+        return packets;
+    }
+
+    // Answers a floor's MSG_READY_QUERY with MSG_READY if enough cars are in service, and says
+    // nothing otherwise, so the floor asks again. Returns false for any other packet.
+    bool answerReadyQuery(const std::vector<uint8_t>& packet) {
+        if (packet.size() < 4 || packet[0] != 0 || packet[1] != MSG_READY_QUERY) {
+            return false;
+        }
+        size_t cars = 0;
+        for (const Dispatcher* dispatcher : fleet) {
+            cars += dispatcher->size();
+        }
+        if (cars >= readyCars) {
+            std::vector<uint8_t> ready = { 0, MSG_READY, static_cast<uint8_t>(cars >> 8 & 0xFF), static_cast<uint8_t>(cars & 0xFF) };
+            sendPacket(ready, ready.size(), InetAddress::getLocalHost(), packet[2] << 8 | packet[3]);
+        }
+        return true;
+    }
+
+    void sendGrants(const std::vector<CreditGrant>& grants) {
+        for (const CreditGrant& grant : grants) {
+            std::vector<uint8_t> packet = creditPacket(MSG_CREDIT, grant.total);
+            sendPacket(packet, packet.size(), InetAddress::getLocalHost(), grant.port);
+        }
+    }
+
+    // A request has left the queue; its credit goes back to the floors.
+    void taken(bool empty) {
+        if (credits) {
+            std::vector<CreditGrant> grants;
+            credits->consumed(1, empty, grants);
+            sendGrants(grants);
+        }
+    }
+
+    void noteDepth(size_t depth) {
+        size_t deepest = highWater.load(std::memory_order_relaxed);
+        while (depth > deepest && !highWater.compare_exchange_weak(deepest, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    // Binds `port`, with SO_REUSEPORT if `shared` so ingress workers can bind it too. SO_REUSEPORT
+    // would just as well let a second scheduler's workers join and take a share of the requests,
+    // so the port is first bound once without it: one already taken fails as it would unshared.
+    static Transport bindClient(int port, bool shared) {
+        if constexpr (SharesPorts<Transport>::value) {
+            if (shared) {
+                Transport claim(port);
+            }
+            return Transport(port, shared);
+        } else {
+            if (shared) {
+                throw std::runtime_error("port " + std::to_string(port) + " cannot be shared by this transport");
+            }
+            return Transport(port);
+        }
+    }
 
     void printStateChange(SchedulerState newState) {
-        if (state != newState) {
-            std::cout << "[Scheduler] State changed: " << stateToString(state) 
+        SchedulerState oldState = state.exchange(newState);
+        if (oldState != newState) {
+            std::cout << "[Scheduler] State changed: " << stateToString(oldState) 
                       << " -> " << stateToString(newState) << std::endl;
-            state = newState;
         }
     }
 
@@ -51,72 +210,313 @@ private:
         }
     }
 public:
-    Scheduler(int PORT) : ClientSocket(PORT), ServerSocket(), state(SchedulerState::IDLE)  {}
+    // With `sharedPort`, PORT is bound so that ingress workers can add sockets of their own on it
+    // (shareClientPort). Only for transports where canSharePort<Transport>(PORT).
+    Scheduler(int PORT, Clock& clock = Clock::realTime(), bool sharedPort = false)
+        : 
+#ifdef SCHEDULER_LOCKFREE_QUEUE
+        queue(SCHEDULER_QUEUE_CAPACITY), waiting(0),
+#endif
+        ServerSocket(), ClientSocket(bindClient(PORT, sharedPort)), clientPort(PORT), state(SchedulerState::IDLE), overflows(0), highWater(0), clock(clock), batch(pool),
+        truncated(0), receiveErrors(0), malformed(0) {}
 
-    void put(Type item) {
-        std::unique_lock<std::mutex> lock(mtx);
-        bool wasEmpty = queue.empty(); // Check if queue was empty before adding
+    // Returns false if the request was dropped because the queue is full.
+    bool put(Type item) {
+        std::string description = item.display();
+#ifdef SCHEDULER_LOCKFREE_QUEUE
+        if (!queue.tryPush(std::move(item))) {
+            overflows++;
+            std::cerr << "[Scheduler] Queue full (" << queue.capacity() << " requests), dropped " << description << std::endl;
+            return false;
+        }
+        noteDepth(queue.size());
+        // Pairs with the increment of `waiting` in get() so a parked consumer is never missed.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load() > 0) {
+            std::lock_guard<std::mutex> lock(mtx);
+            cv.notify_one();
+        }
+        printStateChange(SchedulerState::BUSY);
+#else
+        bool wasEmpty;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            wasEmpty = queue.empty(); // Check if queue was empty before adding
+            queue.push(std::move(item));
+            noteDepth(queue.size());
+        }
+        cv.notify_one();
         if (wasEmpty) {
             printStateChange(SchedulerState::BUSY); // Change state only if it was previously idle
         }
-        std::cout << "[Scheduler] Assign " << item.display() << " to Elevator" << std::endl;
-        queue.push(item);
-        cv.notify_all();
+#endif
+        std::cout << "[Scheduler] Assign " << description << " to Elevator" << std::endl;
+        return true;
     }
 
     Type get() {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, [&] { return !queue.empty(); });
-        Type item = queue.front();
-        queue.pop();
-        printStateChange(queue.empty() ? SchedulerState::IDLE : SchedulerState::BUSY);
+#ifdef SCHEDULER_LOCKFREE_QUEUE
+        std::optional<Type> item = queue.tryPop();
+        for (int spin = 0; !item && spin < 64; spin++) {
+            std::this_thread::yield();
+            item = queue.tryPop();
+        }
+        if (!item) {
+            // Blocking fallback once spinning has not found work.
+            std::unique_lock<std::mutex> lock(mtx);
+            waiting++;
+            cv.wait(lock, [&] { item = queue.tryPop(); return item.has_value(); });
+            waiting--;
+        }
+        bool empty = queue.empty();
+#else
+        std::optional<Type> item;
+        bool empty;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&] { return !queue.empty(); });
+            item.emplace(std::move(queue.front()));
+            queue.pop();
+            empty = queue.empty();
+        }
+#endif
+        printStateChange(empty ? SchedulerState::IDLE : SchedulerState::BUSY);
+        taken(empty);
+        return std::move(*item);
+    }
+
+    // Returns the next request if one is waiting, without blocking.
+    std::optional<Type> tryGet() {
+        std::optional<Type> item;
+        bool empty;
+#ifdef SCHEDULER_LOCKFREE_QUEUE
+        item = queue.tryPop();
+        empty = queue.empty();
+#else
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!queue.empty()) {
+                item.emplace(std::move(queue.front()));
+                queue.pop();
+            }
+            empty = queue.empty();
+        }
+#endif
+        if (item) {
+            printStateChange(empty ? SchedulerState::IDLE : SchedulerState::BUSY);
+            taken(empty);
+        }
         return item;
     }
 
+    // Blocks for the next request, then collects everything else that arrives within `window`,
+    // which lasts at least as long in real time under a virtual clock.
+    std::vector<Type> drain(Clock::duration window) {
+        std::vector<Type> items;
+        items.push_back(get());
+        clock.waitFor(window);
+        while (std::optional<Type> item = tryGet()) {
+            items.push_back(std::move(*item));
+        }
+        return items;
+    }
+
+    // Grants credits out of a window of `window` requests to floors that ask for them, and takes
+    // them back as requests leave the queue. Call before any thread uses the scheduler.
+    void enableFloorCredits(int window = FLOOR_CREDIT_WINDOW) {
+        credits.emplace(window);
+    }
+
+    // For a scheduler whose requests are dispatched straight from processBatch() rather than
+    // queued: `count` requests have been dealt with and their credits go back to the floors.
+    void requestsTaken(int count) {
+        if (credits && count > 0) {
+            std::vector<CreditGrant> grants;
+            credits->consumed(count, true, grants);
+            sendGrants(grants);
+        }
+    }
+
+    // Reports ready to floors that ask only once `dispatchers` have `cars` cars registered between
+    // them. Without this the scheduler is ready as soon as it is bound. Call before any thread
+    // uses the scheduler.
+    void expectCars(std::vector<const Dispatcher*> dispatchers, size_t cars) {
+        fleet = std::move(dispatchers);
+        readyCars = cars;
+    }
+
+    // Credits not granted to any floor; the window if flow control is off.
+    int getAvailableCredits() {
+        return credits ? credits->getAvailable() : FLOOR_CREDIT_WINDOW;
+    }
+
+    // Requests waiting in the queue now.
+    size_t getQueueDepth() {
+#ifdef SCHEDULER_LOCKFREE_QUEUE
+        return queue.size();
+#else
+        std::lock_guard<std::mutex> lock(mtx);
+        return queue.size();
+#endif
+    }
+
+    // The most requests that have waited in the queue at once.
+    size_t getQueueHighWater() const {
+        return highWater.load();
+    }
+
+    // The queue and loss counters on one line, for SocketStats.
+    std::string describeQueue() {
+        std::ostringstream out;
+        out << "depth " << getQueueDepth() << ", high water " << getQueueHighWater() << ", "
+            << getOverflowCount() << " overflowed, " << getTruncatedCount() << " truncated, "
+            << getMalformedCount() << " malformed, " << getReceiveErrorCount() << " receive errors";
+        if (credits) {
+            out << ", " << credits->getAvailable() << "/" << credits->getWindow() << " floor credits free";
+        }
+        return out.str();
+    }
+
+    // Requests dropped by put() because the queue was full.
+    long getOverflowCount() const {
+        return overflows.load();
+    }
+
+    // Datagrams dropped because they did not fit a receive buffer.
+    long getTruncatedCount() const {
+        return truncated.load();
+    }
+
+    // Packets processBatch() dropped because they were not well-formed requests.
+    long getMalformedCount() const {
+        return malformed.load();
+    }
+
+    // Failed receives, each reported and answered with nothing received.
+    long getReceiveErrorCount() const {
+        return receiveErrors.load();
+    }
+
+    // How long the receive calls below wait for a datagram, 0 for ever (the default). Control
+    // loops set this to get control back for periodic work when nothing arrives.
+    void setReceiveTimeout(int ms) {
+        ClientSocket.setSoTimeout(ms);
+    }
+
+    // Waits for the next datagram, received into a pooled buffer. The buffer is empty if the
+    // receive timeout expired or the socket failed.
+    PooledBuffer receiveClientBuffer() {
+        return receiveOne(true);
+    }
+
+    // Empty if nothing arrived.
     std::vector<uint8_t> receiveClient() {
-        std::vector<uint8_t> clientData(17);
-        DatagramPacket clientPacket(clientData, clientData.size());
-        /* std::cout << "Server: Waiting for Packet." << std::endl; */
+        PooledBuffer buffer = receiveClientBuffer();
+        return buffer ? *buffer : std::vector<uint8_t>();
+    }
 
+    // Waits for the next datagram and returns it with any others already waiting, up to
+    // DATAGRAM_BATCH_MAX, read with one system call; empty if nothing arrived. The buffers go
+    // back to the pool on the next call unless moved out.
+    std::vector<PooledBuffer>& receiveClients() {
+        return receiveClients(ClientSocket, batch);
+    }
+
+    // The same from another socket on this scheduler's port (shareClientPort), into the calling
+    // thread's own batch.
+    std::vector<PooledBuffer>& receiveClients(Transport& socket, BufferBatch& into) {
+        std::vector<DatagramPacket>& packets = into.prepare();
         try {
-            /* std::cout << "Waiting..." << std::endl; // so we know we're waiting */
-            ClientSocket.receive(clientPacket);
-        } catch (const std::runtime_error& e ) {
-            std::cout << "IO Exception: likely:"
-                  << "Receive Socket Timed Out." << std::endl << e.what() << std::endl;
-            exit(1);
+            return takeBatch(into, socket.receiveBatch(packets));
+        } catch (const std::runtime_error& e) {
+            receiveFailed(e);
+            return takeBatch(into, 0);
         }
-
-        /* printPacket(clientData); */
-        return clientData;
     }
 
-    DatagramPacket receiveAndStore() {
-        std::vector<uint8_t> clientData(17);
-        DatagramPacket clientPacket(clientData, clientData.size());
-        /* std::cout << "Server: Waiting for Packet." << std::endl; */
+    // Another socket bound to this scheduler's port, for an ingress worker. The kernel spreads
+    // arriving datagrams across all of them but keeps each sender's on one socket, so one floor's
+    // requests stay in order. The scheduler must have been made with `sharedPort`.
+    std::unique_ptr<Transport> shareClientPort() {
+        if constexpr (SharesPorts<Transport>::value) {
+            return std::unique_ptr<Transport>(new Transport(clientPort, true));
+        } else {
+            throw std::runtime_error("port " + std::to_string(clientPort) + " cannot be shared by this transport");
+        }
+    }
 
+    // The datagrams waiting now, up to DATAGRAM_BATCH_MAX, without blocking. A thread other than
+    // the one calling receiveClients() must pass its own batch.
+    std::vector<PooledBuffer>& tryReceiveClients(BufferBatch& into) {
+        std::vector<DatagramPacket>& packets = into.prepare();
         try {
-            /* std::cout << "Waiting..." << std::endl; // so we know we're waiting */
-            ClientSocket.receive(clientPacket);
-        } catch (const std::runtime_error& e ) {
-            std::cout << "IO Exception: likely:"
-                  << "Receive Socket Timed Out." << std::endl << e.what() << std::endl;
-            exit(1);
+            return takeBatch(into, ClientSocket.tryReceiveBatch(packets));
+        } catch (const std::runtime_error& e) {
+            receiveFailed(e);
+            return takeBatch(into, 0);
         }
+    }
+
+    std::vector<PooledBuffer>& tryReceiveClients() {
+        return tryReceiveClients(batch);
+    }
+
+    // The next datagram if one is waiting, or an empty buffer, without blocking.
+    PooledBuffer tryReceiveClient() {
+        return receiveOne(false);
+    }
+
+    // Descriptor of the receiving socket, for an event loop to wait on. Throws if the port has
+    // none (canPoll).
+    int receiveFd() const {
+        if constexpr (PollsPorts<Transport>::value) {
+            return ClientSocket.fd();
+        } else {
+            throw std::runtime_error("port " + std::to_string(clientPort) + " has no descriptor to poll");
+        }
+    }
 
-        return clientPacket;
+    // Until flushPackets(), sendPacket() queues packets instead of sending them. Only for a
+    // scheduler that a single thread sends on, such as an event loop's.
+    void holdPackets() {
+        holding = true;
     }
 
-    // Sends Packet
+    // Sends everything queued since holdPackets() with as few system calls as the transport allows.
+    int flushPackets() {
+        holding = false;
+        if (outbox.empty()) {
+            return 0;
+        }
+        std::vector<DatagramPacket> packets;
+        packets.reserve(outbox.size());
+        for (auto& [data, port] : outbox) {
+            packets.emplace_back(data, data.size(), InetAddress::getLocalHost(), port);
+        }
+        int sent = 0;
+        try {
+            sent = ServerSocket.sendBatch(packets);
+        } catch ( const std::runtime_error& e ) {
+            std::cerr << "[Scheduler] Send failed: " << e.what() << std::endl;
+        }
+        outbox.clear();
+        return sent;
+    }
+
+    // Sends Packet. Returns -1 if the socket failed; like a lost datagram, the caller's
+    // retransmission covers it.
     int sendPacket(std::vector<uint8_t> data, int size, in_addr_t address, int port) {
+        if (holding) {
+            data.resize(size);
+            outbox.emplace_back(std::move(data), port);
+            return size;
+        }
         DatagramPacket sendPacket(data, size, address, port);
         int result = -1;
         try {
                 result = ServerSocket.send(sendPacket);
         } catch ( const std::runtime_error& e ) {
-            std::cerr << e.what() << std::endl;
-            exit(1);
+            std::cerr << "[Scheduler] Send failed: " << e.what() << std::endl;
         }
 
         return result;
@@ -139,78 +539,467 @@ public:
         return ElevatorEvent::parseFromPacket(data);
     }
 
-    std::vector<uint8_t> createData (Type item) {
-
-        int hour = item.timestamp.tm_hour;
-        int min = item.timestamp.tm_min;
-        int sec = item.timestamp.tm_sec;
-        int msec = 0;
-
-        std::vector<uint8_t> packet_data;
-        packet_data.push_back(0x0);
-        packet_data.push_back(0x1);
-
-        packet_data.push_back(hour / 10 % 10);
-        packet_data.push_back(hour % 10);
-        packet_data.push_back(min / 10 % 10);
-        packet_data.push_back(min % 10);
-        packet_data.push_back(sec / 10 % 10);
-        packet_data.push_back(sec % 10);
-        packet_data.push_back(msec % 10);
-        packet_data.push_back(item.floor / 10 % 10);
-        packet_data.push_back(item.floor % 10);
-        packet_data.push_back(item.floorButton.compare("Down") ? 1 : 0);
-        packet_data.push_back(item.floorsToMove / 10 % 10);
-        packet_data.push_back(item.floorsToMove % 10);
-        packet_data.push_back(item.passengers / 10 % 10);
-        packet_data.push_back(item.passengers % 10);
-        if (item.fault.compare("Minor") == 0) {
-            packet_data.push_back(1);  // Minor fault
-        } else if (item.fault.compare("Major") == 0) {
-            packet_data.push_back(2);  // Major fault
-        } else {
-            packet_data.push_back(0);  // No fault
+    // Decodes a batch of request packets into `events`, in order, with decodeRequestBatch. Packets
+    // that are not well-formed requests are dropped and counted instead of thrown on; credit
+    // requests and readiness queries from floors are answered. Safe to call from several threads as long as each passes
+    // its own `events`.
+    void processBatch(const std::vector<PooledBuffer>& packets, std::vector<Type>& events) {
+        events.clear();
+        std::array<const std::vector<uint8_t>*, REQUEST_BATCH_MAX> bytes;
+        std::array<DecodedRequest, REQUEST_BATCH_MAX> decoded;
+        std::vector<CreditGrant> grants;
+        for (size_t next = 0; next < packets.size();) {
+            int count = 0;
+            for (; next < packets.size() && count < REQUEST_BATCH_MAX; next++) {
+                if (!(credits && credits->handle(*packets[next], grants)) && !answerReadyQuery(*packets[next])) {
+                    bytes[count++] = &*packets[next];
+                }
+            }
+            uint64_t invalid = decodeRequestBatch(bytes.data(), count, decoded.data());
+            for (int i = 0; i < count; i++) {
+                if (!(invalid >> i & 1)) {
+                    events.push_back(Type::fromWire(decoded[i].request, decoded[i].version));
+                }
+            }
+            if (invalid != 0) {
+                int dropped = __builtin_popcountll(invalid);
+                malformed += dropped;
+                std::cout << "[Scheduler] Dropped " << dropped << " malformed request packets" << std::endl;
+            }
         }
+        sendGrants(grants);
+    }
 
+    // Decodes one request packet the way processBatch does. A packet that is not a well-formed
+    // request is counted as malformed and false returned, instead of throwing.
+    bool tryDecodeRequest(const std::vector<uint8_t>& packet, Type& event) {
+        const std::vector<uint8_t>* bytes[] = { &packet };
+        DecodedRequest decoded;
+        if (decodeRequestBatch(bytes, 1, &decoded) != 0) {
+            malformed++;
+            std::cout << "[Scheduler] Dropped a malformed request packet" << std::endl;
+            return false;
+        }
+        event = Type::fromWire(decoded.request, decoded.version);
+        return true;
+    }
 
-        /* std::cout << "Printing Packet: "; */
-        /* printPacket(packet_data); */
-        return packet_data;
+    std::vector<uint8_t> createData (const Type& item) {
+        return item.toPacket();
     }
 
     // Returns the current state of the scheduler.
     SchedulerState getState() const {
         return state;
     }
+
+    // Milliseconds on the wall clock, the one time base for dispatch ETAs and retransmit
+    // deadlines. The scheduler's own clock may be a VirtualClock, whose time is kept per thread
+    // and stands still on the dispatch thread, which never sleeps on it.
+    long long dispatchTime() const {
+        return Clock::realTime().now().count();
+    }
  
 };
 
-void floorReader(Scheduler<ElevatorEvent>* scheduler) {
+// Decodes floor requests and queues them, from `socket` (one from shareClientPort, for an ingress
+// worker) or the scheduler's own socket if it is null.
+template <typename Transport>
+void floorReader(Scheduler<ElevatorEvent, Transport>* scheduler, Transport* socket = nullptr) {
+    BufferPool buffers(socket ? POOL_BUFFER_COUNT : 0);
+    BufferBatch batch(buffers);
+    std::vector<ElevatorEvent> events;
+    while (true) {
+        scheduler->processBatch(socket ? scheduler->receiveClients(*socket, batch) : scheduler->receiveClients(), events);
+        for (ElevatorEvent& event : events) {
+            scheduler->put(event);
+        }
+    }
+}
+
+// Adds the car in a MSG_REGISTER packet to the dispatcher, or updates it if the car restarted,
+// and confirms with MSG_REGISTERED. Returns false for any other packet.
+template <typename Transport>
+bool handleRegistration(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher,
+                        const std::vector<uint8_t>& packet) {
+    if (packet.size() < 10 || packet[0] != 0 || packet[1] != MSG_REGISTER) {
+        return false;
+    }
+    int id = packet[2];
+    int port = packet[3] << 8 | packet[4];
+    int lowest = packet[6] << 8 | packet[7];
+    int highest = packet[8] << 8 | packet[9];
+    bool known = dispatcher->indexOf(id) >= 0 && dispatcher->getCar(dispatcher->indexOf(id)).port == port;
+    dispatcher->registerCar(id, port, packet[5], lowest, highest);
+    if (!known) {
+        std::cout << "[Scheduler] Elevator" << id << " registered on port " << port << ", capacity "
+                  << static_cast<int>(packet[5]) << ", floors " << lowest << "-" << highest << std::endl;
+    }
+    std::vector<uint8_t> ack = { 0, MSG_REGISTERED, static_cast<uint8_t>(id) };
+    scheduler->sendPacket(ack, ack.size(), InetAddress::getLocalHost(), port);
+    return true;
+}
+
+// Keeps the dispatch table current from the elevators' status packets and registrations.
+template <typename Transport>
+void elevatorStatusReader(Scheduler<ElevatorEvent, Transport>* statusReceiver, Dispatcher* dispatcher) {
     while (true) {
-        std::vector<uint8_t> packet = scheduler->receiveClient();
-        ElevatorEvent event = scheduler->processData(packet);
-        scheduler->put(event);
+        for (const PooledBuffer& packet : statusReceiver->receiveClients()) {
+            if (!handleRegistration(statusReceiver, dispatcher, *packet)) {
+                dispatcher->updateStatus(*packet);
+            }
+        }
+    }
+}
+
+// Numbers the request, starts its retransmit timer and sends it to the car at `car`.
+template <typename Transport>
+void sendToCar(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher, PendingRequests* pending,
+               ElevatorEvent& event, int car, const std::vector<int>& refused = {}, int group = 0) {
+    pending->track(event, car, scheduler->dispatchTime(), refused, group);
+    std::vector<uint8_t> data = scheduler->createData(event);
+    scheduler->sendPacket(data, data.size(), InetAddress::getLocalHost(), dispatcher->getCar(car).port);
+}
+
+// Splits a group larger than `capacity` into trips of at most `capacity` passengers.
+inline std::vector<ElevatorEvent> splitGroup(const ElevatorEvent& event, int capacity) {
+    if (capacity <= 0 || event.passengers <= capacity) {
+        return { event };
+    }
+    std::vector<ElevatorEvent> trips;
+    for (int left = event.passengers; left > 0; left -= capacity) {
+        ElevatorEvent trip = event;
+        trip.passengers = std::min(left, capacity);
+        trips.push_back(trip);
+    }
+    return trips;
+}
+
+// Starts tracking a request that was split into several trips. Returns 0 if it was not split.
+inline int openGroup(PendingRequests* pending, const ElevatorEvent& event, size_t trips) {
+    if (trips < 2) {
+        return 0;
+    }
+    int group = pending->openGroup(event.passengers);
+    std::cout << "[Scheduler] Group " << group << ": " << event.passengers << " passengers at floor "
+              << event.floor << " split into " << trips << " trips" << std::endl;
+    return group;
+}
+
+inline void reportGroup(const std::optional<GroupProgress>& progress) {
+    if (!progress) {
+        return;
+    }
+    std::cout << "[Scheduler] Group " << progress->group << ": " << progress->delivered << "/"
+              << progress->passengers << " delivered";
+    if (progress->lost > 0) {
+        std::cout << ", " << progress->lost << " dropped";
+    }
+    std::cout << (progress->finished() ? ", done" : "") << std::endl;
+}
+
+// Books the request on a car that has not refused it, numbers it and sends it. A new group
+// too big for every car goes out as several trips, to different cars or one after another.
+template <typename Transport>
+bool dispatchRequest(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher, PendingRequests* pending,
+                     ElevatorEvent event, const std::vector<int>& refused = {}) {
+    std::vector<ElevatorEvent> trips = { event };
+    if (event.requestId == 0) {
+        trips = splitGroup(event, dispatcher->largestCapacity());
+    }
+    int group = openGroup(pending, event, trips.size());
+    bool sent = false;
+    for (ElevatorEvent& trip : trips) {
+        int car = dispatcher->assign(trip, scheduler->dispatchTime(), refused);
+        if (car < 0) {
+            std::cout << "[Scheduler] No elevator can take request " << trip.requestId
+                      << " at floor " << trip.floor << ", dropping it" << std::endl;
+            reportGroup(trip.requestId != 0 ? pending->abandon(trip.requestId) : pending->abandonTrip(group, trip.passengers));
+            continue;
+        }
+        sendToCar(scheduler, dispatcher, pending, trip, car, refused, group);
+        sent = true;
+    }
+    return sent;
+}
+
+// Answers an idle car asking for work: revokes the newest unstarted call of the busiest car
+// that the idle car serves and would reach sooner than the busy car could from where it is.
+// The call moves once the busy car confirms.
+template <typename Transport>
+void handleStealRequest(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher, PendingRequests* pending,
+                        int elevatorId, int floor) {
+    int thief = dispatcher->indexOf(elevatorId);
+    if (thief < 0) {
+        return;
+    }
+    dispatcher->updateStatus(elevatorId, floor, Direction::Idle, ElevatorState::Idle);
+    auto steal = pending->chooseSteal(thief, [&](int victim, const ElevatorEvent& call) {
+        return dispatcher->serves(thief, call)
+            && Dispatcher::travelTime(floor, call.floor) < dispatcher->arrivalFromPosition(victim, call);
+    });
+    if (!steal) {
+        return;
+    }
+    CarStatus victim = dispatcher->getCar(steal->first);
+    std::cout << "[Scheduler] Elevator" << elevatorId << " is idle at floor " << floor << ", revoking request "
+              << steal->second.requestId << " from Elevator" << victim.id << std::endl;
+    int id = steal->second.requestId;
+    std::vector<uint8_t> data = { 0x0, MSG_REVOKE, static_cast<uint8_t>(id >> 8 & 0xFF), static_cast<uint8_t>(id & 0xFF) };
+    scheduler->sendPacket(data, data.size(), InetAddress::getLocalHost(), victim.port);
+}
+
+// Handles an ACK, NACK, completion or work-stealing message from an elevator. Returns false
+// for any other packet.
+template <typename Transport>
+bool handleElevatorReply(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher, PendingRequests* pending,
+                         const std::vector<uint8_t>& packet) {
+    if (packet.size() < 5 || packet[0] != 0) {
+        return false;
+    }
+    int id = packet[2] << 8 | packet[3];
+    int elevatorId = packet[4];
+    switch (packet[1]) {
+        case MSG_ACK:
+            pending->acknowledge(id);
+            return true;
+        case MSG_NACK: {
+            int reason = packet.size() > 5 ? packet[5] : 0;
+            if (reason == NACK_STRANDED) {
+                std::cout << "[Scheduler] Elevator" << elevatorId << " went out of service with request " << id
+                          << " unfinished" << std::endl;
+                pending->started(id);
+                reportGroup(pending->abandon(id));
+                return true;
+            }
+            std::optional<PendingRequest> request = pending->refuse(id, dispatcher->indexOf(elevatorId));
+            if (request) {
+                std::cout << "[Scheduler] Elevator" << elevatorId << " refused request " << id
+                          << (reason == NACK_OVER_CAPACITY ? " (over capacity)" : " (out of service)")
+                          << ", dispatching to another car" << std::endl;
+                dispatchRequest(scheduler, dispatcher, pending, request->event, request->refused);
+            }
+            return true;
+        }
+        case MSG_COMPLETE: {
+            reportGroup(pending->complete(id));
+            RequestCounters counters = pending->getCounters();
+            std::cout << "[Scheduler] Request " << id << " completed by Elevator" << elevatorId
+                      << " (" << counters.completed << " completed, " << counters.retransmitted << " retransmits, "
+                      << counters.nacked << " refusals, " << counters.abandoned << " dropped)" << std::endl;
+            return true;
+        }
+        case MSG_PICKUP:
+            pending->started(id);
+            return true;
+        case MSG_STEAL:
+            if (packet.size() > 6) {
+                handleStealRequest(scheduler, dispatcher, pending, elevatorId, packet[5] << 8 | packet[6]);
+            }
+            return true;
+        case MSG_RELEASED: {
+            bool released = packet.size() > 5 && packet[5] == 1;
+            auto steal = pending->finishSteal(id, released);
+            if (steal) {
+                std::cout << "[Scheduler] Elevator" << dispatcher->getCar(steal->first).id << " took over request " << id
+                          << " from Elevator" << elevatorId << std::endl;
+                dispatcher->assignTo(steal->first, steal->second, scheduler->dispatchTime());
+                sendToCar(scheduler, dispatcher, pending, steal->second, steal->first);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// Resends requests whose ACK is overdue, backing off after each attempt. A car that never
+// answers is treated as refusing and the request goes to another car.
+template <typename Transport>
+void retransmitDue(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher, PendingRequests* pending) {
+    std::vector<PendingRequest> expired;
+    for (const PendingRequest& request : pending->due(scheduler->dispatchTime(), expired)) {
+        std::cout << "[Scheduler] Retransmitting request " << request.event.requestId
+                  << " (attempt " << request.attempts << ")" << std::endl;
+        std::vector<uint8_t> data = scheduler->createData(request.event);
+        scheduler->sendPacket(data, data.size(), InetAddress::getLocalHost(), dispatcher->getCar(request.car).port);
+    }
+    for (const PendingRequest& request : expired) {
+        std::cout << "[Scheduler] No answer for request " << request.event.requestId
+                  << ", dispatching to another car" << std::endl;
+        dispatchRequest(scheduler, dispatcher, pending, request.event, request.refused);
     }
 }
 
-void alertElevator(Scheduler<ElevatorEvent>* scheduler) {
+// Sends each request to the car the dispatcher picks, or round-robin without a dispatcher.
+// With a PendingRequests table every send is numbered and retransmitted until acknowledged.
+template <typename Transport>
+void alertElevator(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher = nullptr, PendingRequests* pending = nullptr) {
+    const int ports[] = { ELEVATOR_1, ELEVATOR_2, ELEVATOR_3, ELEVATOR_4 };
     int i = 0;
     while(true){
         ElevatorEvent event = scheduler->get();
+        if (dispatcher != nullptr && pending != nullptr) {
+            dispatchRequest(scheduler, dispatcher, pending, event);
+            continue;
+        }
         std::vector<uint8_t> data = scheduler->createData(event);
-        int targetPort= 0;
+        int targetPort = ports[i % 4];
 
-        switch (i % 4) {
-            case 0: targetPort = ELEVATOR_1; break;
-            case 1: targetPort = ELEVATOR_2; break;
-            case 2: targetPort = ELEVATOR_3; break;
-            case 3: targetPort = ELEVATOR_4; break;
+        if (dispatcher != nullptr) {
+            int car = dispatcher->assign(event, scheduler->dispatchTime());
+            if (car < 0) {
+                std::cout << "[Scheduler] No elevator in service for request at floor " << event.floor << std::endl;
+                continue;
+            }
+            targetPort = dispatcher->getCar(car).port;
         }
         scheduler->sendPacket(data, data.size(), InetAddress::getLocalHost(), targetPort);        
         i++;
     }
 }
 
+// Assigns a batch of calls at minimum total estimated wait and sends each to its car.
+template <typename Transport>
+void dispatchBatch(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher,
+                   const std::vector<ElevatorEvent>& batch, PendingRequests* pending = nullptr) {
+    std::vector<ElevatorEvent> calls;
+    std::vector<int> groups;
+    for (const ElevatorEvent& call : batch) {
+        std::vector<ElevatorEvent> trips = splitGroup(call, dispatcher->largestCapacity());
+        int group = pending != nullptr ? openGroup(pending, call, trips.size()) : 0;
+        calls.insert(calls.end(), trips.begin(), trips.end());
+        groups.insert(groups.end(), trips.size(), group);
+    }
+    BatchPlan plan = dispatcher->assignBatch(calls, scheduler->dispatchTime());
+    std::cout << "[Scheduler] Batch of " << calls.size() << " calls solved in " << plan.solveMicros
+              << " us, estimated wait " << plan.totalCost / 1000.0 << " s (greedy "
+              << plan.greedyCost / 1000.0 << " s)" << std::endl;
+
+    for (size_t i = 0; i < calls.size(); i++) {
+        if (plan.cars[i] < 0) {
+            std::cout << "[Scheduler] No elevator in service can take the request at floor " << calls[i].floor << std::endl;
+            if (pending != nullptr) {
+                reportGroup(pending->abandonTrip(groups[i], calls[i].passengers));
+            }
+            continue;
+        }
+        if (pending != nullptr) {
+            pending->track(calls[i], plan.cars[i], scheduler->dispatchTime(), {}, groups[i]);
+        }
+        std::vector<uint8_t> data = scheduler->createData(calls[i]);
+        scheduler->sendPacket(data, data.size(), InetAddress::getLocalHost(), dispatcher->getCar(plan.cars[i]).port);
+    }
+}
+
+// Collects calls for `window`, then assigns the whole batch at minimum total estimated wait.
+template <typename Transport>
+void batchAlertElevator(Scheduler<ElevatorEvent, Transport>* scheduler, Dispatcher* dispatcher, Clock::duration window,
+                        PendingRequests* pending = nullptr) {
+    while (true) {
+        dispatchBatch(scheduler, dispatcher, scheduler->drain(window), pending);
+    }
+}
+
+// Every port of the system, for --stats: the scheduler's (for each of `banks`), the cars', the
+// floor's credit port and the display's.
+inline std::vector<int> monitoredPorts(int banks = 1) {
+    std::vector<int> ports = { FLOORREADER };
+    for (int bank = 0; bank < banks; bank++) {
+        ports.push_back(FLOORNOTIFIER + bank * BANK_PORT_STRIDE);
+        ports.push_back(ELEVATOR_STATUS + bank * BANK_PORT_STRIDE);
+    }
+    ports.insert(ports.end(), { FLOOR_CREDITS, ELEVATOR_1, ELEVATOR_2, ELEVATOR_3, ELEVATOR_4, DISPLAY_PORT });
+    return ports;
+}
+
+// The scheduler process: reads requests on FLOORREADER, elevator replies on FLOORNOTIFIER and
+// status packets on ELEVATOR_STATUS, and dispatches requests to the four cars. Every
+// `statsInterval` ms, if not 0, it prints drops on every port and the request queue's depth.
+// `ingress` threads read requests, each from its own socket on FLOORREADER, into one queue.
+// With `fleet` 0 the cars are the four on ELEVATOR_1..4; otherwise the scheduler starts with none
+// and tells floors it is ready once `fleet` cars have registered. Never returns.
+template <typename Transport = ELEVATOR_TRANSPORT>
+void runScheduler(Clock& clock, int batchWindow = 0, int statsInterval = 0, int ingress = 1, int fleet = 0) {
+    if (ingress > 1 && !canSharePort<Transport>(FLOORREADER)) {
+        std::cout << "[Scheduler] Port " << FLOORREADER << " cannot be shared, reading requests on one thread" << std::endl;
+        ingress = 1;
+    }
+    Scheduler<ElevatorEvent, Transport> scheduler(FLOORREADER, clock, ingress > 1);
+    scheduler.enableFloorCredits();
+    SocketStats stats(monitoredPorts());
+    stats.addGauge("request queue", [&] { return scheduler.describeQueue(); });
+    Scheduler<ElevatorEvent, Transport> floorNotifier(FLOORNOTIFIER, clock);
+    Scheduler<ElevatorEvent, Transport> statusReceiver(ELEVATOR_STATUS, clock);
+
+    Dispatcher dispatcher;
+    if (fleet == 0) {
+        dispatcher.addCar(1, ELEVATOR_1);
+        dispatcher.addCar(2, ELEVATOR_2);
+        dispatcher.addCar(3, ELEVATOR_3);
+        dispatcher.addCar(4, ELEVATOR_4);
+    } else {
+        std::cout << "[Scheduler] Waiting for " << fleet << " elevators to register" << std::endl;
+    }
+    scheduler.expectCars({ &dispatcher }, fleet);
+
+    PendingRequests pending;
+
+    // Every worker's socket is bound before any is read: the kernel picks a sender's socket by
+    // hashing over the sockets bound so far, so a floor could otherwise switch sockets mid-stream.
+    std::vector<std::unique_ptr<Transport>> ingressSockets;
+    for (int worker = 1; worker < ingress; worker++) {
+        ingressSockets.push_back(scheduler.shareClientPort());
+    }
+    std::vector<std::thread> floorThreads;
+    floorThreads.emplace_back(floorReader<Transport>, &scheduler, nullptr);
+    for (std::unique_ptr<Transport>& socket : ingressSockets) {
+        floorThreads.emplace_back(floorReader<Transport>, &scheduler, socket.get());
+    }
+    std::thread statusThread(elevatorStatusReader<Transport>, &statusReceiver, &dispatcher);
+    std::thread elevatorThread;
+    if (batchWindow > 0) {
+        elevatorThread = std::thread(batchAlertElevator<Transport>, &scheduler, &dispatcher, std::chrono::milliseconds(batchWindow), &pending);
+    } else {
+        elevatorThread = std::thread(alertElevator<Transport>, &scheduler, &dispatcher, &pending);
+    }
+
+    // Replies are read with a timeout so the retransmit pass runs on this thread between them.
+    const auto retransmitInterval = std::chrono::milliseconds(RETRANSMIT_TIMEOUT_MS / 4);
+    auto nextRetransmit = std::chrono::steady_clock::now() + retransmitInterval;
+    auto nextStats = std::chrono::steady_clock::now() + std::chrono::milliseconds(statsInterval);
+    floorNotifier.setReceiveTimeout(RETRANSMIT_TIMEOUT_MS / 4);
+    while (true) {
+        if (std::chrono::steady_clock::now() >= nextRetransmit) {
+            retransmitDue(&scheduler, &dispatcher, &pending);
+            nextRetransmit = std::chrono::steady_clock::now() + retransmitInterval;
+        }
+        if (statsInterval > 0 && std::chrono::steady_clock::now() >= nextStats) {
+            stats.print();
+            nextStats = std::chrono::steady_clock::now() + std::chrono::milliseconds(statsInterval);
+        }
+        for (const PooledBuffer& packet : floorNotifier.receiveClients()) {
+            const std::vector<uint8_t>& data = *packet;
+            if (handleElevatorReply(&floorNotifier, &dispatcher, &pending, data)) {
+                continue;
+            }
+            if (data.size() >= 2 && static_cast<int>(data[0]) == 1 && static_cast<int>(data[1]) == 1) {
+                std::cout << "[Scheduler] Request completed\n";
+            }
+            else {
+                ElevatorEvent packetInfo;
+                if (floorNotifier.tryDecodeRequest(data, packetInfo)) {
+                    floorNotifier.put(packetInfo);
+                }
+            }
+        }
+    }
+
+    for (std::thread& floorThread : floorThreads) {
+        floorThread.join();
+    }
+    statusThread.join();
+    elevatorThread.join();
+}
 
 #endif // SCHEDULER_H
 
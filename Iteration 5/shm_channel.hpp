@@ -0,0 +1,501 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Datagram1.h"
+
+#define SHM_RING_SLOTS 256          // messages buffered per sending thread, a power of two
+#define SHM_SLOT_BYTES 62           // largest message one slot holds
+#define SHM_PRODUCERS 16            // sending threads a channel serves at the same time
+#define SHM_SPIN_COUNT 2000         // empty polls before the receiver sleeps on the futex
+
+// Single-producer/single-consumer ring in shared memory. The producer only writes tail and the
+// consumer only writes head, so neither side takes a lock.
+struct ShmRing {
+    std::atomic<uint32_t> owner;                    // thread ID of the producer, 0 if the ring is free
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    struct Slot {
+        uint16_t length;
+        uint8_t data[SHM_SLOT_BYTES];
+    } slots[SHM_RING_SLOTS];
+};
+
+// Everything sent to one port: a ring per sending thread and a doorbell word the receiver
+// sleeps on with a futex. An all-zero region is a valid empty channel.
+struct ShmRegion {
+    alignas(64) std::atomic<uint32_t> doorbell;
+    std::atomic<uint32_t> sleepers;
+    std::atomic<uint64_t> dropped;                  // sends lost to a full ring or no free ring
+    std::atomic<uint32_t> closed;                   // set once the receiver has removed the region
+    ShmRing rings[SHM_PRODUCERS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared-memory rings need lock-free 32-bit atomics");
+static_assert((SHM_RING_SLOTS & (SHM_RING_SLOTS - 1)) == 0, "SHM_RING_SLOTS must be a power of two");
+
+// Receiving end of a shared-memory channel, plus the sending side as static functions. Each
+// sending thread claims its own ring in the destination's region the first time it sends there.
+class ShmChannel {
+private:
+    ShmRegion* region = nullptr;
+    int port;
+    int lockFd = -1;                                // holds the exclusive lock that makes this the receiver
+    int next = 0;                                   // ring to look at first, for fairness
+
+    static std::mutex& registryMutex() {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    static std::map<int, ShmRegion*>& regions() {
+        static std::map<int, ShmRegion*> mapped;
+        return mapped;
+    }
+
+    struct Selection {
+        bool all = false;
+        std::set<int> ports;
+    };
+
+    // Ports listed in ELEVATOR_SHM_CHANNELS ("23,24" or "all"), read once.
+    static Selection& selection() {
+        static Selection selected = [] {
+            Selection parsed;
+            const char* env = std::getenv("ELEVATOR_SHM_CHANNELS");
+            if (env != nullptr) {
+                std::stringstream list(env);
+                std::string port;
+                while (std::getline(list, port, ',')) {
+                    if (port == "all") {
+                        parsed.all = true;
+                    } else if (!port.empty()) {
+                        parsed.ports.insert(std::atoi(port.c_str()));
+                    }
+                }
+            }
+            return parsed;
+        }();
+        return selected;
+    }
+
+    static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const timespec* timeout = nullptr) {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+    }
+
+    // Sizes the region behind `fd` and maps it. The caller still owns `fd`.
+    static ShmRegion* map(int fd, const std::string& name) {
+        if (ftruncate(fd, sizeof(ShmRegion)) < 0) {
+            throw std::runtime_error("ftruncate failed for " + name + ": " + strerror(errno));
+        }
+        void* memory = mmap(nullptr, sizeof(ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("mmap failed for " + name + ": " + strerror(errno));
+        }
+        return static_cast<ShmRegion*>(memory);
+    }
+
+    // Rings this thread has claimed, released again when the thread exits.
+    struct ClaimedRings {
+        std::map<ShmRegion*, ShmRing*> rings;
+
+        ~ClaimedRings() {
+            for (auto& [region, ring] : rings) {
+                ring->owner.store(0, std::memory_order_release);
+            }
+        }
+    };
+
+    static ShmRing* claimRing(ShmRegion* region) {
+        thread_local ClaimedRings claimed;
+        auto it = claimed.rings.find(region);
+        if (it != claimed.rings.end()) {
+            return it->second;
+        }
+        uint32_t self = static_cast<uint32_t>(syscall(SYS_gettid));
+        for (ShmRing& ring : region->rings) {
+            uint32_t owner = ring.owner.load(std::memory_order_acquire);
+            // A ring whose producer died is free again; its unread messages are still delivered.
+            if (owner != 0 && kill(owner, 0) == -1 && errno == ESRCH) {
+                ring.owner.compare_exchange_strong(owner, 0);
+                owner = 0;
+            }
+            if (owner == 0 && ring.owner.compare_exchange_strong(owner, self)) {
+                claimed.rings[region] = &ring;
+                return &ring;
+            }
+        }
+        return nullptr;
+    }
+
+    // Drops this process's mapping of `port` if it is still `region`, so the next attach() opens
+    // the port afresh. The memory stays mapped because other threads may still hold its rings.
+    static void forget(int port, ShmRegion* region) {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto it = regions().find(port);
+        if (it != regions().end() && it->second == region) {
+            regions().erase(it);
+        }
+    }
+
+    bool pending() const {
+        for (const ShmRing& ring : region->rings) {
+            if (ring.head.load(std::memory_order_relaxed) != ring.tail.load(std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    // Binds the receiving end for `port`. Messages sent before the receiver started, including any
+    // left by one that crashed before removing the region, are delivered rather than discarded.
+    // Only one receiver can hold a port at a time; a second one throws.
+    explicit ShmChannel(int port) : port(port) {
+        std::string name = regionName(port);
+        lockFd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (lockFd < 0) {
+            throw std::runtime_error("shm_open failed for " + name + ": " + strerror(errno));
+        }
+        if (flock(lockFd, LOCK_EX | LOCK_NB) < 0) {
+            int error = errno;
+            close(lockFd);
+            if (error == EWOULDBLOCK) {
+                throw std::runtime_error("shared-memory port " + std::to_string(port) + " already has a receiver");
+            }
+            throw std::runtime_error("flock failed for " + name + ": " + strerror(error));
+        }
+        try {
+            // Map the region just locked, even if this process still has an older one for the port.
+            std::lock_guard<std::mutex> lock(registryMutex());
+            region = map(lockFd, name);
+            regions()[port] = region;
+        } catch (...) {
+            close(lockFd);
+            throw;
+        }
+    }
+
+    // Removes the region so the next receiver starts a fresh one, then marks it closed so senders
+    // in other processes stop writing to it and open the new one, then releases the port.
+    ~ShmChannel() {
+        shm_unlink(regionName(port).c_str());
+        region->closed.store(1, std::memory_order_release);
+        forget(port, region);
+        close(lockFd);
+    }
+
+    ShmChannel(const ShmChannel&) = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    static bool enabled(int port) {
+        Selection& selected = selection();
+        return selected.all || selected.ports.count(port) > 0;
+    }
+
+    // Routes `port` through shared memory in this process, as if it were listed in the environment.
+    // Call before any thread sends to or binds the port.
+    static void enable(int port) {
+        selection().ports.insert(port);
+    }
+
+    static std::string regionName(int port) {
+        return "/elevator_channel_" + std::to_string(port);
+    }
+
+    // Maps the region for `port`, creating it if no one has yet. Mapped once per process, until
+    // the receiver removes it and send() finds it closed.
+    static ShmRegion* attach(int port) {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        auto it = regions().find(port);
+        if (it != regions().end()) {
+            return it->second;
+        }
+        std::string name = regionName(port);
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+        if (fd < 0) {
+            throw std::runtime_error("shm_open failed for " + name + ": " + strerror(errno));
+        }
+        ShmRegion* region = nullptr;
+        try {
+            region = map(fd, name);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+        regions()[port] = region;
+        return region;
+    }
+
+    // Copies the message into this thread's ring for `port` and wakes the receiver if it sleeps.
+    // Returns false if the message was dropped because the receiver has fallen behind.
+    static bool send(int port, const uint8_t* data, size_t length) {
+        if (length > SHM_SLOT_BYTES) {
+            throw std::runtime_error("message of " + std::to_string(length) + " bytes does not fit a shared-memory slot");
+        }
+        ShmRegion* region = attach(port);
+        if (region->closed.load(std::memory_order_acquire)) {
+            // The receiver restarted since this process mapped the port; its name now leads to the
+            // region the next receiver reads, or will create.
+            forget(port, region);
+            region = attach(port);
+        }
+        ShmRing* ring = claimRing(region);
+        if (ring == nullptr) {
+            region->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+        if (tail - ring->head.load(std::memory_order_acquire) >= SHM_RING_SLOTS) {
+            region->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        ShmRing::Slot& slot = ring->slots[tail & (SHM_RING_SLOTS - 1)];
+        slot.length = length;
+        std::memcpy(slot.data, data, length);
+        ring->tail.store(tail + 1, std::memory_order_release);
+
+        // Pairs with the receiver registering as a sleeper before it rereads the doorbell.
+        region->doorbell.fetch_add(1, std::memory_order_seq_cst);
+        if (region->sleepers.load(std::memory_order_seq_cst) > 0) {
+            futex(&region->doorbell, FUTEX_WAKE, 1);
+        }
+        return true;
+    }
+
+    // Waits until a message arrives, or `timeoutMs` passes if it is not 0, and copies at most
+    // `capacity` bytes of it. `length` is the message's full length, like recvfrom with MSG_TRUNC.
+    // Returns false on timeout.
+    bool receive(uint8_t* out, size_t capacity, size_t& length, int timeoutMs = 0) {
+        // Spinning only pays off if the sender can run on another CPU meanwhile.
+        static const int spins = std::thread::hardware_concurrency() > 1 ? SHM_SPIN_COUNT : 1;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (true) {
+            for (int spin = 0; spin < spins; spin++) {
+                if (tryReceive(out, capacity, length)) {
+                    return true;
+                }
+            }
+            timespec wait = {};
+            if (timeoutMs > 0) {
+                auto left = deadline - std::chrono::steady_clock::now();
+                if (left <= std::chrono::steady_clock::duration::zero()) {
+                    return false;
+                }
+                long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+                wait.tv_sec = ns / 1000000000;
+                wait.tv_nsec = ns % 1000000000;
+            }
+            region->sleepers.fetch_add(1, std::memory_order_seq_cst);
+            uint32_t seen = region->doorbell.load(std::memory_order_seq_cst);
+            if (!pending()) {
+                futex(&region->doorbell, FUTEX_WAIT, seen, timeoutMs > 0 ? &wait : nullptr);
+            }
+            region->sleepers.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    // Copies the next waiting message, if there is one, without blocking.
+    bool tryReceive(uint8_t* out, size_t capacity, size_t& length) {
+        for (int i = 0; i < SHM_PRODUCERS; i++) {
+            ShmRing& ring = region->rings[(next + i) % SHM_PRODUCERS];
+            uint32_t head = ring.head.load(std::memory_order_relaxed);
+            if (head == ring.tail.load(std::memory_order_acquire)) {
+                continue;
+            }
+            const ShmRing::Slot& slot = ring.slots[head & (SHM_RING_SLOTS - 1)];
+            length = slot.length;
+            std::memcpy(out, slot.data, std::min<size_t>(length, capacity));
+            ring.head.store(head + 1, std::memory_order_release);
+            next = (next + i + 1) % SHM_PRODUCERS;
+            return true;
+        }
+        return false;
+    }
+
+    uint64_t droppedCount() const {
+        return region->dropped.load(std::memory_order_relaxed);
+    }
+
+    // The same count for `port` as seen from any process, bound to it or not. 0 if no one has used
+    // the port, without creating its region.
+    static uint64_t droppedCount(int port) {
+        int fd = shm_open(regionName(port).c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return 0;
+        }
+        struct stat status;
+        void* memory = MAP_FAILED;
+        if (fstat(fd, &status) == 0 && status.st_size >= static_cast<off_t>(sizeof(ShmRegion))) {
+            memory = mmap(nullptr, sizeof(ShmRegion), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (memory == MAP_FAILED) {
+            return 0;
+        }
+        uint64_t dropped = static_cast<const ShmRegion*>(memory)->dropped.load(std::memory_order_relaxed);
+        munmap(memory, sizeof(ShmRegion));
+        return dropped;
+    }
+};
+
+// The DatagramSocket interface, with packets for ports selected by ShmChannel (the
+// ELEVATOR_SHM_CHANNELS list) carried through shared memory instead of loopback UDP.
+class ChannelSocket {
+private:
+    std::unique_ptr<DatagramSocket> udp;
+    std::unique_ptr<ShmChannel> shm;
+    in_port_t shmPort = 0;
+    int timeoutMs = 0;
+
+public:
+    // Send-only socket.
+    ChannelSocket() : udp(new DatagramSocket()) {}
+
+    // Receives on `port` over whichever transport the port is configured for. Only UDP ports can
+    // be bound by several sockets (reusePort).
+    ChannelSocket(in_port_t port, bool reusePort = false) {
+        if (ShmChannel::enabled(port)) {
+            if (reusePort) {
+                throw std::runtime_error("shared-memory port " + std::to_string(port) + " has a single receiver");
+            }
+            shm.reset(new ShmChannel(port));
+            shmPort = port;
+            udp.reset(new DatagramSocket());
+        } else {
+            udp.reset(new DatagramSocket(port, reusePort));
+        }
+    }
+
+    static bool canSharePort(int port) {
+        return !ShmChannel::enabled(port);
+    }
+
+    static bool canPoll(int port) {
+        return !ShmChannel::enabled(port);
+    }
+
+    // Port 0 picks a free UDP port; a shared-memory port is always the one asked for.
+    in_port_t localPort() const {
+        return shm ? shmPort : udp->localPort();
+    }
+
+    ssize_t send(DatagramPacket& packet) {
+        if (ShmChannel::enabled(packet.getPort())) {
+            bool sent = ShmChannel::send(packet.getPort(), static_cast<const uint8_t*>(packet.getData()), packet.getLength());
+            return sent ? packet.getLength() : 0;
+        }
+        return udp->send(packet);
+    }
+
+    void setSoTimeout(int ms) {
+        timeoutMs = ms;
+        udp->setSoTimeout(ms);
+    }
+
+    // Returns false if the timeout expired first.
+    bool receive(DatagramPacket& packet) {
+        if (!shm) {
+            return udp->receive(packet);
+        }
+        size_t length = 0;
+        if (!shm->receive(static_cast<uint8_t*>(packet.getData()), std::distance(packet.begin(), packet.end()), length, timeoutMs)) {
+            return false;
+        }
+        packet.setLength(length);
+        return true;
+    }
+
+    // Shared-memory ports have no descriptor, so only UDP ports can join an event loop.
+    int fd() const {
+        if (shm) {
+            throw std::runtime_error("a shared-memory port cannot be polled");
+        }
+        return udp->fd();
+    }
+
+    bool tryReceive(DatagramPacket& packet) {
+        if (!shm) {
+            return udp->tryReceive(packet);
+        }
+        size_t length = 0;
+        if (!shm->tryReceive(static_cast<uint8_t*>(packet.getData()), std::distance(packet.begin(), packet.end()), length)) {
+            return false;
+        }
+        packet.setLength(length);
+        return true;
+    }
+
+    int receiveBatch(std::vector<DatagramPacket>& packets) {
+        if (!shm) {
+            return udp->receiveBatch(packets);
+        }
+        if (packets.empty() || !receive(packets[0])) {
+            return 0;
+        }
+        size_t count = std::min(packets.size(), static_cast<size_t>(DATAGRAM_BATCH_MAX));
+        size_t received = 1;
+        for (size_t length = 0; received < count; received++) {
+            DatagramPacket& packet = packets[received];
+            if (!shm->tryReceive(static_cast<uint8_t*>(packet.getData()), std::distance(packet.begin(), packet.end()), length)) {
+                break;
+            }
+            packet.setLength(length);
+        }
+        return received;
+    }
+
+    int tryReceiveBatch(std::vector<DatagramPacket>& packets) {
+        if (!shm) {
+            return udp->tryReceiveBatch(packets);
+        }
+        size_t count = std::min(packets.size(), static_cast<size_t>(DATAGRAM_BATCH_MAX));
+        size_t received = 0;
+        while (received < count && tryReceive(packets[received])) {
+            received++;
+        }
+        return received;
+    }
+
+    // Packets for shared-memory ports go one at a time; the rest share sendmmsg calls.
+    int sendBatch(std::vector<DatagramPacket>& packets) {
+        std::vector<DatagramPacket> overUdp;
+        for (DatagramPacket& packet : packets) {
+            if (ShmChannel::enabled(packet.getPort())) {
+                send(packet);
+            } else {
+                overUdp.push_back(packet);
+            }
+        }
+        if (!overUdp.empty()) {
+            udp->sendBatch(overUdp);
+        }
+        return packets.size();
+    }
+};
+
+#endif // SHM_CHANNEL_H
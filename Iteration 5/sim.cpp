@@ -0,0 +1,64 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "simulation.hpp"
+
+int main(int argc, char* argv[]) {
+    int cars = 4;
+    int floors = 22;
+    double hours = 1;
+    double rate = 0;
+    unsigned seed = 3303;
+    std::string trace;
+    std::string dispatch = "nearest";
+    long long batchWindow = 100;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--cars") cars = std::atoi(argv[i + 1]);
+        else if (arg == "--floors") floors = std::atoi(argv[i + 1]);
+        else if (arg == "--hours") hours = std::atof(argv[i + 1]);
+        else if (arg == "--rate") rate = std::atof(argv[i + 1]);
+        else if (arg == "--seed") seed = std::atoi(argv[i + 1]);
+        else if (arg == "--trace") trace = argv[i + 1];
+        else if (arg == "--dispatch") dispatch = argv[i + 1];
+        else if (arg == "--batch-window") batchWindow = std::atoll(argv[i + 1]);
+    }
+    if (rate == 0) {
+        rate = cars * 60.0;     // about one request per car per minute
+    }
+
+    Simulation simulation(cars);
+    Dispatcher dispatcher;
+    if (dispatch == "nearest") {
+        simulation.useDispatcher(dispatcher);
+    } else if (dispatch == "batch") {
+        simulation.useBatchDispatcher(dispatcher, batchWindow);
+    }
+    if (!trace.empty()) {
+        simulation.addTrace(trace);
+    } else {
+        simulation.addRandomTraffic(floors, hours, rate, seed);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    SimStats stats = simulation.run();
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+    std::cout << "[Simulation] Cars: " << cars << " (" << dispatch << " dispatch)" << std::endl
+              << "[Simulation] Simulated time: " << stats.endTime / 1000.0 << " s" << std::endl
+              << "[Simulation] Wall time: " << wall.count() << " s" << std::endl
+              << "[Simulation] Events processed: " << stats.eventsProcessed << std::endl
+              << "[Simulation] Requests completed: " << stats.completed << std::endl
+              << "[Simulation] Over capacity: " << stats.overCapacity << std::endl
+              << "[Simulation] Lost to major faults: " << stats.lost << std::endl
+              << "[Simulation] Average wait: " << stats.averageWait / 1000.0 << " s" << std::endl
+              << "[Simulation] Average trip: " << stats.averageTrip / 1000.0 << " s" << std::endl;
+    if (stats.batches > 0) {
+        std::cout << "[Simulation] Batches: " << stats.batches << ", average solve "
+                  << stats.batchSolveMicros / stats.batches << " us" << std::endl
+                  << "[Simulation] Estimated wait, batch plans: " << stats.batchCost / 1000.0
+                  << " s, greedy: " << stats.batchGreedyCost / 1000.0 << " s" << std::endl;
+    }
+}
@@ -0,0 +1,406 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <queue>
+#include <deque>
+#include <vector>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include "elevator.hpp"
+#include "floor.hpp"
+#include "dispatcher.hpp"
+
+// Delays the threaded Elevator sleeps through, in simulated milliseconds.
+#define SIM_FLOOR_TIME FLOOR_TIME_MS
+#define SIM_DOOR_TIME DOOR_STEP_MS
+#define SIM_DOOR_FAULT_TIME DOOR_FAULT_MS
+#define SIM_REST_TIME REST_TIME_MS
+#define SIM_CAR_CAPACITY CAR_CAPACITY
+
+enum class SimEventType { RequestArrival, ArriveFloor, DoorStep, FaultCleared, Rested, BatchFlush };
+
+struct SimEvent {
+    long long time;
+    long long sequence;     // keeps events due at the same time in the order they were scheduled
+    SimEventType type;
+    int target;             // car index, or request index for arrivals
+
+    bool operator>(const SimEvent& other) const {
+        return time != other.time ? time > other.time : sequence > other.sequence;
+    }
+};
+
+struct SimRequest {
+    long long arrival;
+    ElevatorEvent event;
+    long long pickedUp = -1;
+    long long delivered = -1;
+};
+
+enum class SimLeg { None, ToPickup, ToDestination };
+
+struct SimCar {
+    int id;
+    int currentFloor = 1;
+    ElevatorState state = ElevatorState::Idle;
+    Direction direction = Direction::Idle;
+    std::deque<int> assigned;   // requests waiting for this car, oldest first
+    int current = -1;           // request being served
+    SimLeg leg = SimLeg::None;
+    int targetFloor = 1;
+    bool resting = false;
+};
+
+struct SimStats {
+    long long eventsProcessed = 0;
+    long long endTime = 0;
+    int completed = 0;
+    int overCapacity = 0;
+    int lost = 0;
+    double averageWait = 0;     // arrival until the car leaves the pickup floor
+    double averageTrip = 0;     // arrival until delivery
+    int batches = 0;
+    double batchSolveMicros = 0;
+    long long batchCost = 0;        // estimated wait of the batch plans, ms
+    long long batchGreedyCost = 0;  // estimated wait had each batch been assigned greedily, ms
+};
+
+// Single-threaded discrete-event model of the elevator subsystem. Each car steps through the
+// same ElevatorState transitions as Elevator::processRequest, but every sleep becomes a
+// timestamped event, so thousands of cars run on one core in simulated time.
+class Simulation {
+public:
+    // Returns the index of the car for a request, or -1 to drop it.
+    using DispatchPolicy = std::function<int(const ElevatorEvent&, const std::vector<SimCar>&, long long)>;
+    using StateObserver = std::function<void(const SimCar&, long long)>;
+
+private:
+    std::priority_queue<SimEvent, std::vector<SimEvent>, std::greater<SimEvent>> events;
+    std::vector<SimCar> cars;
+    std::vector<SimRequest> requests;
+    long long now = 0;
+    long long sequence = 0;
+    int nextCar = 0;
+    SimStats stats;
+    DispatchPolicy dispatcher;
+    StateObserver observer;
+    Dispatcher* batchDispatcher = nullptr;
+    long long batchWindow = 0;
+    std::vector<int> pendingBatch;
+
+    void schedule(long long delay, SimEventType type, int target) {
+        events.push(SimEvent{now + delay, sequence++, type, target});
+    }
+
+    void setState(SimCar& car, ElevatorState newState) {
+        if (car.state != newState) {
+            car.state = newState;
+            if (observer) {
+                observer(car, now);
+            }
+        }
+    }
+
+    void handleArrival(int r) {
+        if (batchDispatcher != nullptr) {
+            pendingBatch.push_back(r);
+            if (pendingBatch.size() == 1) {
+                schedule(batchWindow, SimEventType::BatchFlush, 0);
+            }
+            return;
+        }
+        int index;
+        if (dispatcher) {
+            index = dispatcher(requests[r].event, cars, now);
+        } else {
+            index = nextCar++ % cars.size();
+        }
+        if (index < 0 || index >= static_cast<int>(cars.size())) {
+            stats.lost++;
+            return;
+        }
+        SimCar& car = cars[index];
+        car.assigned.push_back(r);
+        startNext(car);
+    }
+
+    void flushBatch() {
+        std::vector<ElevatorEvent> calls;
+        for (int r : pendingBatch) {
+            calls.push_back(requests[r].event);
+        }
+        BatchPlan plan = batchDispatcher->assignBatch(calls, now);
+        stats.batches++;
+        stats.batchSolveMicros += plan.solveMicros;
+        stats.batchCost += plan.totalCost;
+        stats.batchGreedyCost += plan.greedyCost;
+
+        std::vector<int> batch;
+        batch.swap(pendingBatch);
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (plan.cars[i] < 0 || plan.cars[i] >= static_cast<int>(cars.size())) {
+                stats.lost++;
+                continue;
+            }
+            cars[plan.cars[i]].assigned.push_back(batch[i]);
+        }
+        for (SimCar& car : cars) {
+            startNext(car);
+        }
+    }
+
+    // Starts the car's oldest request it can serve, skipping those it cannot. A loop rather than
+    // a call per skipped request, so a long queue of them cannot exhaust the stack.
+    void startNext(SimCar& car) {
+        int r = -1;
+        while (r == -1) {
+            if (car.state == ElevatorState::MajorFault) {
+                // An out of service car never reads its queue again, as in the threaded system.
+                stats.lost += car.assigned.size();
+                car.assigned.clear();
+                return;
+            }
+            if (car.current != -1 || car.resting || car.assigned.empty()) {
+                return;
+            }
+            r = car.assigned.front();
+            car.assigned.pop_front();
+            const ElevatorEvent& skipped = requests[r].event;
+            if (skipped.passengers > SIM_CAR_CAPACITY) {
+                stats.overCapacity++;
+                r = -1;
+            } else if (skipped.fault == FaultType::Major) {
+                setState(car, ElevatorState::MajorFault);
+                stats.lost++;
+                r = -1;
+            }
+        }
+        const ElevatorEvent& item = requests[r].event;
+
+        car.current = r;
+        if (car.currentFloor != item.floor) {
+            car.leg = SimLeg::ToPickup;
+            car.targetFloor = item.floor;
+        } else {
+            requests[r].pickedUp = now;
+            car.leg = SimLeg::ToDestination;
+            car.targetFloor = destinationOf(item, car.currentFloor);
+        }
+        depart(car);
+    }
+
+    static int destinationOf(const ElevatorEvent& item, int from) {
+        return item.floorButton == Direction::Up ? from + item.floorsToMove : from - item.floorsToMove;
+    }
+
+    void depart(SimCar& car) {
+        if (car.currentFloor == car.targetFloor) {
+            arrived(car);
+            return;
+        }
+        car.direction = car.currentFloor < car.targetFloor ? Direction::Up : Direction::Down;
+        setState(car, car.direction == Direction::Up ? ElevatorState::MovingUp : ElevatorState::MovingDown);
+        schedule(SIM_FLOOR_TIME, SimEventType::ArriveFloor, car.id);
+    }
+
+    void onArriveFloor(SimCar& car) {
+        car.currentFloor += car.direction == Direction::Up ? 1 : -1;
+        if (car.currentFloor != car.targetFloor) {
+            schedule(SIM_FLOOR_TIME, SimEventType::ArriveFloor, car.id);
+        } else {
+            arrived(car);
+        }
+    }
+
+    void arrived(SimCar& car) {
+        car.direction = Direction::Idle;
+        if (car.leg == SimLeg::ToPickup && requests[car.current].event.fault == FaultType::Minor) {
+            setState(car, ElevatorState::MinorFault);
+            schedule(SIM_DOOR_FAULT_TIME, SimEventType::FaultCleared, car.id);
+            return;
+        }
+        setState(car, ElevatorState::DoorOpening);
+        schedule(SIM_DOOR_TIME, SimEventType::DoorStep, car.id);
+    }
+
+    void onDoorStep(SimCar& car) {
+        switch (car.state) {
+            case ElevatorState::DoorOpening:
+                setState(car, ElevatorState::DoorOpen);
+                schedule(SIM_DOOR_TIME, SimEventType::DoorStep, car.id);
+                break;
+            case ElevatorState::DoorOpen:
+                setState(car, ElevatorState::DoorClosing);
+                schedule(SIM_DOOR_TIME, SimEventType::DoorStep, car.id);
+                break;
+            default:
+                setState(car, ElevatorState::Idle);
+                finishLeg(car);
+                break;
+        }
+    }
+
+    void finishLeg(SimCar& car) {
+        SimRequest& request = requests[car.current];
+        if (car.leg == SimLeg::ToPickup) {
+            request.pickedUp = now;
+            car.leg = SimLeg::ToDestination;
+            car.targetFloor = destinationOf(request.event, car.currentFloor);
+            depart(car);
+            return;
+        }
+        request.delivered = now;
+        stats.completed++;
+        car.current = -1;
+        car.leg = SimLeg::None;
+        car.resting = true;
+        schedule(SIM_REST_TIME, SimEventType::Rested, car.id);
+    }
+
+public:
+    Simulation(int carCount, DispatchPolicy dispatcher = nullptr)
+        : dispatcher(std::move(dispatcher)) {
+        for (int i = 0; i < carCount; i++) {
+            SimCar car;
+            car.id = i;
+            cars.push_back(car);
+        }
+    }
+
+    // Adds an observer of every state change. Observers added before, such as useDispatcher()'s,
+    // are still called, first.
+    void setObserver(StateObserver stateObserver) {
+        if (!observer) {
+            observer = std::move(stateObserver);
+            return;
+        }
+        observer = [previous = std::move(observer), next = std::move(stateObserver)](const SimCar& car, long long now) {
+            previous(car, now);
+            next(car, now);
+        };
+    }
+
+    // Dispatches through `dispatcher`, feeding it every state change the way the
+    // elevators' status packets do in the threaded system.
+    void useDispatcher(Dispatcher& dispatcher) {
+        for (const SimCar& car : cars) {
+            dispatcher.addCar(car.id, car.id);
+        }
+        this->dispatcher = [&dispatcher](const ElevatorEvent& event, const std::vector<SimCar>&, long long now) {
+            return dispatcher.assign(event, now);
+        };
+        StateObserver previous = observer;
+        observer = [&dispatcher, previous](const SimCar& car, long long now) {
+            dispatcher.updateStatus(car.id, car.currentFloor, car.direction, car.state);
+            if (previous) {
+                previous(car, now);
+            }
+        };
+    }
+
+    // Collects arrivals for `window` ms and assigns each batch with Dispatcher::assignBatch.
+    void useBatchDispatcher(Dispatcher& dispatcher, long long window) {
+        useDispatcher(dispatcher);
+        batchDispatcher = &dispatcher;
+        batchWindow = window;
+    }
+
+    // Queues a request that reaches the scheduler `arrival` ms into the run.
+    void addRequest(long long arrival, const ElevatorEvent& event) {
+        requests.push_back(SimRequest{arrival, event});
+        events.push(SimEvent{arrival, sequence++, SimEventType::RequestArrival, static_cast<int>(requests.size() - 1)});
+    }
+
+    SimStats run() {
+        while (!events.empty()) {
+            SimEvent event = events.top();
+            events.pop();
+            now = event.time;
+            stats.eventsProcessed++;
+
+            switch (event.type) {
+                case SimEventType::RequestArrival: handleArrival(event.target); break;
+                case SimEventType::ArriveFloor: onArriveFloor(cars[event.target]); break;
+                case SimEventType::DoorStep: onDoorStep(cars[event.target]); break;
+                case SimEventType::FaultCleared:
+                    setState(cars[event.target], ElevatorState::Idle);
+                    setState(cars[event.target], ElevatorState::DoorOpening);
+                    schedule(SIM_DOOR_TIME, SimEventType::DoorStep, event.target);
+                    break;
+                case SimEventType::Rested:
+                    cars[event.target].resting = false;
+                    startNext(cars[event.target]);
+                    break;
+                case SimEventType::BatchFlush: flushBatch(); break;
+            }
+        }
+
+        stats.endTime = now;
+        double waitTotal = 0, tripTotal = 0;
+        for (const SimRequest& request : requests) {
+            if (request.delivered >= 0) {
+                waitTotal += request.pickedUp - request.arrival;
+                tripTotal += request.delivered - request.arrival;
+            }
+        }
+        if (stats.completed > 0) {
+            stats.averageWait = waitTotal / stats.completed;
+            stats.averageTrip = tripTotal / stats.completed;
+        }
+        return stats;
+    }
+
+    const std::vector<SimCar>& getCars() const { return cars; }
+
+    static ElevatorEvent makeEvent(long long time, int floor, const std::string& button, int floorsToMove, int passengers, const std::string& fault) {
+        return ElevatorEvent(static_cast<uint32_t>(time % 86400000), floor, directionFromString(button), floorsToMove, passengers,
+                             faultFromString(fault));
+    }
+
+    // Poisson hall-call traffic over a building with `floors` floors and no faults.
+    void addRandomTraffic(int floors, double hours, double requestsPerHour, unsigned seed) {
+        std::mt19937 rng(seed);
+        std::exponential_distribution<double> gap(requestsPerHour / 3600000.0);
+        std::uniform_int_distribution<int> floorPick(1, floors);
+        std::uniform_int_distribution<int> groupSize(1, SIM_CAR_CAPACITY);
+        long long end = static_cast<long long>(hours * 3600000);
+
+        for (double t = gap(rng); t < end; t += gap(rng)) {
+            int from = floorPick(rng);
+            int to = floorPick(rng);
+            while (to == from) {
+                to = floorPick(rng);
+            }
+            addRequest(static_cast<long long>(t), ElevatorEvent(static_cast<uint32_t>(static_cast<long long>(t) % 86400000), from,
+                                                                to > from ? Direction::Up : Direction::Down,
+                                                                std::abs(to - from), groupSize(rng), FaultType::None));
+        }
+    }
+
+    // Loads a trace in the elevator.txt format, timed relative to its first line.
+    void addTrace(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        std::string line;
+        long long firstTime = -1;
+        while (std::getline(file, line)) {
+            std::istringstream iss(line);
+            std::string timeStr, floorButton, fault;
+            int floor, floorsToMove, passengers;
+            if (!(iss >> timeStr >> floor >> floorButton >> floorsToMove >> passengers >> fault)) {
+                continue;
+            }
+            long long time = Floor<ElevatorEvent>::parseTime(timeStr);
+            if (firstTime < 0) {
+                firstTime = time;
+            }
+            addRequest(std::max(0LL, time - firstTime), makeEvent(time, floor, floorButton, floorsToMove, passengers, fault));
+        }
+    }
+};
+
+#endif // SIMULATION_H
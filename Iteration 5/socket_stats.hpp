@@ -0,0 +1,118 @@
+#ifndef SOCKET_STATS_H
+#define SOCKET_STATS_H
+
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <arpa/inet.h>
+#include "shm_channel.hpp"
+
+#define STATS_INTERVAL_MS 5000      // how often --stats prints when no interval is given
+
+// What the kernel reports for the UDP sockets bound to one local port, summed over every socket
+// on the port and over IPv4 and IPv6.
+struct UdpPortStats {
+    int sockets = 0;
+    unsigned long drops = 0;        // datagrams discarded, almost always for a full receive buffer
+    unsigned long queuedBytes = 0;  // in the receive buffers now, not yet read
+};
+
+// Parses /proc/net/udp-style tables into counters by local port, as the kernel numbers it. Files
+// that cannot be read, as where procfs is not mounted, contribute nothing.
+inline std::map<int, UdpPortStats> readUdpStats(
+    const std::vector<std::string>& files = { "/proc/net/udp", "/proc/net/udp6" }) {
+    std::map<int, UdpPortStats> stats;
+    for (const std::string& name : files) {
+        std::ifstream file(name);
+        std::string line;
+        std::getline(file, line);       // column headings
+        while (std::getline(file, line)) {
+            // sl local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode ref pointer drops
+            std::istringstream fields(line);
+            std::vector<std::string> field;
+            for (std::string word; fields >> word;) {
+                field.push_back(word);
+            }
+            if (field.size() < 13) {
+                continue;
+            }
+            size_t portAt = field[1].rfind(':');
+            size_t rxAt = field[4].find(':');
+            if (portAt == std::string::npos || rxAt == std::string::npos) {
+                continue;
+            }
+            UdpPortStats& port = stats[std::stoi(field[1].substr(portAt + 1), nullptr, 16)];
+            port.sockets++;
+            port.queuedBytes += std::stoul(field[4].substr(rxAt + 1), nullptr, 16);
+            port.drops += std::stoul(field.back());
+        }
+    }
+    return stats;
+}
+
+// Periodic report of datagrams lost on a set of ports, next to whatever gauges the process adds,
+// such as a queue's depth. Ports carried over shared memory report their rings' drops instead of
+// the kernel's. Nothing is sampled on its own: the owner calls print() from a loop it already runs.
+class SocketStats {
+private:
+    std::vector<int> ports;
+    std::map<int, unsigned long> lastDrops;
+    std::vector<std::pair<std::string, std::function<std::string()>>> gauges;
+
+public:
+    explicit SocketStats(std::vector<int> ports) : ports(std::move(ports)) {}
+
+    // `describe` is called on every print() from the printing thread.
+    void addGauge(const std::string& name, std::function<std::string()> describe) {
+        gauges.emplace_back(name, std::move(describe));
+    }
+
+    // DatagramSocket puts port numbers into sin_port as they are, without htons, so the kernel
+    // lists port p under ntohs(p).
+    static int kernelPort(int port) {
+        return ntohs(static_cast<uint16_t>(port));
+    }
+
+    // Drops on `port` so far, from the kernel or the shared-memory ring.
+    unsigned long drops(int port, const std::map<int, UdpPortStats>& udp) const {
+        if (ShmChannel::enabled(port)) {
+            return ShmChannel::droppedCount(port);
+        }
+        auto it = udp.find(kernelPort(port));
+        return it == udp.end() ? 0 : it->second.drops;
+    }
+
+    // One line per port, with the drops since the previous print, then one per gauge.
+    void print(std::ostream& out = std::cout) {
+        std::map<int, UdpPortStats> udp = readUdpStats();
+        std::ostringstream report;
+        for (int port : ports) {
+            unsigned long dropped = drops(port, udp);
+            unsigned long before = lastDrops.count(port) ? lastDrops[port] : dropped;
+            lastDrops[port] = dropped;
+            // The count starts again from 0 when the port is bound anew; all of it is new then.
+            unsigned long since = dropped >= before ? dropped - before : dropped;
+            report << "[Stats] port " << port << ": ";
+            if (ShmChannel::enabled(port)) {
+                report << dropped << " dropped (+" << since << ") in shared memory";
+            } else if (udp.count(kernelPort(port)) == 0) {
+                report << "not bound";
+            } else {
+                report << dropped << " dropped (+" << since << "), " << udp[kernelPort(port)].queuedBytes
+                       << " bytes queued";
+            }
+            report << "\n";
+        }
+        for (auto& [name, describe] : gauges) {
+            report << "[Stats] " << name << ": " << describe() << "\n";
+        }
+        out << report.str() << std::flush;
+    }
+};
+
+#endif // SOCKET_STATS_H
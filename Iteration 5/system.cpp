@@ -0,0 +1,51 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <functional>
+#include "elevator.hpp"
+#include "floor.hpp"
+
+#define SYSTEM_SETTLE_MS 2000       // how long every car must stay idle after the last request before exiting
+
+// The whole system in one process: four elevators, the scheduler and the floor replaying
+// elevator.txt, talking through in-process ports instead of sockets. Takes the clock options
+// of the separate programs.
+int main(int argc, char* argv[]) {
+    Clock& clock = Clock::fromArgs(argc, argv);
+
+    Elevator<ElevatorEvent, InProcessSocket> elevator1(ELEVATOR_1, 1, clock);
+    Elevator<ElevatorEvent, InProcessSocket> elevator2(ELEVATOR_2, 2, clock);
+    Elevator<ElevatorEvent, InProcessSocket> elevator3(ELEVATOR_3, 3, clock);
+    Elevator<ElevatorEvent, InProcessSocket> elevator4(ELEVATOR_4, 4, clock);
+
+    std::thread elevator1Thread(std::ref(elevator1));
+    std::thread elevator2Thread(std::ref(elevator2));
+    std::thread elevator3Thread(std::ref(elevator3));
+    std::thread elevator4Thread(std::ref(elevator4));
+    std::thread schedulerThread(runScheduler<InProcessSocket>, std::ref(clock), 0, 0, 1, 0);
+
+    Floor<ElevatorEvent, InProcessSocket> floorReader("elevator.txt", clock);
+    floorReader();
+
+    // The elevators and the scheduler serve for ever, so once the trace is sent wait until the
+    // cars have nothing left to do and leave without tearing down what their threads still use.
+    Elevator<ElevatorEvent, InProcessSocket>* elevators[] = { &elevator1, &elevator2, &elevator3, &elevator4 };
+    auto idleSince = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - idleSince < std::chrono::milliseconds(SYSTEM_SETTLE_MS)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        for (Elevator<ElevatorEvent, InProcessSocket>* elevator : elevators) {
+            if (elevator->getQueuedCalls() > 0) {
+                idleSince = std::chrono::steady_clock::now();
+            }
+        }
+    }
+    std::cout << "[System] All requests served, exiting" << std::endl;
+
+    schedulerThread.detach();
+    elevator1Thread.detach();
+    elevator2Thread.detach();
+    elevator3Thread.detach();
+    elevator4Thread.detach();
+    std::quick_exit(0);
+}
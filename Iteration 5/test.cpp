@@ -9,10 +9,16 @@
 
 #include "floor.hpp"
 
+#include "simulation.hpp"
+
+#include "reactor.hpp"
+
 #include <thread>
+#include <atomic>
 #include "iostream"
 #include <chrono>
 #include <sstream>
+#include <sys/wait.h>
 
 
 // Test ElevatorEvent structure
@@ -31,10 +37,49 @@ TEST_CASE("Scheduler handles put and get correctly") {
     scheduler.put(event);
     ElevatorEvent receivedEvent = scheduler.get();
     CHECK(receivedEvent.floor == 6);
-    CHECK(receivedEvent.floorButton == "Down");
+    CHECK(receivedEvent.floorButton == Direction::Down);
     CHECK(receivedEvent.floorsToMove == 1);
 }
 
+TEST_CASE("RingQueue reports overflow and keeps FIFO order across threads") {
+    RingQueue<int> ring(3);
+    CHECK(ring.capacity() == 4);
+    for (int i = 0; i < 4; i++) {
+        CHECK(ring.tryPush(i));
+    }
+    CHECK_FALSE(ring.tryPush(4));
+    CHECK(*ring.tryPop() == 0);
+    CHECK(ring.tryPush(4));
+    for (int i = 1; i <= 4; i++) {
+        CHECK(*ring.tryPop() == i);
+    }
+    CHECK_FALSE(ring.tryPop().has_value());
+
+    RingQueue<int> shared(64);
+    std::atomic<long> sum(0);
+    std::atomic<int> consumed(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < 2; p++) {
+        threads.emplace_back([&] {
+            for (int i = 1; i <= 10000; i++) {
+                while (!shared.tryPush(i)) { std::this_thread::yield(); }
+            }
+        });
+        threads.emplace_back([&] {
+            while (consumed.load() < 20000) {
+                if (std::optional<int> item = shared.tryPop()) {
+                    sum += *item;
+                    consumed++;
+                }
+            }
+        });
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    CHECK(sum.load() == 2L * 10000 * 10001 / 2);
+}
+
 // Test Scheduler Algorithm
 TEST_CASE("Scheduler alternates elevators correctly in alertElevator") {
     Scheduler<ElevatorEvent> scheduler(23);
@@ -76,6 +121,118 @@ TEST_CASE("Scheduler alternates elevators correctly in alertElevator") {
 }
 
 
+TEST_CASE("Dispatcher assigns calls to the car with the lowest estimated arrival") {
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, ELEVATOR_1);
+    dispatcher.addCar(2, ELEVATOR_2);
+    dispatcher.addCar(3, ELEVATOR_3);
+    dispatcher.updateStatus(std::vector<uint8_t>{1, 2, 0, static_cast<uint8_t>(ElevatorState::Idle)});
+    dispatcher.updateStatus(std::vector<uint8_t>{2, 9, 0, static_cast<uint8_t>(ElevatorState::Idle)});
+    dispatcher.updateStatus(std::vector<uint8_t>{3, 10, 1, static_cast<uint8_t>(ElevatorState::MovingUp)});
+
+    struct tm timestamp = {};
+    ElevatorEvent call(timestamp, 10, "Down", 3, 1, "None");
+    CHECK(dispatcher.assign(call, 0) == 1);
+    CHECK(dispatcher.getCar(1).port == ELEVATOR_2);
+
+    // Car 2 is now booked, so the next call near it goes to the idle car at floor 2.
+    ElevatorEvent next(timestamp, 8, "Up", 1, 1, "None");
+    CHECK(dispatcher.assign(next, 0) == 0);
+
+    dispatcher.updateStatus(std::vector<uint8_t>{1, 2, 0, static_cast<uint8_t>(ElevatorState::MajorFault)});
+    CHECK(dispatcher.estimateArrival(0, next, 0) == std::numeric_limits<long long>::max());
+
+    // Floors above 255 carry their high byte after the four bytes the displays read.
+    dispatcher.updateStatus(std::vector<uint8_t>{3, 300 & 0xFF, 1, static_cast<uint8_t>(ElevatorState::MovingUp), 300 >> 8});
+    CHECK(dispatcher.getCar(2).floor == 300);
+}
+
+TEST_CASE("Batch assignment beats greedy when the first call takes the wrong car") {
+    std::vector<std::vector<long long>> cost = {{4, 1, 3}, {2, 0, 5}, {3, 2, 2}};
+    std::vector<int> expectedColumns = {1, 0, 2};
+    CHECK(solveAssignment(cost) == expectedColumns);
+
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, ELEVATOR_1);
+    dispatcher.addCar(2, ELEVATOR_2);
+    dispatcher.updateStatus(1, 5, Direction::Idle, ElevatorState::Idle);
+    dispatcher.updateStatus(2, 1, Direction::Idle, ElevatorState::Idle);
+
+    // Greedy sends the floor 4 call to the car at 5, leaving the car at 1 to cross the building.
+    struct tm timestamp = {};
+    std::vector<ElevatorEvent> calls = {
+        ElevatorEvent(timestamp, 4, "Up", 1, 1, "None"),
+        ElevatorEvent(timestamp, 9, "Up", 1, 1, "None")
+    };
+    BatchPlan plan = dispatcher.assignBatch(calls, 0);
+    std::vector<int> expectedCars = {1, 0};
+    CHECK(plan.cars == expectedCars);
+    CHECK(plan.totalCost == 13000);
+    CHECK(plan.greedyCost == 15000);
+}
+
+TEST_CASE("A batch leaves a call no car serves unassigned and books nothing for it") {
+    Dispatcher dispatcher;
+    dispatcher.registerCar(1, 4801, CAR_CAPACITY, 1, 10);
+    dispatcher.registerCar(2, 4802, CAR_CAPACITY, 1, 10);
+    struct tm timestamp = {};
+    std::vector<ElevatorEvent> calls = {
+        ElevatorEvent(timestamp, 3, "Up", 2, 1, "None"),
+        ElevatorEvent(timestamp, 15, "Down", 2, 1, "None"),        // above both cars' floors
+        ElevatorEvent(timestamp, 8, "Down", 2, 1, "None")
+    };
+    BatchPlan plan = dispatcher.assignBatch(calls, 0);
+    CHECK(plan.cars[0] >= 0);
+    CHECK(plan.cars[1] == -1);
+    CHECK(plan.cars[2] >= 0);
+    CHECK(plan.cars[0] != plan.cars[2]);
+
+    // Each car's projection covers only the call it took.
+    for (int index = 0; index < 2; index++) {
+        long long eta = dispatcher.estimateArrival(index, ElevatorEvent(timestamp, 1, "Up", 1, 1, "None"), 0);
+        CHECK(eta > 0);
+        CHECK(eta < 60000);
+    }
+}
+
+TEST_CASE("A large batch is solved in parts with a few slots per car") {
+    Dispatcher dispatcher;
+    for (int id = 1; id <= 4; id++) {
+        dispatcher.addCar(id, ELEVATOR_1 + id);
+    }
+    std::vector<ElevatorEvent> calls;
+    for (int i = 0; i < 500; i++) {
+        calls.push_back(ElevatorEvent(0, 1 + i % 20, Direction::Up, 1, 1, FaultType::None));
+    }
+    auto start = std::chrono::steady_clock::now();
+    BatchPlan plan = dispatcher.assignBatch(calls, 0);
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(2));
+
+    std::vector<int> perCar(4, 0);
+    for (int car : plan.cars) {
+        REQUIRE(car >= 0);
+        perCar[car]++;
+    }
+    for (int count : perCar) {
+        CHECK(count <= 32 * BATCH_CAR_SLOTS);       // 32 parts, none giving a car more than its slots
+    }
+    CHECK(plan.totalCost <= plan.greedyCost);
+}
+
+TEST_CASE("The batch window passes in real time under a virtual clock") {
+    VirtualClock clock;
+    Scheduler<ElevatorEvent> scheduler(4721, clock);
+    scheduler.put(ElevatorEvent(0, 1, Direction::Up, 1, 1, FaultType::None));
+    std::thread late([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        scheduler.put(ElevatorEvent(0, 2, Direction::Up, 1, 1, FaultType::None));
+    });
+    std::vector<ElevatorEvent> batch = scheduler.drain(std::chrono::milliseconds(200));
+    late.join();
+    CHECK(batch.size() == 2);
+    CHECK(clock.now() == std::chrono::milliseconds(200));
+}
+
 // Test Elevator movement
 TEST_CASE("Elevator moves to correct floor") {
     Scheduler<ElevatorEvent> scheduler(23);
@@ -190,6 +347,947 @@ TEST_CASE("Test if elevator enters Minor Fault state") {
     elevatorThread.join();  
 }
 
+TEST_CASE("Elevator serves queued calls in LOOK sweep order") {
+    VirtualClock clock;
+    Elevator<ElevatorEvent> elevator(69, 1, clock);
+
+    struct tm timestamp = {};
+    elevator.addRequest(ElevatorEvent(timestamp, 4, "Down", 2, 1, "None"));
+    elevator.addRequest(ElevatorEvent(timestamp, 3, "Up", 4, 2, "None"));
+    elevator.addRequest(ElevatorEvent(timestamp, 5, "Up", 1, 1, "None"));
+
+    // Up sweep picks up at 3 and 5 and drops off at 6 and 7, then the down sweep serves 4 -> 2.
+    std::vector<int> expectedStops = {3, 5, 6, 7, 4, 2};
+    CHECK(elevator.serveUntilIdle() == expectedStops);
+    CHECK(elevator.getCurrentFloor() == 2);
+    CHECK(elevator.getState() == ElevatorState::Idle);
+}
+
+// Refuses every send, as a UDP socket does after ECONNREFUSED, and never receives anything.
+struct RefusingSocket {
+    in_port_t port;
+
+    RefusingSocket(in_port_t port = 1) : port(port) {}
+    in_port_t localPort() const { return port; }
+    void setSoTimeout(int) {}
+    bool receive(DatagramPacket&) { return false; }
+    ssize_t send(DatagramPacket&) { throw std::runtime_error("Connection refused"); }
+};
+
+TEST_CASE("Elevator reports failed status sends and keeps serving") {
+    VirtualClock clock;
+    Elevator<ElevatorEvent, RefusingSocket> elevator(4754, 1, clock);
+
+    struct tm timestamp = {};
+    elevator.addRequest(ElevatorEvent(timestamp, 3, "Up", 2, 1, "None"));
+    std::vector<int> stops;
+    CHECK_NOTHROW(stops = elevator.serveUntilIdle());
+    CHECK(stops == std::vector<int>({3, 5}));
+    CHECK(elevator.getState() == ElevatorState::Idle);
+}
+
+TEST_CASE("Elevator skips a pickup that does not fit and returns for it") {
+    VirtualClock clock;
+    Elevator<ElevatorEvent> elevator(69, 1, clock);
+
+    struct tm timestamp = {};
+    elevator.addRequest(ElevatorEvent(timestamp, 3, "Up", 4, 3, "None"));
+    elevator.addRequest(ElevatorEvent(timestamp, 5, "Up", 1, 2, "None"));
+
+    std::vector<int> expectedStops = {3, 7, 5, 6};
+    CHECK(elevator.serveUntilIdle() == expectedStops);
+}
+
+TEST_CASE("PendingRequests numbers requests and backs off retransmits") {
+    PendingRequests pending;
+    struct tm timestamp = {};
+    ElevatorEvent event(timestamp, 3, "Up", 2, 1, "None");
+    pending.track(event, 0, 0);
+    CHECK(event.requestId == 1);
+
+    std::vector<PendingRequest> expired;
+    CHECK(pending.due(RETRANSMIT_TIMEOUT_MS - 1, expired).empty());
+    std::vector<PendingRequest> resend = pending.due(RETRANSMIT_TIMEOUT_MS, expired);
+    REQUIRE(resend.size() == 1);
+    CHECK(resend[0].deadline == 3 * RETRANSMIT_TIMEOUT_MS);
+
+    std::optional<PendingRequest> refused = pending.refuse(event.requestId, 0);
+    REQUIRE(refused.has_value());
+    CHECK(refused->refused == std::vector<int>{0});
+    CHECK(pending.size() == 0);
+    CHECK(pending.getCounters().retransmitted == 1);
+}
+
+TEST_CASE("Elevator acknowledges queued requests and refuses groups over capacity") {
+    Scheduler<ElevatorEvent> floorNotifier(24);
+    Scheduler<ElevatorEvent> scheduler(23);
+    VirtualClock clock;
+    Elevator<ElevatorEvent> elevator(69, 2, clock);
+
+    struct tm timestamp = {};
+    ElevatorEvent group(timestamp, 1, "Up", 4, 7, "None");
+    group.requestId = 42;
+    elevator.handlePacket(scheduler.createData(group));
+    CHECK(floorNotifier.receiveClient() == std::vector<uint8_t>{0, MSG_NACK, 0, 42, 2, NACK_OVER_CAPACITY});
+
+    ElevatorEvent rider(timestamp, 3, "Up", 1, 2, "None");
+    rider.requestId = 300;
+    std::vector<uint8_t> ack = {0, MSG_ACK, 1, 44, 2};
+    elevator.handlePacket(scheduler.createData(rider));
+    CHECK(floorNotifier.receiveClient() == ack);
+    // A retransmission is acknowledged again but only served once.
+    elevator.handlePacket(scheduler.createData(rider));
+    CHECK(floorNotifier.receiveClient() == ack);
+    CHECK(elevator.serveUntilIdle() == std::vector<int>{3, 4});
+}
+
+TEST_CASE("A major fault strikes when the car reaches the call and its other riders are reported") {
+    Scheduler<ElevatorEvent> floorNotifier(24);
+    Scheduler<ElevatorEvent> scheduler(23);
+    VirtualClock clock;
+    Elevator<ElevatorEvent> elevator(69, 2, clock);
+
+    struct tm timestamp = {};
+    ElevatorEvent rider(timestamp, 2, "Up", 3, 1, "None");
+    ElevatorEvent faulted(timestamp, 3, "Up", 1, 1, "Major");
+    ElevatorEvent waiting(timestamp, 4, "Down", 1, 1, "None");
+    rider.requestId = 50;
+    faulted.requestId = 51;
+    waiting.requestId = 52;
+    for (ElevatorEvent* call : {&rider, &faulted, &waiting}) {
+        elevator.handlePacket(scheduler.createData(*call));
+        CHECK(floorNotifier.receiveClient() == std::vector<uint8_t>{0, MSG_ACK, 0, static_cast<uint8_t>(call->requestId), 2});
+    }
+    CHECK(elevator.getState() != ElevatorState::MajorFault);
+
+    // The car picks up at 2 and fails on reaching 3, with the first rider on board.
+    CHECK_THROWS_AS(elevator.serveUntilIdle(), std::runtime_error);
+    CHECK(elevator.getState() == ElevatorState::MajorFault);
+    CHECK(elevator.getCurrentFloor() == 3);
+    CHECK(floorNotifier.receiveClient() == std::vector<uint8_t>{0, MSG_PICKUP, 0, 50, 2});
+    CHECK(floorNotifier.receiveClient() == std::vector<uint8_t>{0, MSG_NACK, 0, 50, 2, NACK_STRANDED});
+    CHECK(floorNotifier.receiveClient() == std::vector<uint8_t>{0, MSG_NACK, 0, 51, 2, NACK_STRANDED});
+    CHECK(floorNotifier.receiveClient() == std::vector<uint8_t>{0, MSG_NACK, 0, 52, 2, NACK_OUT_OF_SERVICE});
+    CHECK(elevator.getQueuedCalls() == 0);
+
+    // The scheduler still has the acknowledged call that never started, and hands it on.
+    PendingRequests pending;
+    pending.track(waiting, 0, 0);
+    pending.acknowledge(waiting.requestId);
+    std::optional<PendingRequest> refused = pending.refuse(waiting.requestId, 0);
+    REQUIRE(refused.has_value());
+    CHECK(refused->event.floor == 4);
+    CHECK(pending.queued(0) == 0);
+}
+
+TEST_CASE("An idle car far away does not steal calls the owner is about to reach") {
+    Scheduler<ElevatorEvent> floorNotifier(24);
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, 4723);
+    dispatcher.addCar(2, 4724);
+    dispatcher.updateStatus(1, 4, Direction::Idle, ElevatorState::Idle);
+    PendingRequests pending;
+
+    // Three long trips booked against car 1, the last starting one floor from it.
+    std::vector<ElevatorEvent> calls = {
+        ElevatorEvent(0, 4, Direction::Up, 10, 1, FaultType::None),
+        ElevatorEvent(0, 6, Direction::Up, 10, 1, FaultType::None),
+        ElevatorEvent(0, 5, Direction::Up, 10, 1, FaultType::None)
+    };
+    for (ElevatorEvent& call : calls) {
+        dispatcher.assignTo(0, call, 0);
+        pending.track(call, 0, 0);
+    }
+    CHECK(dispatcher.estimateArrival(0, calls[2], 0) > Dispatcher::travelTime(20, 5));
+
+    handleStealRequest(&floorNotifier, &dispatcher, &pending, 2, 20);
+    CHECK(pending.queued(0) == 3);
+    CHECK_FALSE(pending.finishSteal(calls[2].requestId, true).has_value());
+
+    // An older call the thief is next to is still worth taking when the newest is not.
+    ElevatorEvent far(0, 21, Direction::Up, 1, 1, FaultType::None);
+    ElevatorEvent near(0, 3, Direction::Up, 1, 1, FaultType::None);
+    PendingRequests queue;
+    queue.track(far, 0, 0);
+    queue.track(near, 0, 0);
+    handleStealRequest(&floorNotifier, &dispatcher, &queue, 2, 20);
+    std::optional<std::pair<int, ElevatorEvent>> stolen = queue.finishSteal(far.requestId, true);
+    REQUIRE(stolen.has_value());
+    CHECK(stolen->first == 1);
+
+    // A thief that does not serve the floors of a call leaves it with its owner, however close.
+    dispatcher.registerCar(2, 4724, CAR_CAPACITY, 10, 30);
+    ElevatorEvent below(0, 19, Direction::Down, 15, 1, FaultType::None);
+    PendingRequests owned;
+    owned.track(below, 0, 0);
+    CHECK_FALSE(dispatcher.serves(1, below));
+    handleStealRequest(&floorNotifier, &dispatcher, &owned, 2, 20);
+    CHECK_FALSE(owned.finishSteal(below.requestId, true).has_value());
+    CHECK(owned.queued(0) == 1);
+}
+
+TEST_CASE("Dispatch under a virtual clock sees booked work run down") {
+    VirtualClock clock;
+    Scheduler<ElevatorEvent> floorNotifier(4752, clock);
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, 4753);
+    PendingRequests pending;
+    ElevatorEvent call(0, 5, Direction::Up, 2, 1, FaultType::None);
+    REQUIRE(dispatchRequest(&floorNotifier, &dispatcher, &pending, call));
+
+    // This thread never sleeps on the virtual clock, yet the booking still runs down.
+    ElevatorEvent next(0, 9, Direction::Up, 1, 1, FaultType::None);
+    long long booked = dispatcher.estimateArrival(0, next, floorNotifier.dispatchTime());
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(clock.now().count() == 0);
+    CHECK(dispatcher.estimateArrival(0, next, floorNotifier.dispatchTime()) <= booked - 50);
+
+    // The retransmit timer it started is on the same time base.
+    std::vector<PendingRequest> expired;
+    CHECK(pending.due(floorNotifier.dispatchTime() + RETRANSMIT_TIMEOUT_MS, expired).size() == 1);
+}
+
+TEST_CASE("Idle elevator steals an unstarted call from a car stuck in door recovery") {
+    Scheduler<ElevatorEvent> floorNotifier(24);
+    VirtualClock clock;
+    Elevator<ElevatorEvent> stuck(69, 1, clock);
+    Elevator<ElevatorEvent> idle(70, 2, clock);
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, 69);
+    dispatcher.addCar(2, 70);
+    dispatcher.updateStatus(1, 1, Direction::Idle, ElevatorState::MinorFault);
+    PendingRequests pending;
+
+    struct tm timestamp = {};
+    ElevatorEvent first(timestamp, 2, "Up", 1, 1, "None");
+    ElevatorEvent second(timestamp, 3, "Up", 1, 1, "None");
+    for (ElevatorEvent* call : {&first, &second}) {
+        sendToCar(&floorNotifier, &dispatcher, &pending, *call, 0);
+        stuck.handlePacket(stuck.receivePacket());
+        CHECK(handleElevatorReply(&floorNotifier, &dispatcher, &pending, floorNotifier.receiveClient()));
+    }
+    CHECK(pending.queued(0) == 2);
+
+    // Car 2 asks for work from floor 1 and is closer than the faulted car: the newest call moves.
+    std::vector<uint8_t> steal = {0, MSG_STEAL, 0, 0, 2, 0, 1};
+    CHECK(handleElevatorReply(&floorNotifier, &dispatcher, &pending, steal));
+    stuck.handlePacket(stuck.receivePacket());
+    std::vector<uint8_t> released = floorNotifier.receiveClient();
+    CHECK(released == std::vector<uint8_t>{0, MSG_RELEASED, 0, static_cast<uint8_t>(second.requestId), 1, 1});
+    CHECK(handleElevatorReply(&floorNotifier, &dispatcher, &pending, released));
+    idle.handlePacket(idle.receivePacket());
+    CHECK(handleElevatorReply(&floorNotifier, &dispatcher, &pending, floorNotifier.receiveClient()));
+
+    CHECK(pending.getCounters().stolen == 1);
+    CHECK(pending.queued(0) == 1);
+    CHECK(pending.queued(1) == 1);
+    CHECK(pending.size() == 0);
+    CHECK(stuck.serveUntilIdle() == std::vector<int>{2, 3});
+    CHECK(idle.serveUntilIdle() == std::vector<int>{3, 4});
+
+    // A call whose riders have boarded can no longer be revoked.
+    CHECK_FALSE(idle.revokeRequest(second.requestId));
+}
+
+TEST_CASE("Scheduler splits a group across cars that fit and tracks it until delivered") {
+    Scheduler<ElevatorEvent> floorNotifier(24);
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, 69, 4);
+    dispatcher.addCar(2, 70, 6);
+    dispatcher.updateStatus(1, 1, Direction::Idle, ElevatorState::Idle);
+    dispatcher.updateStatus(2, 10, Direction::Idle, ElevatorState::Idle);
+    PendingRequests pending;
+
+    struct tm timestamp = {};
+    ElevatorEvent group(timestamp, 1, "Up", 4, 21, "None");
+    CHECK(splitGroup(group, 6).size() == 4);
+    CHECK(dispatchRequest(&floorNotifier, &dispatcher, &pending, group));
+
+    // Three full trips only fit the big car; the last 3 go to the small car waiting at floor 1.
+    CHECK(pending.size() == 4);
+    CHECK(pending.queued(1) == 3);
+    CHECK(pending.queued(0) == 1);
+    CHECK(pending.openGroups() == 1);
+
+    std::optional<GroupProgress> progress;
+    for (int id = 1; id <= 4; id++) {
+        progress = pending.complete(id);
+        REQUIRE(progress.has_value());
+    }
+    CHECK(progress->delivered == 21);
+    CHECK(progress->finished());
+    CHECK(pending.openGroups() == 0);
+}
+
+TEST_CASE("Binary v2 requests carry tall towers and are forwarded in the version they arrived in") {
+    Scheduler<ElevatorEvent> scheduler(23);
+    Floor<ElevatorEvent> floor("elevator.txt");
+
+    std::vector<uint8_t> packet = floor.createData("14:05:09.25", "Down", 150, 120, 300, "Major");
+    CHECK(packet.size() == REQUEST_V2_SIZE);
+    ElevatorEvent event = ElevatorEvent::parseFromPacket(packet);
+    CHECK(event.wireVersion == WIRE_V2);
+    CHECK(event.timeMs == ((14 * 60 + 5) * 60 + 9) * 1000 + 250);
+    CHECK(event.floor == 150);
+    CHECK(event.floorButton == Direction::Down);
+    CHECK(event.floorsToMove == 120);
+    CHECK(event.passengers == 300);
+    CHECK(event.fault == FaultType::Major);
+
+    event.requestId = 513;
+    std::vector<uint8_t> forwarded = scheduler.createData(event);
+    CHECK(forwarded.size() == REQUEST_V2_SIZE);
+    CHECK(forwarded[14] == 1);
+    CHECK(forwarded[15] == 2);
+    CHECK(ElevatorEvent::parseFromPacket(forwarded).requestId == 513);
+
+    // A version 1 request stays version 1 unless a field no longer fits in two digits.
+    struct tm timestamp = {};
+    ElevatorEvent small(timestamp, 12, "Up", 3, 2, "None");
+    CHECK(scheduler.createData(small).size() == REQUEST_PACKET_SIZE);
+    small.floor = 120;
+    CHECK(scheduler.createData(small).size() == REQUEST_V2_SIZE);
+}
+
+TEST_CASE("Floor and Scheduler encode version 1 requests with the same field order") {
+    Scheduler<ElevatorEvent> scheduler(23);
+    Floor<ElevatorEvent> floor("elevator.txt", Clock::realTime(), ReplayOptions(), WIRE_V1);
+
+    std::vector<uint8_t> fromFloor = floor.createData("14:03:07.5", "Up", 12, 3, 7, "Minor");
+    std::vector<uint8_t> expected = {0, MSG_REQUEST, 1, 4, 0, 3, 0, 7, 5, 1, 2, 1, 0, 3, 0, 7, 1, 0, 0};
+    CHECK(fromFloor == expected);
+
+    ElevatorEvent event = ElevatorEvent::parseFromPacket(fromFloor);
+    CHECK(event.floorsToMove == 3);
+    CHECK(event.passengers == 7);
+    CHECK(scheduler.createData(event) == expected);
+
+    // The 17-byte packets from before request IDs still decode, unnumbered, on every path.
+    std::vector<uint8_t> baseline(expected.begin(), expected.begin() + REQUEST_V1_BASELINE_SIZE);
+    ElevatorEvent old = ElevatorEvent::parseFromPacket(baseline);
+    CHECK(old.floor == 12);
+    CHECK(old.requestId == 0);
+    CHECK(scheduler.createData(old) == expected);
+
+    std::vector<uint8_t> numbered = expected;
+    numbered[18] = 9;
+    const std::vector<uint8_t>* packets[] = { &baseline, &numbered, &baseline };
+    for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::Best }) {
+        DecodedRequest decoded[3];
+        CHECK(decodeRequestBatch(packets, 3, decoded, level) == 0);
+        CHECK(decoded[0].request.floor == 12);
+        CHECK(decoded[0].request.requestId == 0);
+        CHECK(decoded[1].request.requestId == 9);
+        CHECK(decoded[2].version == WIRE_V1);
+    }
+    std::vector<uint8_t> truncated(expected.begin(), expected.begin() + REQUEST_V1_BASELINE_SIZE - 1);
+    CHECK_FALSE(ElevatorEvent::isRequest(truncated));
+}
+
+TEST_CASE("ElevatorEvent is a 16-byte value built the same from text or enums") {
+    CHECK(sizeof(ElevatorEvent) <= 16);
+
+    struct tm timestamp = {};
+    timestamp.tm_hour = 14;
+    timestamp.tm_min = 2;
+    ElevatorEvent fromText(timestamp, 7, "Down", 3, 2, "Minor");
+    ElevatorEvent fromEnums((14 * 60 + 2) * 60 * 1000, 7, Direction::Down, 3, 2, FaultType::Minor);
+    CHECK(fromText.timeMs == fromEnums.timeMs);
+    CHECK(fromText.floor == fromEnums.floor);
+    CHECK(fromText.floorButton == fromEnums.floorButton);
+    CHECK(fromText.floorsToMove == fromEnums.floorsToMove);
+    CHECK(fromText.passengers == fromEnums.passengers);
+    CHECK(fromText.floorButton == Direction::Down);
+    CHECK(fromText.fault == FaultType::Minor);
+
+    // Unknown text falls back the way the trace parser always has: no fault.
+    CHECK(ElevatorEvent(timestamp, 7, "Up", 3, 2, "Sideways").fault == FaultType::None);
+}
+
+TEST_CASE("Shared-memory channel delivers every request from several senders") {
+    const int port = 4711;
+    ShmChannel::enable(port);
+    ChannelSocket receiver(port);
+
+    // Senders that finish early hand their ring to the next one, so keep the total within one ring.
+    const int senders = 3;
+    const int perSender = SHM_RING_SLOTS / senders;
+    std::vector<std::thread> threads;
+    for (int s = 0; s < senders; s++) {
+        threads.emplace_back([s] {
+            ChannelSocket socket;
+            for (int i = 0; i < perSender; i++) {
+                ElevatorEvent event(i * 100, s + 1, Direction::Up, 1, 1, FaultType::None);
+                event.requestId = s * perSender + i + 1;
+                std::vector<uint8_t> data = event.toPacket();
+                DatagramPacket packet(data, data.size(), InetAddress::getLocalHost(), port);
+                CHECK(socket.send(packet) == static_cast<ssize_t>(data.size()));
+            }
+        });
+    }
+
+    std::vector<int> lastSeen(senders, 0);
+    for (int n = 0; n < senders * perSender; n++) {
+        std::vector<uint8_t> buffer(REQUEST_PACKET_SIZE);
+        DatagramPacket packet(buffer, buffer.size());
+        receiver.receive(packet);
+        buffer.resize(packet.getLength());
+        ElevatorEvent event = ElevatorEvent::parseFromPacket(buffer);
+        // Each sender has its own ring, so its requests arrive in the order it sent them.
+        int sender = event.floor - 1;
+        CHECK(event.requestId == sender * perSender + lastSeen[sender] + 1);
+        lastSeen[sender]++;
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    CHECK(lastSeen == std::vector<int>(senders, perSender));
+
+    // Like a full UDP receive buffer, a full ring drops the message instead of blocking the sender.
+    ChannelSocket socket;
+    std::vector<uint8_t> data = ElevatorEvent(0, 1, Direction::Up, 1, 1, FaultType::None).toPacket();
+    DatagramPacket packet(data, data.size(), InetAddress::getLocalHost(), port);
+    for (int i = 0; i < SHM_RING_SLOTS; i++) {
+        socket.send(packet);
+    }
+    CHECK(socket.send(packet) == 0);
+}
+
+TEST_CASE("Shared-memory channel has one receiver and keeps what was sent before it started") {
+    const int port = 4714;
+    ShmChannel::enable(port);
+    std::vector<uint8_t> data = ElevatorEvent(0, 1, Direction::Up, 1, 1, FaultType::None).toPacket();
+    DatagramPacket packet(data, data.size(), InetAddress::getLocalHost(), port);
+    ChannelSocket sender;
+    CHECK(sender.send(packet) == static_cast<ssize_t>(data.size()));
+
+    {
+        ChannelSocket receiver(port);
+        CHECK_THROWS_AS(ChannelSocket(static_cast<in_port_t>(port)), std::runtime_error);
+        receiver.setSoTimeout(50);
+        std::vector<uint8_t> buffer(REQUEST_PACKET_SIZE);
+        DatagramPacket incoming(buffer, buffer.size());
+        CHECK(receiver.tryReceive(incoming));       // polled, as a floor polls its credit port
+        CHECK(incoming.getLength() == data.size());
+        CHECK_FALSE(receiver.tryReceive(incoming));
+        CHECK(sender.send(packet) == static_cast<ssize_t>(data.size()));
+        std::vector<DatagramPacket> batch(2, DatagramPacket(buffer, buffer.size()));
+        CHECK(receiver.tryReceiveBatch(batch) == 1);
+        CHECK(sender.send(packet) == static_cast<ssize_t>(data.size()));
+    }
+
+    // The receiver removed the region on the way out, so the next one starts empty.
+    ChannelSocket receiver(port);
+    receiver.setSoTimeout(50);
+    std::vector<uint8_t> buffer(REQUEST_PACKET_SIZE);
+    DatagramPacket incoming(buffer, buffer.size());
+    CHECK_FALSE(receiver.receive(incoming));
+}
+
+TEST_CASE("A sender in another process follows a shared-memory receiver that restarts") {
+    const int port = 4715;
+    ShmChannel::enable(port);
+    std::vector<uint8_t> data = ElevatorEvent(0, 1, Direction::Up, 1, 1, FaultType::None).toPacket();
+    std::vector<uint8_t> buffer(REQUEST_PACKET_SIZE);
+    DatagramPacket incoming(buffer, buffer.size());
+    std::unique_ptr<ChannelSocket> receiver(new ChannelSocket(port));
+    receiver->setSoTimeout(1000);
+
+    // The child maps the region once, then sends again after the receiver has been replaced.
+    int restarted[2];
+    REQUIRE(pipe(restarted) == 0);
+    pid_t child = fork();
+    if (child == 0) {
+        close(restarted[1]);
+        ChannelSocket sender;
+        DatagramPacket packet(data, data.size(), InetAddress::getLocalHost(), port);
+        sender.send(packet);
+        char go;
+        if (read(restarted[0], &go, 1) == 1) {
+            sender.send(packet);
+        }
+        _exit(0);
+    }
+    REQUIRE(child > 0);
+    close(restarted[0]);
+    CHECK(receiver->receive(incoming));
+    receiver.reset();
+    receiver.reset(new ChannelSocket(port));
+    receiver->setSoTimeout(1000);
+    CHECK(write(restarted[1], "x", 1) == 1);
+    CHECK(receiver->receive(incoming));
+    CHECK(incoming.getLength() == data.size());
+    close(restarted[1]);
+    int status = 0;
+    waitpid(child, &status, 0);
+}
+
+TEST_CASE_TEMPLATE("Floor, scheduler and elevator work over every transport", Transport,
+                   DatagramSocket, UnixDatagramSocket, InProcessSocket, UringDatagramSocket) {
+    Scheduler<ElevatorEvent, Transport> scheduler(FLOORREADER);
+    Scheduler<ElevatorEvent, Transport> floorNotifier(FLOORNOTIFIER);
+    VirtualClock clock;
+    Elevator<ElevatorEvent, Transport> elevator(ELEVATOR_1, 1, clock);
+    Floor<ElevatorEvent, Transport> floor("elevator.txt");
+    Dispatcher dispatcher;
+    dispatcher.addCar(1, ELEVATOR_1);
+    PendingRequests pending;
+
+    std::vector<uint8_t> request = floor.createData("14:05:15.0", "Up", 2, 3, 1, "None");
+    floor.sendPacket(request, request.size(), InetAddress::getLocalHost(), FLOORREADER);
+    ElevatorEvent event = scheduler.processData(scheduler.receiveClient());
+    CHECK(event.floor == 2);
+
+    CHECK(dispatchRequest(&floorNotifier, &dispatcher, &pending, event));
+    elevator.handlePacket(elevator.receivePacket());
+    CHECK(handleElevatorReply(&floorNotifier, &dispatcher, &pending, floorNotifier.receiveClient()));
+    CHECK(pending.getCounters().acked == 1);
+    CHECK(elevator.serveUntilIdle() == std::vector<int>{2, 5});
+}
+
+TEST_CASE("Scheduler event loop dispatches a request and takes the ACK for its bank") {
+    CHECK_THROWS_AS(runSchedulerReactor(Clock::realTime(), 0, MAX_BANKS + 1), std::runtime_error);
+
+    // Only ports with a descriptor can join the loop; shared-memory and in-process ones have none.
+    ShmChannel::enable(4716);
+    CHECK_FALSE(canPoll<ChannelSocket>(4716));
+    CHECK(canPoll<ChannelSocket>(4717));
+    CHECK(canPoll<UnixDatagramSocket>(4717));
+    CHECK(reactorCanPoll<DatagramSocket>(MAX_BANKS));
+    CHECK_FALSE(reactorCanPoll<InProcessSocket>(1));
+    CHECK_THROWS_AS(runSchedulerReactor<InProcessSocket>(Clock::realTime(), 0, 1), std::runtime_error);
+
+    Scheduler<ElevatorEvent> requests(FLOORREADER);
+    Dispatcher dispatcher;
+    dispatcher.addCar(2, ELEVATOR_2);
+    PendingRequests pending;
+    SchedulerReactor<> reactor(requests, 1, dispatcher, pending, Clock::realTime());
+    VirtualClock clock;
+    Elevator<ElevatorEvent> elevator(ELEVATOR_2, 2, clock);
+    elevator.reportToBank(1);
+
+    Floor<ElevatorEvent> floor("elevator.txt");
+    std::vector<uint8_t> request = floor.createData("14:05:15.0", "Up", 2, 3, 1, "None");
+    floor.sendPacket(request, request.size(), InetAddress::getLocalHost(), FLOORREADER);
+    CHECK(reactor.poll(1000) >= 1);
+    CHECK(pending.getCounters().sent == 1);
+
+    elevator.handlePacket(elevator.receivePacket());
+    while (pending.getCounters().acked == 0 && reactor.poll(1000) > 0) {}
+    CHECK(pending.getCounters().acked == 1);
+    CHECK(pending.size() == 0);
+}
+
+TEST_CASE("Batched send and receive move several datagrams per call") {
+    Scheduler<ElevatorEvent> scheduler(FLOORREADER);
+    Floor<ElevatorEvent> floor("elevator.txt");
+
+    std::vector<std::vector<uint8_t>> requests;
+    std::vector<DatagramPacket> packets;
+    for (int floorNumber = 1; floorNumber <= 5; floorNumber++) {
+        requests.push_back(floor.createData("14:05:15.0", "Up", floorNumber, 3, 1, "None"));
+    }
+    for (std::vector<uint8_t>& request : requests) {
+        packets.emplace_back(request, request.size(), InetAddress::getLocalHost(), FLOORREADER);
+    }
+    DatagramSocket sender;
+    CHECK(sender.sendBatch(packets) == 5);
+
+    std::vector<int> floors;
+    while (floors.size() < 5) {
+        for (const PooledBuffer& packet : scheduler.receiveClients()) {
+            CHECK(packet->size() == requests[0].size());
+            floors.push_back(scheduler.processData(*packet).floor);
+        }
+    }
+    CHECK(floors == std::vector<int>{1, 2, 3, 4, 5});
+    CHECK(scheduler.tryReceiveClients().empty());
+}
+
+TEST_CASE("Receive buffers come from a fixed pool and oversized datagrams are dropped") {
+    BufferPool pool(2, 8);
+    {
+        PooledBuffer first = pool.acquire();
+        PooledBuffer second = std::move(first);
+        CHECK_FALSE(first);
+        PooledBuffer third = pool.acquire();
+        CHECK_THROWS_AS(pool.acquire(), std::runtime_error);
+        second.setLength(3);
+        CHECK(second->size() == 3);
+        CHECK(second.fill().size() == 8);
+    }
+    CHECK(pool.acquire()->size() == 8);
+
+    Scheduler<ElevatorEvent> scheduler(FLOORREADER);
+    Floor<ElevatorEvent> floor("elevator.txt");
+    std::vector<uint8_t> oversized(POOL_BUFFER_BYTES + 1, 0);
+    floor.sendPacket(oversized, oversized.size(), InetAddress::getLocalHost(), FLOORREADER);
+    std::vector<uint8_t> request = floor.createData("14:05:15.0", "Up", 2, 3, 1, "None");
+    floor.sendPacket(request, request.size(), InetAddress::getLocalHost(), FLOORREADER);
+
+    CHECK(scheduler.receiveClient() == request);
+    CHECK(scheduler.getTruncatedCount() == 1);
+}
+
+TEST_CASE_TEMPLATE("A receive timeout returns nothing instead of blocking", Transport,
+                   DatagramSocket, UnixDatagramSocket, InProcessSocket, ChannelSocket, UringDatagramSocket) {
+    ShmChannel::enable(4712);       // ChannelSocket on this port goes through shared memory
+    Scheduler<ElevatorEvent, Transport> receiver(4712);
+    receiver.setReceiveTimeout(50);
+
+    auto start = std::chrono::steady_clock::now();
+    CHECK(receiver.receiveClient().empty());
+    CHECK(receiver.receiveClients().empty());
+    auto waited = std::chrono::steady_clock::now() - start;
+    CHECK(waited >= std::chrono::milliseconds(90));
+    CHECK(waited < std::chrono::seconds(2));
+    CHECK(receiver.getReceiveErrorCount() == 0);
+
+    std::vector<uint8_t> message = {0, MSG_ACK, 0, 7, 1};
+    receiver.sendPacket(message, message.size(), InetAddress::getLocalHost(), 4712);
+    CHECK(receiver.receiveClient() == message);
+}
+
+TEST_CASE("The io_uring transport falls back to recvfrom and sendto when switched off") {
+    setenv("ELEVATOR_URING", "off", 1);
+    UringDatagramSocket receiver(4713);
+    UringDatagramSocket sender;
+    unsetenv("ELEVATOR_URING");
+    CHECK_FALSE(receiver.usesRing());
+    CHECK_FALSE(sender.usesRing());
+    CHECK(receiver.fd() >= 0);
+
+    std::vector<uint8_t> message = {0, MSG_ACK, 0, 7, 1};
+    DatagramPacket outgoing(message, message.size(), InetAddress::getLocalHost(), 4713);
+    CHECK(sender.send(outgoing) == 5);
+    std::vector<uint8_t> data(POOL_BUFFER_BYTES);
+    DatagramPacket incoming(data, data.size());
+    CHECK(receiver.receive(incoming));
+    CHECK(std::vector<uint8_t>(data.begin(), data.begin() + incoming.getLength()) == message);
+}
+
+TEST_CASE("Request batches are decoded with a bitmask of malformed packets instead of exceptions") {
+    Floor<ElevatorEvent> floor("elevator.txt");
+    WireRequest request;
+    request.timeMs = 50715000;
+    request.floor = 2;
+    request.floorsToMove = 3;
+    request.passengers = 1;
+    request.up = 1;
+    std::vector<uint8_t> valid = encodeRequest(request, WIRE_V1);
+    WireRequest wide;
+    wide.timeMs = 50000123;
+    wide.floor = 300;
+    wide.passengers = 4;
+    wide.up = 1;
+    std::vector<uint8_t> v2 = encodeRequest(wide, WIRE_V2);
+
+    std::vector<std::vector<uint8_t>> packets(9, valid);
+    packets[1] = v2;
+    packets[2][10] = 10;                    // floor ones digit out of range
+    packets[3][2] = 2;                      // hour 24
+    packets[3][3] = 4;
+    packets[4][1] = MSG_ACK;
+    packets[5].resize(REQUEST_PACKET_SIZE - 1);
+    packets[6] = v2;
+    packets[6][3] = 0xFF;                   // flags outside up | fault
+    packets[7][16] = 3;                     // no such fault
+    packets[8][4] = 6;                      // minute 60
+
+    std::vector<const std::vector<uint8_t>*> bytes;
+    for (std::vector<uint8_t>& packet : packets) {
+        bytes.push_back(&packet);
+    }
+    for (int level = 0; level <= static_cast<int>(bestSimdLevel()); level++) {
+        CAPTURE(level);
+        std::vector<DecodedRequest> decoded(packets.size());
+        uint64_t invalid = decodeRequestBatch(bytes.data(), bytes.size(), decoded.data(), static_cast<SimdLevel>(level));
+        CHECK(invalid == 0b111111100);
+        CHECK(ElevatorEvent::fromWire(decoded[0].request, decoded[0].version).toPacket() == valid);
+        CHECK(decoded[1].version == WIRE_V2);
+        CHECK(decoded[1].request.timeMs == wide.timeMs);
+        CHECK(decoded[1].request.floor == 300);
+    }
+
+    Scheduler<ElevatorEvent> scheduler(FLOORREADER);
+    for (const std::vector<uint8_t>& packet : {valid, packets[2], v2}) {
+        floor.sendPacket(packet, packet.size(), InetAddress::getLocalHost(), FLOORREADER);
+    }
+    std::vector<ElevatorEvent> events;
+    std::vector<ElevatorEvent> received;
+    while (received.size() + scheduler.getMalformedCount() < 3) {
+        scheduler.processBatch(scheduler.receiveClients(), events);
+        received.insert(received.end(), events.begin(), events.end());
+    }
+    REQUIRE(received.size() == 2);
+    CHECK(received[0].floor == 2);
+    CHECK(received[1].floor == 300);
+    CHECK(scheduler.getMalformedCount() == 1);
+
+    // Requests arriving on the reply ports go through the same decoder, one at a time.
+    ElevatorEvent event;
+    CHECK(scheduler.tryDecodeRequest(valid, event));
+    CHECK(event.floor == 2);
+    CHECK_FALSE(scheduler.tryDecodeRequest(packets[3], event));
+    CHECK_FALSE(scheduler.tryDecodeRequest({}, event));
+    CHECK(scheduler.getMalformedCount() == 3);
+}
+
+TEST_CASE_TEMPLATE("Floors send only against credits the scheduler grants and return what they do not use", Transport,
+                   DatagramSocket, ChannelSocket) {
+    ShmChannel::enable(4720);       // ChannelSocket takes grants through shared memory
+    Scheduler<ElevatorEvent, Transport> scheduler(FLOORREADER);
+    scheduler.enableFloorCredits(5);
+    scheduler.setReceiveTimeout(100);
+    ReplayOptions replay;
+    replay.creditPort = 4720;
+    Floor<ElevatorEvent, Transport> floor("elevator.txt", Clock::realTime(), replay);
+    std::thread floorThread(std::ref(floor));
+
+    // The trace has 12 requests: two full windows of 5, then 2 of a third grant of 5.
+    std::vector<ElevatorEvent> events;
+    int received = 0;
+    for (int window = 0; window < 3; window++) {
+        int inWindow = 0;
+        for (int quiet = 0; quiet < 3;) {
+            scheduler.processBatch(scheduler.receiveClients(), events);
+            inWindow += events.size();
+            quiet = events.empty() ? quiet + 1 : 0;
+        }
+        CHECK(inWindow == (window < 2 ? 5 : 2));
+        if (window < 2) {
+            CHECK(scheduler.getAvailableCredits() == 0);
+        }
+        received += inWindow;
+        scheduler.requestsTaken(inWindow);
+    }
+    floorThread.join();
+
+    for (int wait = 0; wait < 20 && scheduler.getAvailableCredits() < 5; wait++) {
+        scheduler.processBatch(scheduler.receiveClients(), events);
+        CHECK(events.empty());
+    }
+    CHECK(scheduler.getAvailableCredits() == 5);
+    CHECK(received == 12);
+    CHECK(scheduler.getMalformedCount() == 0);
+}
+
+TEST_CASE("Credits in a lost grant are made up by the next grant or the floor's next ask") {
+    FloorCredits credits(4);
+    std::vector<CreditGrant> grants;
+    CHECK(credits.handle(creditRequestPacket(4725, 0), grants));
+    REQUIRE(grants.size() == 1);
+    CHECK(grants[0].total == 4);
+
+    // That grant never arrives: the floor asks again, still at 0, and is sent the total again.
+    grants.clear();
+    credits.handle(creditRequestPacket(4725, 0), grants);
+    REQUIRE(grants.size() == 1);
+    CHECK(newCredits(grants[0].total, 0) == 4);
+    CHECK(newCredits(grants[0].total, 4) == 0);         // the first copy turning up late adds nothing
+
+    // The floor spends them; the next grant counts on from 4.
+    grants.clear();
+    credits.handle(creditRequestPacket(4725, 4), grants);
+    CHECK(grants.empty());
+    credits.consumed(4, true, grants);
+    REQUIRE(grants.size() == 1);
+    CHECK(grants[0].total == 8);
+    CHECK(newCredits(grants[0].total, 0) == 8);         // a floor that missed both grants gets both
+    CHECK(newCredits(2, 65534) == 4);                   // totals wrap around
+    CHECK(credits.getAvailable() == 0);
+}
+
+TEST_CASE("Socket stats report kernel drops per port and the scheduler's queue high-water mark") {
+    std::string table = "/tmp/elevator_test_udp";
+    std::ofstream(table) << "   sl  local_address rem_address   st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode ref pointer drops\n"
+                         << "   12: 0100007F:0017 00000000:0000 07 00000000:00000300 00:00000000 00000000     0        0 1 2 0000000000000000 5\n"
+                         << "   13: 00000000:0017 00000000:0000 07 00000000:00000000 00:00000000 00000000     0        0 2 2 0000000000000000 2\n"
+                         << "   14: 0100007F:01D7 00000000:0000 07 00000000:00000000 00:00000000 00000000     0        0 3 2 0000000000000000 0\n";
+    std::map<int, UdpPortStats> parsed = readUdpStats({ table, "/nonexistent" });
+    std::remove(table.c_str());
+    REQUIRE(parsed.count(23) == 1);
+    CHECK(parsed[23].sockets == 2);
+    CHECK(parsed[23].drops == 7);
+    CHECK(parsed[23].queuedBytes == 0x300);
+    CHECK(parsed[471].drops == 0);
+
+    // A socket nobody reads overflows its receive buffer, and the kernel counts what it drops.
+    DatagramSocket unread(4730);
+    DatagramSocket sender;
+    std::vector<uint8_t> request(REQUEST_V2_SIZE, 1);
+    DatagramPacket packet(request, request.size(), InetAddress::getLocalHost(), 4730);
+    for (int i = 0; i < 5000; i++) {
+        sender.send(packet);
+    }
+    std::map<int, UdpPortStats> live = readUdpStats();
+    REQUIRE(live.count(SocketStats::kernelPort(4730)) == 1);
+    UdpPortStats unreadStats = live[SocketStats::kernelPort(4730)];
+    CHECK(unreadStats.drops > 0);
+    CHECK(unreadStats.queuedBytes > 0);
+
+    SocketStats stats({ 4730, 4731 });
+    stats.addGauge("test", [] { return std::string("gauge"); });
+    std::ostringstream first;
+    stats.print(first);
+    CHECK(first.str().find("[Stats] port 4730: " + std::to_string(unreadStats.drops)) == 0);
+    CHECK(first.str().find("(+0)") != std::string::npos);
+    CHECK(first.str().find("[Stats] port 4731: not bound") != std::string::npos);
+    CHECK(first.str().find("[Stats] test: gauge") != std::string::npos);
+    sender.send(packet);
+    std::ostringstream second;
+    stats.print(second);
+    CHECK(second.str().find("(+1)") != std::string::npos);
+
+    // A shared-memory port's count is read without creating its region, and starts over when a
+    // new receiver binds it; the drops since the last print are then all of the new count.
+    ShmChannel::enable(4733);
+    CHECK(ShmChannel::droppedCount(4733) == 0);
+    CHECK(shm_open(ShmChannel::regionName(4733).c_str(), O_RDONLY, 0) < 0);
+    SocketStats shmStats({ 4733 });
+    {
+        ChannelSocket receiver(4733);
+        ChannelSocket shmSender;
+        DatagramPacket shmPacket(request, request.size(), InetAddress::getLocalHost(), 4733);
+        for (int i = 0; i <= SHM_RING_SLOTS + 2; i++) {
+            shmSender.send(shmPacket);
+        }
+        CHECK(ShmChannel::droppedCount(4733) == 3);
+        std::ostringstream filled;
+        shmStats.print(filled);
+        CHECK(filled.str().find("3 dropped (+0)") != std::string::npos);
+    }
+    ChannelSocket rebound(4733);
+    std::ostringstream restarted;
+    shmStats.print(restarted);
+    CHECK(restarted.str().find("0 dropped (+0)") != std::string::npos);
+
+    Scheduler<ElevatorEvent> scheduler(4732);
+    struct tm timestamp = {};
+    for (int floor = 2; floor <= 4; floor++) {
+        scheduler.put(ElevatorEvent(timestamp, floor, "Up", 1, 0, "None"));
+    }
+    scheduler.get();
+    CHECK(scheduler.getQueueDepth() == 2);
+    CHECK(scheduler.getQueueHighWater() == 3);
+    CHECK(scheduler.describeQueue().find("depth 2, high water 3, 0 overflowed") == 0);
+}
+
+TEST_CASE("Ingress workers share the request port, each floor's requests reaching one of them in order") {
+    CHECK(canSharePort<DatagramSocket>(4741));
+    CHECK(canSharePort<UringDatagramSocket>(4741));
+    CHECK_FALSE(canSharePort<InProcessSocket>(4741));
+    CHECK_FALSE(canSharePort<UnixDatagramSocket>(4741));
+
+    Scheduler<ElevatorEvent, DatagramSocket> scheduler(4741, Clock::realTime(), true);
+    std::unique_ptr<DatagramSocket> second = scheduler.shareClientPort();
+    CHECK_THROWS_AS(DatagramSocket(4741), std::runtime_error);     // a socket without SO_REUSEPORT cannot join
+    CHECK_THROWS_AS((Scheduler<ElevatorEvent, DatagramSocket>(4741, Clock::realTime(), true)), std::runtime_error);  // nor a second scheduler
+    scheduler.setReceiveTimeout(100);
+    second->setSoTimeout(100);
+
+    // Sixteen floors, each sending floors 1..3 from a socket of its own.
+    Floor<ElevatorEvent> floor("elevator.txt");
+    std::vector<std::unique_ptr<DatagramSocket>> floors;
+    for (int sender = 0; sender < 16; sender++) {
+        floors.emplace_back(new DatagramSocket());
+        for (int level = 1; level <= 3; level++) {
+            std::vector<uint8_t> request = floor.createData("14:05:15.0", "Up", sender * 10 + level, 1, 1, "None");
+            DatagramPacket packet(request, request.size(), InetAddress::getLocalHost(), 4741);
+            floors.back()->send(packet);
+        }
+    }
+
+    BufferPool buffers;
+    BufferBatch batch(buffers);
+    std::vector<ElevatorEvent> events;
+    std::map<int, std::vector<int>> first;
+    std::map<int, std::vector<int>> other;
+    for (std::vector<PooledBuffer>* packets = &scheduler.receiveClients(); !packets->empty(); packets = &scheduler.receiveClients()) {
+        scheduler.processBatch(*packets, events);
+        for (const ElevatorEvent& event : events) {
+            first[event.floor / 10].push_back(event.floor % 10);
+        }
+    }
+    for (std::vector<PooledBuffer>* packets = &scheduler.receiveClients(*second, batch); !packets->empty();
+         packets = &scheduler.receiveClients(*second, batch)) {
+        scheduler.processBatch(*packets, events);
+        for (const ElevatorEvent& event : events) {
+            other[event.floor / 10].push_back(event.floor % 10);
+        }
+    }
+    CHECK(first.size() + other.size() == 16);
+    CHECK_FALSE(first.empty());         // the kernel hashes senders across sockets; all 16 on one is 1 in 32768
+    CHECK_FALSE(other.empty());
+    for (auto* socket : { &first, &other }) {
+        for (auto& [sender, levels] : *socket) {
+            CHECK(levels == std::vector<int>{1, 2, 3});
+        }
+    }
+}
+
+TEST_CASE("Elevators register their port and floors, and floors wait until the fleet is in") {
+    Dispatcher dispatcher;
+    CHECK(dispatcher.registerCar(7, 4730, 5, 1, 10) == 0);
+    CHECK(dispatcher.registerCar(8, 4731, 5, 11, 20) == 1);
+    CHECK(dispatcher.assign(ElevatorEvent(0, 15, Direction::Up, 2, 1, FaultType::None), 0) == 1);
+    CHECK(dispatcher.assign(ElevatorEvent(0, 25, Direction::Up, 2, 1, FaultType::None), 0) == -1);
+    CHECK(dispatcher.registerCar(7, 4732, 5, 1, 10) == 0);      // a restarted car keeps its place
+    CHECK(dispatcher.size() == 2);
+    CHECK(dispatcher.getCar(0).port == 4732);
+
+    // A car on a port the kernel picks tells the scheduler where to reach it.
+    Scheduler<ElevatorEvent> status(ELEVATOR_STATUS + 47 * BANK_PORT_STRIDE);
+    status.setReceiveTimeout(100);
+    Elevator<ElevatorEvent> elevator(0, 3);
+    elevator.reportToBank(47);
+    elevator.serveFloors(2, 9);
+    Dispatcher fleet;
+    std::thread registering([&] { CHECK(elevator.registerWithScheduler(20)); });
+    for (int wait = 0; wait < 20 && fleet.size() == 0; wait++) {
+        for (const PooledBuffer& packet : status.receiveClients()) {
+            handleRegistration(&status, &fleet, *packet);
+        }
+    }
+    registering.join();
+    REQUIRE(fleet.size() == 1);
+    CHECK(elevator.getPort() != 0);
+    CHECK(fleet.getCar(0).port == elevator.getPort());
+    CHECK(fleet.getCar(0).capacity == CAR_CAPACITY);
+    CHECK(fleet.getCar(0).lowestFloor == 2);
+    CHECK(fleet.getCar(0).highestFloor == 9);
+
+    // Transports with no ports of their own to hand out refuse port 0 rather than all share it.
+    ReplayOptions readiness;
+    readiness.waitForReady = true;
+    CHECK_THROWS_AS((Elevator<ElevatorEvent, InProcessSocket>(0, 5)), std::runtime_error);
+    CHECK_THROWS_AS((Floor<ElevatorEvent, InProcessSocket>("elevator.txt", Clock::realTime(), readiness)), std::runtime_error);
+
+    // The scheduler stays silent to a floor's queries until its second car is in.
+    Scheduler<ElevatorEvent> scheduler(FLOORREADER);
+    scheduler.setReceiveTimeout(100);
+    scheduler.expectCars({ &fleet }, 2);
+    ReplayOptions replay;
+    replay.waitForReady = true;
+    Floor<ElevatorEvent> floor("elevator.txt", Clock::realTime(), replay);
+    CHECK(floor.waitForScheduler(2) == -1);
+    std::atomic<int> ready{-1};
+    std::thread waiting([&] { ready = floor.waitForScheduler(); });
+    std::vector<ElevatorEvent> events;
+    for (int wait = 0; wait < 10; wait++) {
+        scheduler.processBatch(scheduler.receiveClients(), events);
+        CHECK(events.empty());
+    }
+    CHECK(ready == -1);
+    fleet.registerCar(4, 4733, 5, 1, TOP_FLOOR);
+    for (int wait = 0; wait < 50 && ready == -1; wait++) {
+        scheduler.processBatch(scheduler.receiveClients(), events);
+    }
+    waiting.join();
+    CHECK(ready == 2);
+    CHECK(scheduler.getMalformedCount() == 0);
+}
+
 TEST_CASE ("Testing Capacity Limit (Overflow (5ppl))") {
     Scheduler<ElevatorEvent> scheduler(23);
     Scheduler<ElevatorEvent> floorNotifier(24);
@@ -205,4 +1303,97 @@ TEST_CASE ("Testing Capacity Limit (Overflow (5ppl))") {
     CHECK(elevator.getState() == ElevatorState::Idle);
 
     elevatorThread.join();  
-}
\ No newline at end of file
+}
+TEST_CASE("Elevator in virtual time moves without waiting on the wall clock") {
+    VirtualClock clock;
+    Elevator<ElevatorEvent> elevator(69, 1, clock);
+
+    auto start = std::chrono::steady_clock::now();
+    elevator.moveToFloor(5);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    CHECK(elevator.getCurrentFloor() == 5);
+    CHECK(clock.now() == std::chrono::seconds(4));
+    CHECK(elapsed < std::chrono::seconds(1));
+}
+
+TEST_CASE("Floor replays trace lines at their recorded offsets") {
+    const std::string trace = "replay_trace.txt";
+    std::ofstream out(trace);
+    out << "14:00:00.0  1   Up     4   2    None\n"
+        << "14:00:30.0  3   Down   2   1    None\n"
+        << "14:01:00.0  5   Up     1   1    None\n"
+        << "14:01:00.0  6   Up     1   1    None\n"
+        << "14:01:00.0  2   Up     3   1    None\n";
+    out.close();
+
+    CHECK(Floor<ElevatorEvent>::parseTime("14:01:00.5") - Floor<ElevatorEvent>::parseTime("14:00:00.0") == 60500);
+
+    VirtualClock clock;
+    ReplayOptions replay;
+    replay.paced = true;
+    replay.speed = 2.0;
+    replay.maxBurst = 2;
+    Floor<ElevatorEvent> floor(trace, clock, replay);
+    floor();
+
+    // 60 s of trace at double speed, plus one gap for the three requests recorded at 14:01:00
+    CHECK(clock.now() == std::chrono::seconds(30) + replay.burstGap);
+    std::remove(trace.c_str());
+
+    replay.speed = 0;
+    CHECK_THROWS_AS(Floor<ElevatorEvent>(trace, clock, replay), std::runtime_error);
+    replay.speed = -1;
+    CHECK_THROWS_AS(Floor<ElevatorEvent>(trace, clock, replay), std::runtime_error);
+}
+
+TEST_CASE("Simulation steps a car through the same states as Elevator::processRequest") {
+    Simulation simulation(1);
+    std::vector<ElevatorState> actualStates;
+    simulation.setObserver([&](const SimCar& car, long long) { actualStates.push_back(car.state); });
+    simulation.addRequest(0, Simulation::makeEvent(0, 6, "Down", 1, 0, "None"));
+
+    SimStats stats = simulation.run();
+
+    std::vector<ElevatorState> expectedStates = {
+        ElevatorState::MovingUp,
+        ElevatorState::DoorOpening, ElevatorState::DoorOpen,
+        ElevatorState::DoorClosing, ElevatorState::Idle, ElevatorState::MovingDown,
+        ElevatorState::DoorOpening, ElevatorState::DoorOpen,
+        ElevatorState::DoorClosing, ElevatorState::Idle
+    };
+    CHECK(actualStates == expectedStates);
+    CHECK(stats.completed == 1);
+    CHECK(simulation.getCars()[0].currentFloor == 5);
+    // 5 floors up, a door cycle, 1 floor down, a door cycle, then the rest before the next task
+    CHECK(stats.endTime == 5 * SIM_FLOOR_TIME + 3 * SIM_DOOR_TIME + SIM_FLOOR_TIME + 3 * SIM_DOOR_TIME + SIM_REST_TIME);
+
+    // An observer added after useDispatcher() runs alongside the dispatcher's, not instead of it.
+    Simulation dispatched(1);
+    Dispatcher dispatcher;
+    dispatched.useDispatcher(dispatcher);
+    int changes = 0;
+    dispatched.setObserver([&](const SimCar&, long long) { changes++; });
+    dispatched.addRequest(0, Simulation::makeEvent(0, 6, "Down", 1, 0, "None"));
+    dispatched.run();
+    CHECK(changes == static_cast<int>(expectedStates.size()));
+    CHECK(dispatcher.getCar(0).floor == 5);
+}
+
+TEST_CASE("Simulation skips a long run of unservable requests and drops out-of-range car indices") {
+    int calls = 0;
+    Simulation simulation(1, [&calls](const ElevatorEvent&, const std::vector<SimCar>&, long long) {
+        return calls++ == 1 ? 7 : 0;       // the second request goes to a car that does not exist
+    });
+    simulation.addRequest(0, Simulation::makeEvent(0, 2, "Up", 1, 1, "None"));
+    simulation.addRequest(0, Simulation::makeEvent(0, 2, "Up", 1, 1, "None"));
+    for (int i = 0; i < 200000; i++) {
+        simulation.addRequest(0, Simulation::makeEvent(0, 3, "Up", 1, SIM_CAR_CAPACITY + 1, "None"));
+    }
+    simulation.addRequest(0, Simulation::makeEvent(0, 4, "Up", 1, 1, "None"));
+
+    SimStats stats = simulation.run();
+    CHECK(stats.completed == 2);
+    CHECK(stats.lost == 1);
+    CHECK(stats.overCapacity == 200000);
+}
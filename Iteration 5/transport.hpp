@@ -0,0 +1,417 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Datagram1.h"
+#include "ring_queue.hpp"
+#include "shm_channel.hpp"
+#include "uring_socket.hpp"
+
+// A transport is anything with the DatagramSocket interface:
+//   Transport()                       send-only
+//   Transport(in_port_t port)         bound to `port`, can also receive
+//   ssize_t send(DatagramPacket&)     delivers to packet.getPort(); 0 if the message was dropped
+//   void setSoTimeout(int ms)         bounds the wait in receive and receiveBatch; 0 waits for ever
+//   bool receive(DatagramPacket&)     waits for the next message, setting the packet length; false on timeout
+//   int receiveBatch(std::vector<DatagramPacket>&)      up to DATAGRAM_BATCH_MAX at once, waiting for the first
+//   int tryReceiveBatch(std::vector<DatagramPacket>&)   the same without blocking
+//   int sendBatch(std::vector<DatagramPacket>&)         sends every packet, each to its own port
+//   in_port_t localPort()             the port bound; port 0 has UDP pick a free one and stays 0 elsewhere
+// Socket-backed transports also have fd() and a non-blocking tryReceive() for the event loop
+// (see canPoll), and a static bool canPoll(int port) if some of their ports have no descriptor.
+// UDP-backed ones can also bind one port several times (see SharesPorts):
+//   Transport(in_port_t port, bool reusePort)   with SO_REUSEPORT; each sender sticks to one socket
+//   static bool canSharePort(int port)          false where the port is carried another way
+// Endpoints are the port numbers in scheduler.hpp. Backends that do not use IP ignore the address.
+//
+// Backends: DatagramSocket (UDP), ChannelSocket (UDP, or shared memory for the ports listed in
+// ELEVATOR_SHM_CHANNELS), UringDatagramSocket (UDP through io_uring), UnixDatagramSocket (AF_UNIX,
+// same host) and InProcessSocket (threads of one process). Build with
+// -DELEVATOR_TRANSPORT=<backend> to change the default.
+#ifndef ELEVATOR_TRANSPORT
+#define ELEVATOR_TRANSPORT ChannelSocket
+#endif
+
+// Whether Transport can bind one port with several sockets.
+template <typename Transport, typename = void>
+struct SharesPorts : std::false_type {};
+
+template <typename Transport>
+struct SharesPorts<Transport, std::void_t<decltype(Transport::canSharePort(0))>> : std::true_type {};
+
+template <typename Transport>
+bool canSharePort(int port) {
+    if constexpr (SharesPorts<Transport>::value) {
+        return Transport::canSharePort(port);
+    } else {
+        return false;
+    }
+}
+
+// Whether Transport has descriptors an event loop can wait on.
+template <typename Transport, typename = void>
+struct PollsPorts : std::false_type {};
+
+template <typename Transport>
+struct PollsPorts<Transport, std::void_t<decltype(std::declval<const Transport&>().fd())>> : std::true_type {};
+
+template <typename Transport, typename = void>
+struct PollsSomePorts : std::false_type {};
+
+template <typename Transport>
+struct PollsSomePorts<Transport, std::void_t<decltype(Transport::canPoll(0))>> : std::true_type {};
+
+// Whether a Transport bound to `port` has a descriptor for an event loop.
+template <typename Transport>
+bool canPoll(int port) {
+    if constexpr (PollsSomePorts<Transport>::value) {
+        return Transport::canPoll(port);
+    } else {
+        return PollsPorts<Transport>::value;
+    }
+}
+
+#define UNIX_SEND_TIMEOUT_MS 100        // a full receiver queue blocks the sender this long, then drops
+#define INPROCESS_QUEUE_CAPACITY 1024   // messages waiting per in-process port
+#define INPROCESS_MESSAGE_BYTES 64      // largest in-process message
+
+// Datagram socket in the abstract AF_UNIX namespace, one name per port, so processes on one host
+// talk without the IP stack and no socket files are left behind.
+class UnixDatagramSocket {
+private:
+    int socket_fd;
+    in_port_t bound = 0;
+
+    static socklen_t addressOf(in_port_t port, sockaddr_un& address) {
+        std::string name = "elevator_" + std::to_string(port);
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path + 1, name.data(), name.size());     // sun_path[0] == 0: abstract name
+        return offsetof(sockaddr_un, sun_path) + 1 + name.size();
+    }
+
+public:
+    UnixDatagramSocket() : socket_fd(socket(AF_UNIX, SOCK_DGRAM, 0)) {
+        if (socket_fd < 0) {
+            throw std::runtime_error(std::string("socket creation failed: ") + strerror(errno));
+        }
+        // The kernel queues only a few datagrams per AF_UNIX receiver (net.unix.max_dgram_qlen), so
+        // wait briefly for room instead of dropping every burst.
+        timeval timeout = { UNIX_SEND_TIMEOUT_MS / 1000, UNIX_SEND_TIMEOUT_MS % 1000 * 1000 };
+        setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
+
+    UnixDatagramSocket(in_port_t port) : UnixDatagramSocket() {
+        bound = port;
+        sockaddr_un address;
+        socklen_t length = addressOf(port, address);
+        if (bind(socket_fd, reinterpret_cast<const sockaddr*>(&address), length) < 0) {
+            close(socket_fd);
+            throw std::runtime_error(std::string("socket bind failed: ") + strerror(errno));
+        }
+    }
+
+    ~UnixDatagramSocket() {
+        close(socket_fd);
+    }
+
+    UnixDatagramSocket(const UnixDatagramSocket&) = delete;
+    UnixDatagramSocket& operator=(const UnixDatagramSocket&) = delete;
+
+    // Like UDP, a message to a port no one is bound to, or to a receiver that stays full, is dropped.
+    ssize_t send(DatagramPacket& packet) {
+        sockaddr_un address;
+        socklen_t length = addressOf(packet.getPort(), address);
+        ssize_t sent = sendto(socket_fd, packet.getData(), packet.getLength(), 0,
+                              reinterpret_cast<const sockaddr*>(&address), length);
+        if (sent == -1) {
+            if (errno == ECONNREFUSED || errno == ENOENT || errno == EAGAIN) {
+                return 0;
+            }
+            throw std::runtime_error(std::string("sendto failed: ") + strerror(errno));
+        }
+        return sent;
+    }
+
+    // 0 waits for ever.
+    void setSoTimeout(int ms) {
+        timeval timeout = { ms / 1000, ms % 1000 * 1000 };
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+            throw std::runtime_error(std::string("setsockopt failed: ") + strerror(errno));
+        }
+    }
+
+    // Returns false if the timeout expired first.
+    bool receive(DatagramPacket& packet) {
+        size_t capacity = std::distance(packet.begin(), packet.end());
+        ssize_t received = recv(socket_fd, packet.getData(), capacity, MSG_TRUNC);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return false;
+            }
+            throw std::runtime_error(std::string("recv failed: ") + strerror(errno));
+        }
+        packet.setLength(received);
+        return true;
+    }
+
+    // Returns false if no datagram is waiting.
+    bool tryReceive(DatagramPacket& packet) {
+        size_t capacity = std::distance(packet.begin(), packet.end());
+        ssize_t received = recv(socket_fd, packet.getData(), capacity, MSG_DONTWAIT | MSG_TRUNC);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            }
+            throw std::runtime_error(std::string("recv failed: ") + strerror(errno));
+        }
+        packet.setLength(received);
+        return true;
+    }
+
+    int receiveBatch(std::vector<DatagramPacket>& packets) {
+        return receiveMany(packets, MSG_WAITFORONE | MSG_TRUNC);
+    }
+
+    int tryReceiveBatch(std::vector<DatagramPacket>& packets) {
+        return receiveMany(packets, MSG_DONTWAIT | MSG_TRUNC);
+    }
+
+    // Drops the same messages send() would drop and counts them as sent.
+    int sendBatch(std::vector<DatagramPacket>& packets) {
+        size_t sent = 0;
+        while (sent < packets.size()) {
+            mmsghdr messages[DATAGRAM_BATCH_MAX];
+            iovec buffers[DATAGRAM_BATCH_MAX];
+            sockaddr_un addresses[DATAGRAM_BATCH_MAX];
+            size_t count = std::min(packets.size() - sent, static_cast<size_t>(DATAGRAM_BATCH_MAX));
+            memset(messages, 0, sizeof(messages));
+            for (size_t i = 0; i < count; i++) {
+                DatagramPacket& packet = packets[sent + i];
+                buffers[i] = { packet.getData(), packet.getLength() };
+                messages[i].msg_hdr.msg_iov = &buffers[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+                messages[i].msg_hdr.msg_name = &addresses[i];
+                messages[i].msg_hdr.msg_namelen = addressOf(packet.getPort(), addresses[i]);
+            }
+            int n = sendmmsg(socket_fd, messages, count, 0);
+            if (n < 0) {
+                if (errno != ECONNREFUSED && errno != ENOENT && errno != EAGAIN) {
+                    throw std::runtime_error(std::string("sendmmsg failed: ") + strerror(errno));
+                }
+                n = 1;      // the first message was dropped; carry on with the next
+            }
+            sent += n;
+        }
+        return sent;
+    }
+
+    int fd() const { return socket_fd; }
+
+    in_port_t localPort() const { return bound; }
+
+private:
+    int receiveMany(std::vector<DatagramPacket>& packets, int flags) {
+        mmsghdr messages[DATAGRAM_BATCH_MAX];
+        iovec buffers[DATAGRAM_BATCH_MAX];
+        size_t count = std::min(packets.size(), static_cast<size_t>(DATAGRAM_BATCH_MAX));
+        memset(messages, 0, sizeof(messages));
+        for (size_t i = 0; i < count; i++) {
+            buffers[i] = { packets[i].getData(), static_cast<size_t>(std::distance(packets[i].begin(), packets[i].end())) };
+            messages[i].msg_hdr.msg_iov = &buffers[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int received = recvmmsg(socket_fd, messages, count, flags, nullptr);
+        if (received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                return 0;
+            }
+            throw std::runtime_error(std::string("recvmmsg failed: ") + strerror(errno));
+        }
+        for (int i = 0; i < received; i++) {
+            packets[i].setLength(messages[i].msg_len);
+        }
+        return received;
+    }
+};
+
+// Ports as lock-free queues between threads of one process, so the whole system can run as a
+// single program. Messages sent before the port is bound wait for the receiver.
+class InProcessSocket {
+private:
+    struct Message {
+        uint16_t length;
+        uint8_t data[INPROCESS_MESSAGE_BYTES];
+    };
+
+    struct Mailbox {
+        RingQueue<Message> queue{INPROCESS_QUEUE_CAPACITY};
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<int> waiting{0};    // receivers parked on the condition variable
+    };
+
+    std::shared_ptr<Mailbox> inbox;     // null for a send-only socket
+    in_port_t bound = 0;
+    int timeoutMs = 0;                  // 0 waits for ever
+
+    // Mailboxes are never removed from the map, so each thread keeps the ones it has sent to and
+    // only takes the map's lock for a port it has not seen.
+    static Mailbox& destination(int port) {
+        thread_local std::map<int, std::shared_ptr<Mailbox>> known;
+        std::shared_ptr<Mailbox>& box = known[port];
+        if (!box) {
+            box = mailbox(port);
+        }
+        return *box;
+    }
+
+    static std::shared_ptr<Mailbox> mailbox(int port) {
+        static std::mutex mtx;
+        static std::map<int, std::shared_ptr<Mailbox>> mailboxes;
+        std::lock_guard<std::mutex> lock(mtx);
+        std::shared_ptr<Mailbox>& box = mailboxes[port];
+        if (!box) {
+            box = std::make_shared<Mailbox>();
+        }
+        return box;
+    }
+
+public:
+    InProcessSocket() {}
+
+    InProcessSocket(in_port_t port) : inbox(mailbox(port)), bound(port) {}
+
+    in_port_t localPort() const {
+        return bound;
+    }
+
+    // Unbinding discards what is left unread, so the next socket on the port starts empty.
+    ~InProcessSocket() {
+        if (inbox) {
+            while (inbox->queue.tryPop()) {}
+        }
+    }
+
+    InProcessSocket(const InProcessSocket&) = delete;
+    InProcessSocket& operator=(const InProcessSocket&) = delete;
+
+    ssize_t send(DatagramPacket& packet) {
+        if (packet.getLength() > INPROCESS_MESSAGE_BYTES) {
+            throw std::runtime_error("message of " + std::to_string(packet.getLength()) + " bytes is too long for an in-process port");
+        }
+        Mailbox& box = destination(packet.getPort());
+        Message message;
+        message.length = packet.getLength();
+        memcpy(message.data, packet.getData(), packet.getLength());
+        if (!box.queue.tryPush(message)) {
+            return 0;
+        }
+        // Pairs with the increment of `waiting` in receive() so a parked receiver is never missed.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (box.waiting.load() > 0) {
+            std::lock_guard<std::mutex> lock(box.mtx);
+            box.cv.notify_one();
+        }
+        return packet.getLength();
+    }
+
+    void setSoTimeout(int ms) {
+        timeoutMs = ms;
+    }
+
+    // Returns false if the timeout expired first.
+    bool receive(DatagramPacket& packet) {
+        if (!inbox) {
+            throw std::runtime_error("receive on an unbound in-process socket");
+        }
+        std::optional<Message> message = inbox->queue.tryPop();
+        for (int spin = 0; !message && spin < 64; spin++) {
+            std::this_thread::yield();
+            message = inbox->queue.tryPop();
+        }
+        if (!message) {
+            auto arrived = [&] { message = inbox->queue.tryPop(); return message.has_value(); };
+            std::unique_lock<std::mutex> lock(inbox->mtx);
+            inbox->waiting++;
+            if (timeoutMs > 0) {
+                inbox->cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), arrived);
+            } else {
+                inbox->cv.wait(lock, arrived);
+            }
+            inbox->waiting--;
+            if (!message) {
+                return false;
+            }
+        }
+        copyOut(*message, packet);
+        return true;
+    }
+
+    bool tryReceive(DatagramPacket& packet) {
+        if (!inbox) {
+            throw std::runtime_error("receive on an unbound in-process socket");
+        }
+        std::optional<Message> message = inbox->queue.tryPop();
+        if (message) {
+            copyOut(*message, packet);
+        }
+        return message.has_value();
+    }
+
+    int receiveBatch(std::vector<DatagramPacket>& packets) {
+        if (packets.empty() || !receive(packets[0])) {
+            return 0;
+        }
+        return 1 + tryReceiveRange(packets, 1);
+    }
+
+    int tryReceiveBatch(std::vector<DatagramPacket>& packets) {
+        return tryReceiveRange(packets, 0);
+    }
+
+    int sendBatch(std::vector<DatagramPacket>& packets) {
+        for (DatagramPacket& packet : packets) {
+            send(packet);
+        }
+        return packets.size();
+    }
+
+private:
+    static void copyOut(const Message& message, DatagramPacket& packet) {
+        size_t capacity = std::distance(packet.begin(), packet.end());
+        memcpy(packet.getData(), message.data, std::min<size_t>(message.length, capacity));
+        packet.setLength(message.length);
+    }
+
+    int tryReceiveRange(std::vector<DatagramPacket>& packets, size_t first) {
+        size_t count = std::min(packets.size(), static_cast<size_t>(DATAGRAM_BATCH_MAX));
+        size_t i = first;
+        while (i < count && tryReceive(packets[i])) {
+            i++;
+        }
+        return i - first;
+    }
+};
+
+#endif // TRANSPORT_H
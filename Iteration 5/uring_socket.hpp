@@ -0,0 +1,616 @@
+#ifndef URING_SOCKET_H
+#define URING_SOCKET_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Datagram1.h"
+
+#define URING_ENTRIES 128           // submission queue entries; the completion queue gets twice as many
+#define URING_BUFFER_COUNT 256      // receive buffers handed to the kernel, a power of two
+#define URING_BUFFER_BYTES 128      // recvmsg header, source address and payload
+#define URING_SEND_SLOTS 64         // sends in flight per socket
+#define URING_SQPOLL_IDLE_MS 50     // the polling kernel thread sleeps after this long without work
+
+// One io_uring instance: the submission and completion rings mapped into this process, driven
+// with raw system calls since liburing is not a dependency. Not thread-safe.
+//
+// When a ring is closed the kernel interrupts the next blocking call of every thread that set it
+// up or submitted to it, which the other transports would report as a receive timeout. So rings
+// are set up on a thread that exits straight away, and every ring hands its submissions to one
+// polling kernel thread shared by the whole process, which also spares a system call per send.
+class Uring {
+private:
+    int ringFd = -1;
+    void* rings = MAP_FAILED;
+    size_t ringBytes = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqeBytes = 0;
+
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqFlags;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqPending;             // tail including entries not yet published
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+
+    static int setup(unsigned entries, io_uring_params& params) {
+        return syscall(__NR_io_uring_setup, entries, &params);
+    }
+
+    // The ring that owns the shared polling thread, set up on first use and kept open for the
+    // life of the process. Negative if the kernel would not start the thread.
+    static int poller() {
+        static const int fd = [] {
+            io_uring_params params = {};
+            params.flags = IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = URING_SQPOLL_IDLE_MS;
+            return setup(1, params);
+        }();
+        return fd;
+    }
+
+    // Submits and waits as submit() describes, collecting completions if `getEvents`.
+    bool enter(unsigned waitFor, bool getEvents, const __kernel_timespec* timeout) {
+        unsigned toSubmit = sqPending - *sqTail;
+        __atomic_store_n(sqTail, sqPending, __ATOMIC_RELEASE);
+        unsigned flags = getEvents ? IORING_ENTER_GETEVENTS : 0;
+        // The polling thread picks the entries up; wake it if it has gone to sleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (toSubmit > 0 && (__atomic_load_n(sqFlags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP)) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        if (flags == 0) {
+            return true;
+        }
+        long entered;
+        if (timeout != nullptr) {
+            io_uring_getevents_arg arg = {};
+            arg.ts = reinterpret_cast<uint64_t>(timeout);
+            entered = syscall(__NR_io_uring_enter, ringFd, 0, waitFor, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+        } else {
+            entered = syscall(__NR_io_uring_enter, ringFd, 0, waitFor, flags, nullptr, 0);
+        }
+        if (entered < 0) {
+            if (errno == ETIME || errno == EINTR) {
+                return false;
+            }
+            throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqeBytes);
+        }
+        if (rings != MAP_FAILED) {
+            munmap(rings, ringBytes);
+        }
+    }
+
+public:
+    // Throws if the kernel has no io_uring, will not share a polling thread, or is too old for
+    // the features used here.
+    explicit Uring(unsigned entries) {
+        io_uring_params params = {};
+        int error = 0;
+        std::thread([&] {
+            if (poller() < 0) {
+                error = errno;
+                return;
+            }
+            params.flags = IORING_SETUP_SQPOLL | IORING_SETUP_ATTACH_WQ;
+            params.sq_thread_idle = URING_SQPOLL_IDLE_MS;
+            params.wq_fd = poller();
+            ringFd = setup(entries, params);
+            error = errno;
+        }).join();
+        if (poller() < 0) {
+            throw std::runtime_error(std::string("no io_uring polling thread: ") + strerror(error));
+        }
+        if (ringFd < 0) {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(error));
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+            close(ringFd);
+            throw std::runtime_error("io_uring lacks single-mmap rings or timed waits");
+        }
+
+        ringBytes = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                             params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        rings = mmap(nullptr, ringBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+        void* entriesMemory = mmap(nullptr, sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        sqes = static_cast<io_uring_sqe*>(entriesMemory);
+        if (rings == MAP_FAILED || entriesMemory == MAP_FAILED) {
+            std::string error = strerror(errno);
+            unmap();
+            close(ringFd);
+            throw std::runtime_error("io_uring mmap failed: " + error);
+        }
+
+        char* base = static_cast<char*>(rings);
+        sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sqFlags = reinterpret_cast<unsigned*>(base + params.sq_off.flags);
+        sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqPending = *sqTail;
+        unsigned* sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        for (unsigned i = 0; i < sqEntries; i++) {
+            sqArray[i] = i;         // submission slot i always holds entry i
+        }
+        cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+    }
+
+    ~Uring() {
+        unmap();
+        close(ringFd);
+    }
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    int fd() const { return ringFd; }
+
+    // A zeroed entry to fill in, or nullptr if the submission queue is full. submit() hands it over.
+    io_uring_sqe* nextSqe() {
+        if (sqPending - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+            return nullptr;
+        }
+        io_uring_sqe* sqe = &sqes[sqPending & sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqPending++;
+        return sqe;
+    }
+
+    // Publishes the new entries and, if `waitFor` > 0, waits until that many completions are
+    // queued or `timeout` passes. Enters the kernel only when there is something it must do.
+    // Returns false if the wait timed out or was interrupted.
+    bool submit(unsigned waitFor = 0, const __kernel_timespec* timeout = nullptr) {
+        return enter(waitFor, waitFor > 0, timeout);
+    }
+
+    // Publishes the new entries and runs completions the kernel has deferred to this thread,
+    // without waiting.
+    void flush() {
+        enter(0, true, nullptr);
+    }
+
+    // Waits for a completion without touching the submission queue, so another thread may
+    // submit meanwhile. Returns false on timeout.
+    bool wait(const __kernel_timespec* timeout) {
+        io_uring_getevents_arg arg = {};
+        arg.ts = reinterpret_cast<uint64_t>(timeout);
+        long entered = timeout != nullptr
+            ? syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg))
+            : syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (entered < 0 && errno != ETIME && errno != EINTR) {
+            throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+        }
+        return entered >= 0;
+    }
+
+    // The oldest completion, left in the queue until advance().
+    io_uring_cqe* peek() {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            return nullptr;
+        }
+        return &cqes[head & cqMask];
+    }
+
+    void advance() {
+        __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+    }
+
+    // An entry to fill in, submitting what is queued to make room if the queue is full.
+    io_uring_sqe* nextSqeOrSubmit() {
+        io_uring_sqe* sqe = nextSqe();
+        while (sqe == nullptr) {
+            submit();
+            std::this_thread::yield();      // the polling thread frees entries as it takes them
+            sqe = nextSqe();
+        }
+        return sqe;
+    }
+};
+
+// The DatagramSocket interface over io_uring. A bound socket keeps one multishot recvmsg armed
+// over a pool of buffers the kernel picks from, so under load datagrams are read from the completion
+// queue without a system call. A send-only socket queues each send and returns without waiting
+// for it; the shared polling thread submits them, so sending needs no system call either. On
+// the wire it is plain UDP. Where the kernel lacks the io_uring features used, or
+// ELEVATOR_URING=off, every call takes the recvfrom/sendto path of DatagramSocket instead.
+// Only worth choosing with a spare core for the polling thread; see bench_datagram.
+class UringDatagramSocket {
+private:
+    static constexpr uint64_t RECEIVE_TAG = 1;
+    static constexpr uint64_t CANCEL_TAG = 2;
+    static constexpr uint64_t PROVIDE_TAG = 3;
+    static constexpr uint64_t SEND_TAG = 16;        // + slot number
+    static constexpr uint16_t BUFFER_GROUP = 0;
+
+    struct SendSlot {
+        msghdr message;
+        iovec buffer;
+        sockaddr_in address;
+        uint8_t data[URING_BUFFER_BYTES];
+    };
+
+    DatagramSocket socket;              // the descriptor the ring reads and writes, and the fallback
+    std::vector<uint8_t> buffers;       // URING_BUFFER_COUNT receive buffers, on loan to the kernel
+    std::unique_ptr<Uring> ring;        // null: the classic path
+    bool bound;
+    int timeoutMs = 0;
+    std::mutex mtx;
+
+    // Receiving
+    msghdr receiveHeader;
+    bool armed = false;
+
+    // Sending
+    std::vector<SendSlot> slots;
+    std::vector<int> freeSlots;
+    long sendErrors = 0;
+
+    static bool enabledByEnvironment() {
+        const char* setting = std::getenv("ELEVATOR_URING");
+        return setting == nullptr || std::string(setting) != "off";
+    }
+
+    void start() {
+        if (!enabledByEnvironment()) {
+            return;
+        }
+        try {
+            ring.reset(new Uring(URING_ENTRIES));
+            if (bound) {
+                startReceiving();
+            } else {
+                slots.resize(URING_SEND_SLOTS);
+                for (int i = URING_SEND_SLOTS - 1; i >= 0; i--) {
+                    freeSlots.push_back(i);
+                }
+            }
+        } catch (const std::runtime_error& e) {
+            fallBack(e.what());
+        }
+    }
+
+    void fallBack(const std::string& reason) {
+        static std::once_flag reported;
+        std::call_once(reported, [&] {
+            std::cerr << "[Transport] io_uring unavailable (" << reason << "), using recvfrom/sendto" << std::endl;
+        });
+        stopReceiving();
+        ring.reset();
+    }
+
+    void startReceiving() {
+        buffers.resize(URING_BUFFER_COUNT * URING_BUFFER_BYTES);
+        provide(0, URING_BUFFER_COUNT);
+        memset(&receiveHeader, 0, sizeof(receiveHeader));
+        receiveHeader.msg_namelen = sizeof(sockaddr_in);
+        arm();
+        // A kernel without multishot recvmsg rejects the request as soon as it is submitted.
+        ring->flush();
+        while (io_uring_cqe* cqe = ring->peek()) {
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            uint64_t tag = cqe->user_data;
+            ring->advance();
+            if (tag == RECEIVE_TAG && (flags & IORING_CQE_F_BUFFER)) {
+                provide(flags >> IORING_CQE_BUFFER_SHIFT, 1);      // too early for anyone to be listening
+            }
+            if (result < 0 && tag == PROVIDE_TAG) {
+                throw std::runtime_error(std::string("providing receive buffers failed: ") + strerror(-result));
+            }
+            if (result < 0 && tag == RECEIVE_TAG) {
+                armed = false;
+                throw std::runtime_error(std::string("multishot recvmsg failed: ") + strerror(-result));
+            }
+        }
+    }
+
+    // Cancels the armed receive and waits for the kernel to let go of the buffers.
+    void stopReceiving() {
+        if (ring && armed) {
+            io_uring_sqe* sqe = ring->nextSqeOrSubmit();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = RECEIVE_TAG;
+            sqe->user_data = CANCEL_TAG;
+            __kernel_timespec wait = { 0, 100000000 };
+            for (int round = 0; armed && round < 10; round++) {
+                ring->submit(1, &wait);
+                while (io_uring_cqe* cqe = ring->peek()) {
+                    if (cqe->user_data == RECEIVE_TAG && !(cqe->flags & IORING_CQE_F_MORE)) {
+                        armed = false;
+                    }
+                    ring->advance();
+                }
+            }
+        }
+    }
+
+    // Lends buffers first..first+count-1 to the kernel to receive into. Queued with the next submit.
+    // (Buffer rings registered with IORING_REGISTER_PBUF_RING would save the entry, but not every
+    // kernel that has them selects from them for recvmsg.)
+    void provide(int first, int count) {
+        io_uring_sqe* sqe = ring->nextSqeOrSubmit();
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = count;
+        sqe->addr = reinterpret_cast<uint64_t>(buffers.data() + first * URING_BUFFER_BYTES);
+        sqe->len = URING_BUFFER_BYTES;
+        sqe->off = first;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = PROVIDE_TAG;
+    }
+
+    void arm() {
+        io_uring_sqe* sqe = ring->nextSqeOrSubmit();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = socket.fd();
+        sqe->addr = reinterpret_cast<uint64_t>(&receiveHeader);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = RECEIVE_TAG;
+        ring->submit();
+        armed = true;
+    }
+
+    // Copies out the next received datagram, if one has completed. Caller holds mtx.
+    bool take(DatagramPacket& packet) {
+        while (io_uring_cqe* cqe = ring->peek()) {
+            int result = cqe->res;
+            unsigned flags = cqe->flags;
+            bool receive = cqe->user_data == RECEIVE_TAG;
+            ring->advance();
+            if (!receive) {
+                continue;
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                armed = false;
+            }
+            if (result < 0) {
+                if (result == -ENOBUFS) {
+                    continue;       // every buffer was in use; re-armed below
+                }
+                throw std::runtime_error(std::string("io_uring recvmsg failed: ") + strerror(-result));
+            }
+            int id = flags >> IORING_CQE_BUFFER_SHIFT;
+            uint8_t* buffer = buffers.data() + id * URING_BUFFER_BYTES;
+            io_uring_recvmsg_out* out = reinterpret_cast<io_uring_recvmsg_out*>(buffer);
+            size_t offset = sizeof(*out) + receiveHeader.msg_namelen + receiveHeader.msg_controllen;
+            size_t stored = result > static_cast<int>(offset) ? result - offset : 0;
+            size_t capacity = std::distance(packet.begin(), packet.end());
+            memcpy(packet.getData(), buffer + offset, std::min(stored, capacity));
+            if (out->namelen >= sizeof(sockaddr_in)) {
+                memcpy(packet.address(), buffer + sizeof(*out), sizeof(sockaddr_in));
+            }
+            packet.setLength(out->payloadlen);      // flags a truncated datagram, like MSG_TRUNC
+            provide(id, 1);
+            if (!armed) {
+                arm();
+            }
+            return true;
+        }
+        if (!armed) {
+            arm();
+        }
+        return false;
+    }
+
+    int takeRange(std::vector<DatagramPacket>& packets, size_t first) {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t count = std::min(packets.size(), static_cast<size_t>(DATAGRAM_BATCH_MAX));
+        size_t i = first;
+        while (i < count && take(packets[i])) {
+            i++;
+        }
+        if (i == first && i < count) {
+            ring->flush();
+            while (i < count && take(packets[i])) {
+                i++;
+            }
+        }
+        return i - first;
+    }
+
+    // Frees the slots of finished sends. Caller holds mtx.
+    void reap() {
+        while (io_uring_cqe* cqe = ring->peek()) {
+            if (cqe->user_data >= SEND_TAG) {
+                freeSlots.push_back(cqe->user_data - SEND_TAG);
+                if (cqe->res < 0) {
+                    sendErrors++;
+                }
+            }
+            ring->advance();
+        }
+    }
+
+    // Queues one send; submit() hands it to the kernel. Caller holds mtx.
+    void queue(DatagramPacket& packet) {
+        if (packet.getLength() > URING_BUFFER_BYTES) {
+            throw std::runtime_error("message of " + std::to_string(packet.getLength()) + " bytes is too long for an io_uring send slot");
+        }
+        reap();
+        while (freeSlots.empty()) {
+            ring->submit(1);
+            reap();
+        }
+        int id = freeSlots.back();
+        freeSlots.pop_back();
+        SendSlot& slot = slots[id];
+        memcpy(slot.data, packet.getData(), packet.getLength());
+        memcpy(&slot.address, packet.address(), sizeof(slot.address));
+        slot.buffer = { slot.data, packet.getLength() };
+        memset(&slot.message, 0, sizeof(slot.message));
+        slot.message.msg_name = &slot.address;
+        slot.message.msg_namelen = sizeof(slot.address);
+        slot.message.msg_iov = &slot.buffer;
+        slot.message.msg_iovlen = 1;
+
+        io_uring_sqe* sqe = ring->nextSqeOrSubmit();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = socket.fd();
+        sqe->addr = reinterpret_cast<uint64_t>(&slot.message);
+        sqe->len = 1;
+        sqe->user_data = SEND_TAG + id;
+    }
+
+public:
+    // Send-only socket.
+    UringDatagramSocket() : socket(), bound(false) {
+        start();
+    }
+
+    UringDatagramSocket(in_port_t port, bool reusePort = false) : socket(port, reusePort), bound(true) {
+        start();
+    }
+
+    ~UringDatagramSocket() {
+        if (ring && !bound) {
+            // Let queued sends finish before their slots go away.
+            __kernel_timespec wait = { 0, 100000000 };
+            for (int round = 0; freeSlots.size() < slots.size() && round < 10; round++) {
+                ring->submit(1, &wait);
+                reap();
+            }
+        }
+        stopReceiving();
+    }
+
+    UringDatagramSocket(const UringDatagramSocket&) = delete;
+    UringDatagramSocket& operator=(const UringDatagramSocket&) = delete;
+
+    // Whether io_uring is in use rather than the classic path.
+    bool usesRing() const { return ring != nullptr; }
+
+    static bool canSharePort(int port) { return DatagramSocket::canSharePort(port); }
+
+    in_port_t localPort() const { return socket.localPort(); }
+
+    // Sends that failed after send() had returned.
+    long getSendErrors() const { return sendErrors; }
+
+    // A bound socket sends on the classic path; its ring only receives.
+    ssize_t send(DatagramPacket& packet) {
+        if (!ring || bound) {
+            return socket.send(packet);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        queue(packet);
+        ring->submit();
+        return packet.getLength();
+    }
+
+    int sendBatch(std::vector<DatagramPacket>& packets) {
+        if (!ring || bound) {
+            return socket.sendBatch(packets);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        for (DatagramPacket& packet : packets) {
+            queue(packet);
+        }
+        ring->submit();
+        return packets.size();
+    }
+
+    void setSoTimeout(int ms) {
+        timeoutMs = ms;
+        socket.setSoTimeout(ms);
+    }
+
+    // Returns false if the timeout expired first.
+    bool receive(DatagramPacket& packet) {
+        std::unique_lock<std::mutex> lock(mtx);
+        if (!ring) {
+            lock.unlock();
+            return socket.receive(packet);
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (true) {
+            if (take(packet)) {
+                return true;
+            }
+            __kernel_timespec wait = {};
+            if (timeoutMs > 0) {
+                auto left = deadline - std::chrono::steady_clock::now();
+                if (left <= std::chrono::steady_clock::duration::zero()) {
+                    return false;
+                }
+                long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+                wait.tv_sec = ns / 1000000000;
+                wait.tv_nsec = ns % 1000000000;
+            }
+            // Other threads may take completions while this one waits for them.
+            ring->submit();
+            lock.unlock();
+            ring->wait(timeoutMs > 0 ? &wait : nullptr);
+            lock.lock();
+        }
+    }
+
+    bool tryReceive(DatagramPacket& packet) {
+        if (!ring) {
+            return socket.tryReceive(packet);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        if (take(packet)) {
+            return true;
+        }
+        ring->flush();
+        return take(packet);
+    }
+
+    int receiveBatch(std::vector<DatagramPacket>& packets) {
+        if (!ring) {
+            return socket.receiveBatch(packets);
+        }
+        if (packets.empty() || !receive(packets[0])) {
+            return 0;
+        }
+        return 1 + takeRange(packets, 1);
+    }
+
+    int tryReceiveBatch(std::vector<DatagramPacket>& packets) {
+        if (!ring) {
+            return socket.tryReceiveBatch(packets);
+        }
+        return takeRange(packets, 0);
+    }
+
+    // The ring's descriptor is readable while completions are queued, so an event loop waits on it.
+    int fd() const {
+        return ring ? ring->fd() : socket.fd();
+    }
+};
+
+#endif // URING_SOCKET_H